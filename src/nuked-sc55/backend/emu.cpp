@@ -33,12 +33,18 @@
  */
 
 #include "emu.h"
+#include "hotspot.h"
 #include "lcd.h"
 #include "mcu.h"
+#include "mcu_block.h"
 #include "mcu_timer.h"
 #include "pcm.h"
+#include "profile.h"
 #include "submcu.h"
-#include <bit>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <span>
 #include <vector>
@@ -59,6 +65,12 @@ bool Emulator::Init(const EMU_Options& options)
         m_timer = std::make_unique<mcu_timer_t>();
         m_lcd   = std::make_unique<lcd_t>();
         m_pcm   = std::make_unique<pcm_t>();
+        m_midi_in = std::make_unique<MidiInputQueue>(EMU_MIDI_QUEUE_SIZE);
+
+        if (options.block_engine)
+        {
+            m_blocks = std::make_unique<mcu_block_cache_t>();
+        }
     }
     catch (const std::bad_alloc&)
     {
@@ -67,6 +79,8 @@ bool Emulator::Init(const EMU_Options& options)
         m_timer.reset();
         m_lcd.reset();
         m_pcm.reset();
+        m_midi_in.reset();
+        m_blocks.reset();
         return false;
     }
 
@@ -77,6 +91,9 @@ bool Emulator::Init(const EMU_Options& options)
     LCD_Init(*m_lcd, *m_mcu);
     m_lcd->backend = options.lcd_backend;
 
+    m_roms = GetEmptyRomImages();
+    AttachRoms(*m_roms);
+
     return true;
 }
 
@@ -84,6 +101,7 @@ void Emulator::Reset()
 {
     MCU_Reset(*m_mcu);
     SM_Reset(*m_sm);
+    m_mcu->has_render_overflow = false;
 }
 
 bool Emulator::StartLCD()
@@ -109,32 +127,35 @@ bool Emulator::LoadRoms(Romset romset, const AllRomsetInfo& all_info, RomLocatio
         loaded->fill(false);
     }
 
-    MCU_SetRomset(GetMCU(), romset);
-
-    const RomsetInfo& info = all_info.romsets[(size_t)romset];
-
-    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    std::shared_ptr<const RomImages> images = AcquireRomImages(romset, all_info.romsets[(size_t)romset]);
+    if (!images)
     {
-        const RomLocation location = (RomLocation)i;
+        return false;
+    }
 
-        // rom_data should be populated at this point
-        // if it isn't, then there isn't a rom for this location
-        if (info.rom_data[i].empty())
+    if (loaded)
+    {
+        for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
         {
-            continue;
+            (*loaded)[i] = images->size[i] != 0;
         }
+    }
 
-        if (!LoadRom(location, info.rom_data[i]))
-        {
-            return false;
-        }
+    return LoadRoms(std::move(images));
+}
 
-        if (loaded)
-        {
-            (*loaded)[i] = true;
-        }
+bool Emulator::LoadRoms(std::shared_ptr<const RomImages> images)
+{
+    if (!images)
+    {
+        return false;
     }
 
+    MCU_SetRomset(GetMCU(), images->romset);
+
+    m_roms = std::move(images);
+    AttachRoms(*m_roms);
+
     if (m_mcu->is_jv880)
     {
         LoadNVRAM();
@@ -145,17 +166,66 @@ bool Emulator::LoadRoms(Romset romset, const AllRomsetInfo& all_info, RomLocatio
     return true;
 }
 
-void Emulator::PostMIDI(uint8_t byte)
+bool Emulator::PostMIDI(uint8_t byte)
+{
+    return PostMIDI(std::span{&byte, 1});
+}
+
+bool Emulator::PostMIDI(std::span<const uint8_t> data)
 {
-    MCU_PostUART(*m_mcu, byte);
+    return m_midi_in->Push(data, false, 0.0);
 }
 
-void Emulator::PostMIDI(std::span<const uint8_t> data)
+bool Emulator::PostMIDI(std::span<const uint8_t> data, double delay_frames)
 {
-    for (uint8_t byte : data)
+    return m_midi_in->Push(data, true, delay_frames);
+}
+
+// 31250 baud, 10 bits per byte including the start and stop bits
+constexpr double MIDI_BYTES_PER_SECOND = 3125.0;
+
+void Emulator::ReceiveMIDI()
+{
+    mcu_t& mcu = *m_mcu;
+    const pcm_t& pcm = *m_pcm;
+
+    MidiInputByte in;
+    if (!m_midi_in->Peek(in))
     {
-        PostMIDI(byte);
+        return;
     }
+
+    const double cycles_per_frame = PCM_GetCyclesPerFrame(pcm);
+    const uint64_t cycles_per_byte =
+        (uint64_t)(cycles_per_frame * PCM_GetOutputFrequency(pcm) / MIDI_BYTES_PER_SECOND);
+
+    do
+    {
+        uint64_t time = 0;
+        if (in.timed)
+        {
+            // A frame left over from the last render has been produced already
+            double delay_frames = mcu.has_render_overflow ? in.delay_frames - 1.0 : in.delay_frames;
+
+            // pcm.cycles is the cycle at which the frame after the last rendered one starts
+            time = pcm.cycles + (uint64_t)(std::max(delay_frames, 0.0) * cycles_per_frame);
+            time = std::max(time, mcu.uart_post_time);
+        }
+
+        // Leave the rest in the queue until the firmware has caught up
+        if (!MCU_PostUART(mcu, in.data, time))
+        {
+            return;
+        }
+
+        if (in.timed)
+        {
+            mcu.uart_post_time = time + cycles_per_byte;
+        }
+
+        m_midi_in->Pop();
+        PROFILE_COUNT(MIDI_BYTES, 1);
+    } while (m_midi_in->Peek(in));
 }
 
 constexpr uint8_t GM_RESET_SEQ[] = { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
@@ -177,11 +247,180 @@ void Emulator::PostSystemReset(EMU_SystemReset reset)
     }
 }
 
+// Steps after the reset until the firmware has finished starting up; skips the bootup delay of the real devices
+constexpr size_t EMU_BOOT_STEPS_MK2   = 9'500'000;
+constexpr size_t EMU_BOOT_STEPS_OTHER = 700'000;
+
+void Emulator::Boot(EMU_SystemReset reset)
+{
+    Reset();
+    m_pcm->disable_oversampling = true;
+    PostSystemReset(reset);
+
+    const size_t num_steps = (m_mcu->romset == Romset::MK2) ? EMU_BOOT_STEPS_MK2 : EMU_BOOT_STEPS_OTHER;
+
+    for (size_t i = 0; i < num_steps; i++)
+    {
+        Step();
+    }
+}
+
+bool Emulator::IsSilent(int32_t threshold) const
+{
+    if (!m_midi_in->IsEmpty() || MCU_HasPendingUART(*m_mcu) || m_sm->uart_rx_gotbyte)
+        return false;
+
+    return PCM_IsSilent(*m_pcm, threshold);
+}
+
 void Emulator::Step()
 {
+    ReceiveMIDI();
     MCU_Step(*m_mcu);
 }
 
+void Emulator::RenderFrames(std::span<AudioFrame<int32_t>> out)
+{
+    mcu_t& mcu = *m_mcu;
+
+    ReceiveMIDI();
+
+    size_t pos = 0;
+    if (mcu.has_render_overflow && !out.empty())
+    {
+        out[pos++] = mcu.render_overflow;
+        mcu.has_render_overflow = false;
+    }
+
+    mcu.render_frames = out.data();
+    mcu.render_frames_pos = pos;
+    mcu.render_frames_count = out.size();
+
+    (this->*m_run)();
+
+    mcu.render_frames = nullptr;
+
+    PROFILE_COUNT(RENDERED_FRAMES, out.size());
+    PROFILE_Publish();
+    HOTSPOT_Publish();
+}
+
+void Emulator::RenderFrames(float* left, float* right, size_t count)
+{
+    mcu_t& mcu = *m_mcu;
+
+    ReceiveMIDI();
+
+    size_t pos = 0;
+    if (mcu.has_render_overflow && count != 0)
+    {
+        AudioFrame<float> out;
+        Normalize(mcu.render_overflow, out);
+        left[pos] = out.left;
+        right[pos] = out.right;
+        pos++;
+        mcu.has_render_overflow = false;
+    }
+
+    mcu.render_left = left;
+    mcu.render_right = right;
+    mcu.render_frames_pos = pos;
+    mcu.render_frames_count = count;
+
+    (this->*m_run)();
+
+    mcu.render_left = nullptr;
+    mcu.render_right = nullptr;
+
+    PROFILE_COUNT(RENDERED_FRAMES, count);
+    PROFILE_Publish();
+    HOTSPOT_Publish();
+}
+
+template <typename Model>
+void Emulator::Run()
+{
+    mcu_t& mcu = *m_mcu;
+
+    if (m_blocks)
+    {
+        while (mcu.render_frames_pos < mcu.render_frames_count)
+        {
+            StepBlock<Model>();
+        }
+    }
+    else
+    {
+        while (mcu.render_frames_pos < mcu.render_frames_count)
+        {
+            MCU_Step<Model>(mcu);
+        }
+    }
+}
+
+template <typename T>
+static void SaveChipState(std::vector<uint8_t>& dest, const T& chip, size_t begin, size_t end)
+{
+    const uint8_t* src = (const uint8_t*)&chip;
+    dest.assign(src + begin, src + end);
+}
+
+template <typename T>
+static void RestoreChipState(T& chip, const std::vector<uint8_t>& src, size_t begin)
+{
+    memcpy((uint8_t*)&chip + begin, src.data(), src.size());
+}
+
+void Emulator::SaveSnapshot(EMU_Snapshot& snapshot) const
+{
+    snapshot.romset = m_mcu->romset;
+
+    SaveChipState(snapshot.mcu, *m_mcu, 0, MCU_STATE_SIZE);
+    SaveChipState(snapshot.sm, *m_sm, 0, SM_STATE_SIZE);
+    SaveChipState(snapshot.timer, *m_timer, 0, TIMER_STATE_SIZE);
+    SaveChipState(snapshot.pcm, *m_pcm, 0, PCM_STATE_SIZE);
+    SaveChipState(snapshot.lcd, *m_lcd, LCD_STATE_BEGIN, LCD_STATE_END);
+    snapshot.lcd_enable = m_lcd->enable;
+}
+
+bool Emulator::RestoreSnapshot(const EMU_Snapshot& snapshot)
+{
+    if (snapshot.romset != m_mcu->romset || snapshot.mcu.size() != MCU_STATE_SIZE)
+    {
+        return false;
+    }
+
+    // The NVRAM loaded from nvram_filename belongs to the user, not to the snapshot. It is still saved, so that
+    // RestoreState can rewind it.
+    const bool keep_nvram = !m_options.nvram_filename.empty() && m_mcu->is_jv880;
+    RestoreState(snapshot, keep_nvram);
+
+    return true;
+}
+
+void Emulator::RestoreState(const EMU_Snapshot& snapshot, bool keep_nvram)
+{
+    if (keep_nvram)
+    {
+        const size_t nvram_begin = offsetof(mcu_t, nvram);
+        const size_t nvram_end   = nvram_begin + NVRAM_SIZE;
+        memcpy((uint8_t*)m_mcu.get(), snapshot.mcu.data(), nvram_begin);
+        memcpy((uint8_t*)m_mcu.get() + nvram_end, snapshot.mcu.data() + nvram_end, MCU_STATE_SIZE - nvram_end);
+    }
+    else
+    {
+        RestoreChipState(*m_mcu, snapshot.mcu, 0);
+    }
+    RestoreChipState(*m_sm, snapshot.sm, 0);
+    RestoreChipState(*m_timer, snapshot.timer, 0);
+    RestoreChipState(*m_pcm, snapshot.pcm, 0);
+    RestoreChipState(*m_lcd, snapshot.lcd, LCD_STATE_BEGIN);
+    m_lcd->enable = snapshot.lcd_enable;
+    m_mcu->has_render_overflow = false;
+    MCU_InvalidateDeadlines(*m_mcu);
+    MCU_UpdateMemoryMap(*m_mcu);
+}
+
 void Emulator::SaveNVRAM()
 {
     // emulator was constructed, but never init
@@ -206,55 +445,82 @@ void Emulator::LoadNVRAM()
     }
 }
 
-std::span<uint8_t> Emulator::MapBuffer(RomLocation location)
+void Emulator::AttachRoms(const RomImages& images)
 {
-    switch (location)
+    m_mcu->rom1 = images.data[(size_t)RomLocation::ROM1];
+    m_mcu->rom2 = images.data[(size_t)RomLocation::ROM2];
+    m_sm->rom   = images.data[(size_t)RomLocation::SMROM];
+
+    m_pcm->waverom1     = images.data[(size_t)RomLocation::WAVEROM1];
+    m_pcm->waverom2     = images.data[(size_t)RomLocation::WAVEROM2];
+    m_pcm->waverom3     = images.data[(size_t)RomLocation::WAVEROM3];
+    m_pcm->waverom_card = images.data[(size_t)RomLocation::WAVEROM_CARD];
+    m_pcm->waverom_exp  = images.data[(size_t)RomLocation::WAVEROM_EXP];
+
+    const size_t rom2_size = images.size[(size_t)RomLocation::ROM2];
+    m_mcu->rom2_mask       = (int)(rom2_size ? rom2_size : ROM2_SIZE) - 1;
+
+    MCU_UpdateMemoryMap(*m_mcu);
+    MCU_FlushDecodeCache(*m_mcu);
+    m_run = MCU_WithModel(*m_mcu, [](auto model) { return &Emulator::Run<decltype(model)>; });
+    if (m_blocks)
     {
-    case RomLocation::ROM1:
-        return GetMCU().rom1;
-    case RomLocation::ROM2:
-        return GetMCU().rom2;
-    case RomLocation::WAVEROM1:
-        return GetPCM().waverom1;
-    case RomLocation::WAVEROM2:
-        return GetPCM().waverom2;
-    case RomLocation::WAVEROM3:
-        return GetPCM().waverom3;
-    case RomLocation::WAVEROM_CARD:
-        return GetPCM().waverom_card;
-    case RomLocation::WAVEROM_EXP:
-        return GetPCM().waverom_exp;
-    case RomLocation::SMROM:
-        return m_sm->rom;
+        MCU_FlushBlockCache(*m_blocks);
     }
-    //fprintf(stderr, "FATAL: MapBuffer called with invalid location %d\n", (int)location);
-    std::abort();
 }
 
-bool Emulator::LoadRom(RomLocation location, std::span<const uint8_t> source)
+#ifndef NUKED_SC55_BLOCK_CHECK
+template <typename Model>
+void Emulator::StepBlock()
 {
-    auto buffer = MapBuffer(location);
-
-    if (buffer.size() < source.size())
+    MCU_StepBlock<Model>(*m_mcu, *m_blocks);
+}
+#else
+// Runs the block, rewinds, and runs the same number of steps on the interpreter. The interpreter's results are kept, so
+// samples are only delivered once; the LCD backend may see some writes twice.
+template <typename Model>
+void Emulator::StepBlock()
+{
+    mcu_t& mcu = *m_mcu;
+
+    SaveSnapshot(m_check_before);
+    const size_t              render_frames_pos   = mcu.render_frames_pos;
+    const bool                has_render_overflow = mcu.has_render_overflow;
+    const AudioFrame<int32_t> render_overflow     = mcu.render_overflow;
+    const uint32_t            address             = MCU_GetAddress(mcu.cp, mcu.pc);
+    uint64_t                  deadline[MCU_DEADLINE_COUNT];
+    memcpy(deadline, mcu.deadline, sizeof(deadline));
+
+    const mcu_sample_callback sample_callback = mcu.sample_callback;
+    mcu.sample_callback = MCU_DefaultSampleCallback;
+    const uint32_t steps = MCU_StepBlock<Model>(mcu, *m_blocks);
+    mcu.sample_callback = sample_callback;
+    SaveSnapshot(m_check_block);
+
+    // The block may have written to NVRAM, so rewind all of it
+    RestoreState(m_check_before, false);
+    mcu.render_frames_pos   = render_frames_pos;
+    mcu.has_render_overflow = has_render_overflow;
+    mcu.render_overflow     = render_overflow;
+    // The timer is only clocked at its deadlines, so they must match for its state to match
+    memcpy(mcu.deadline, deadline, sizeof(deadline));
+    for (uint32_t i = 0; i < steps; ++i)
     {
-        //fprintf(stderr,
-        //        "FATAL: rom for %s is too large; max size is %d bytes\n",
-        //        ToCString(location),
-        //        (int)buffer.size());
-        return false;
+        MCU_Step<Model>(mcu);
     }
+    SaveSnapshot(m_check_interpreter);
 
-    if (location == RomLocation::ROM2)
-    {
-        if (!std::has_single_bit(source.size()))
+    const auto check = [&](const char* chip, const std::vector<uint8_t>& block, const std::vector<uint8_t>& reference) {
+        if (block != reference)
         {
-            //fprintf(stderr, "FATAL: %s requires a power-of-2 size\n", ToCString(location));
-            return false;
+            fprintf(stderr, "block engine: %s state differs after %u steps from %06x\n", chip, steps, address);
+            abort();
         }
-        GetMCU().rom2_mask = (int)source.size() - 1;
-    }
-
-    std::copy(source.begin(), source.end(), buffer.begin());
-
-    return true;
+    };
+    check("mcu", m_check_block.mcu, m_check_interpreter.mcu);
+    check("submcu", m_check_block.sm, m_check_interpreter.sm);
+    check("timer", m_check_block.timer, m_check_interpreter.timer);
+    check("pcm", m_check_block.pcm, m_check_interpreter.pcm);
+    check("lcd", m_check_block.lcd, m_check_interpreter.lcd);
 }
+#endif
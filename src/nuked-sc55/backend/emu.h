@@ -36,14 +36,18 @@
 
 #include "lcd.h"
 #include "mcu.h"
+#include "mcu_block.h"
 #include "mcu_timer.h"
+#include "midi_queue.h"
 #include "pcm.h"
 #include "rom.h"
+#include "rom_cache.h"
 #include "rom_io.h"
 #include "submcu.h"
 #include <filesystem>
 #include <memory>
 #include <span>
+#include <vector>
 
 struct EMU_Options
 {
@@ -51,10 +55,34 @@ struct EMU_Options
     // If left null, LCD processing will be skipped.
     LCD_Backend* lcd_backend = nullptr;
 
-    // If not empty, nvram will be saved to and loaded from here. JV-880 only.
+    // If not empty, nvram will be saved to and loaded from here. JV-880 only. Emulator::RestoreSnapshot then keeps the
+    // current nvram instead of the snapshot's.
     std::filesystem::path nvram_filename;
+
+    // Run the main MCU on the block engine (see mcu_block.h) in RenderFrames. Results are identical to the interpreter.
+    bool block_engine = false;
+};
+
+// Complete machine state of an emulator, excluding roms. Restoring a snapshot is a handful of memcpys, so it can be
+// used to skip the boot sequence when the same romset is started repeatedly.
+struct EMU_Snapshot
+{
+    Romset romset = Romset::MK2;
+
+    std::vector<uint8_t> mcu;
+    std::vector<uint8_t> sm;
+    std::vector<uint8_t> timer;
+    std::vector<uint8_t> pcm;
+    std::vector<uint8_t> lcd;
+    uint8_t              lcd_enable = 0;
 };
 
+// Capacity of the MIDI input queue in bytes, see Emulator::PostMIDI.
+static const size_t EMU_MIDI_QUEUE_SIZE = 8192;
+
+// Default threshold for Emulator::IsSilent, on the 20-bit scale of the delay memory (about -96 dBFS).
+static const int32_t EMU_SILENCE_THRESHOLD = 8;
+
 enum class EMU_SystemReset {
     NONE,
     GS_RESET,
@@ -88,8 +116,8 @@ public:
     // Loads roms from buffers referenced by `all_info`. If the slot for a rom in `all_info` has a non-empty `rom_data`,
     // it will be loaded even if the romset doesn't require it.
     //
-    // It is unspecified whether or not the emulator will copy `rom_data`. `all_info` should outlive the emulator
-    // instance.
+    // The roms are copied into images shared with every other emulator that loaded identical roms (see
+    // `AcquireRomImages`), so `all_info` can be purged afterwards.
     //
     // For roms that were successfully loaded, this function will set their corresponding index in `loaded` to true if
     // `loaded` is non-null.
@@ -98,24 +126,76 @@ public:
     // `IsCompleteRomset(all_info, romset)`.
     bool LoadRoms(Romset romset, const AllRomsetInfo& all_info, RomLocationSet* loaded = nullptr);
 
-    void PostMIDI(uint8_t data_byte);
-    void PostMIDI(std::span<const uint8_t> data);
+    // Loads roms from `images`. The emulator keeps a reference to `images` and reads from them directly.
+    bool LoadRoms(std::shared_ptr<const RomImages> images);
+
+    // The PostMIDI functions may be called from any thread, including concurrently with each other and with the thread
+    // running the emulator; they never block. The bytes are queued and sent to the UART at the start of the next
+    // `Step` or `RenderFrames`. Each message is queued as a whole: if it doesn't fit, it is dropped, counted in the
+    // overflow counters of `GetMIDIQueue()`, and false is returned.
+    bool PostMIDI(uint8_t data_byte);
+    bool PostMIDI(std::span<const uint8_t> data);
+
+    // Schedules `data` to start arriving `delay_frames` frames after the last frame rendered by `RenderFrames`. The
+    // bytes are spaced at the MIDI baud rate and queue up behind earlier scheduled bytes like on a real cable, so the
+    // timing only depends on the frame positions and not on how rendering is split into calls.
+    bool PostMIDI(std::span<const uint8_t> data, double delay_frames);
 
     void PostSystemReset(EMU_SystemReset reset);
 
+    // Runs the boot sequence used by the plugin and the tools: resets the machine, disables oversampling, posts `reset`
+    // and steps until the firmware is ready to play. This takes seconds for the mk2, so callers booting repeatedly
+    // should take a snapshot afterwards and restore it next time.
+    void Boot(EMU_SystemReset reset);
+
+    // Returns true if the emulator is in a silent steady state: no MIDI bytes are waiting to be read by the firmware, no
+    // voice is keyed on, and the reverb/chorus tails in the delay memory have decayed to within `threshold` of zero.
+    // Output stays silent until more MIDI is posted, so a caller may stop rendering until then.
+    bool IsSilent(int32_t threshold = EMU_SILENCE_THRESHOLD) const;
+
     void Step();
 
+    // Runs the emulator until it has produced `out.size()` frames, and writes them to `out`. The sample callback is
+    // not called for these frames.
+    void RenderFrames(std::span<AudioFrame<int32_t>> out);
+
+    // Same as above, but writes the frames as normalized floats (see `Normalize`) to `left[0..count)` and
+    // `right[0..count)`, so they can go straight to the output buffers of an audio API.
+    void RenderFrames(float* left, float* right, size_t count);
+
+    // Captures the current machine state into `snapshot`.
+    void SaveSnapshot(EMU_Snapshot& snapshot) const;
+
+    // Replaces the current machine state with `snapshot`. Fails if the snapshot was taken from an emulator with a
+    // different romset. Roms, the sample callback and the LCD backend are not affected. If a JV-880 has an
+    // `nvram_filename`, its NVRAM is left alone too, so the contents loaded from that file survive a restore of e.g. a
+    // boot snapshot; state the firmware derived from the snapshot's NVRAM during boot is restored as is.
+    bool RestoreSnapshot(const EMU_Snapshot& snapshot);
+
     mcu_t& GetMCU() { return *m_mcu; }
     pcm_t& GetPCM() { return *m_pcm; }
     lcd_t& GetLCD() { return *m_lcd; }
+    MidiInputQueue& GetMIDIQueue() { return *m_midi_in; }
 
 private:
     void SaveNVRAM();
     void LoadNVRAM();
 
-    std::span<uint8_t> MapBuffer(RomLocation location);
+    // Restores the state saved in `snapshot`, which must match this emulator; see RestoreSnapshot.
+    void RestoreState(const EMU_Snapshot& snapshot, bool keep_nvram);
+
+    void AttachRoms(const RomImages& images);
+
+    // Moves bytes from `m_midi_in` to the UART buffer.
+    void ReceiveMIDI();
 
-    bool LoadRom(RomLocation location, std::span<const uint8_t> source);
+    // Runs the emulator until `render_frames` is full.
+    template <typename Model>
+    void Run();
+
+    // Takes the steps of one block; see MCU_StepBlock.
+    template <typename Model>
+    void StepBlock();
 
 private:
     std::unique_ptr<mcu_t>       m_mcu;
@@ -123,5 +203,21 @@ private:
     std::unique_ptr<mcu_timer_t> m_timer;
     std::unique_ptr<lcd_t>       m_lcd;
     std::unique_ptr<pcm_t>       m_pcm;
+    std::unique_ptr<MidiInputQueue> m_midi_in;
     EMU_Options                  m_options;
+
+    std::shared_ptr<const RomImages> m_roms;
+
+    // Run<Model> specialized for the romset, bound in AttachRoms
+    void (Emulator::*m_run)() = nullptr;
+
+    // Only allocated if `block_engine` was requested
+    std::unique_ptr<mcu_block_cache_t> m_blocks;
+
+#ifdef NUKED_SC55_BLOCK_CHECK
+    // Lockstep check of the block engine against the interpreter
+    EMU_Snapshot m_check_before;
+    EMU_Snapshot m_check_block;
+    EMU_Snapshot m_check_interpreter;
+#endif
 };
@@ -0,0 +1,320 @@
+#include "hotspot.h"
+
+#include "mcu_opcodes.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#ifdef NUKED_SC55_HOTSPOTS
+
+// The local table is kept at most half full
+constexpr uint32_t HOTSPOT_TABLE_BITS = 16;
+constexpr uint32_t HOTSPOT_TABLE_SIZE = 1u << HOTSPOT_TABLE_BITS;
+static_assert(HOTSPOT_TABLE_SIZE >= 2 * HOTSPOT_LOCAL_CAPACITY);
+
+struct HOTSPOT_Slot
+{
+    // Address plus one, or 0 for an unused slot
+    uint32_t tag     = 0;
+    uint8_t  operand = 0;
+    int      opcode  = HOTSPOT_NO_OPCODE;
+    uint64_t samples = 0;
+};
+
+// Samples of the current thread that haven't been published yet
+struct HOTSPOT_Local
+{
+    // Open addressing with linear probing; allocated on the first sample
+    std::unique_ptr<HOTSPOT_Slot[]> slots;
+    std::vector<uint32_t>           used;
+
+    uint64_t operands[256]{};
+    uint64_t opcodes[32]{};
+    uint64_t total   = 0;
+    uint64_t dropped = 0;
+
+    uint32_t rng = 0x9e3779b9;
+};
+
+static HOTSPOT_Local& HOTSPOT_GetLocal()
+{
+    static thread_local HOTSPOT_Local local;
+    return local;
+}
+
+struct HOTSPOT_Shared
+{
+    std::mutex                                   mutex;
+    std::unordered_map<uint32_t, HOTSPOT_Address> addresses;
+
+    uint64_t operands[256]{};
+    uint64_t opcodes[32]{};
+    uint64_t total   = 0;
+    uint64_t dropped = 0;
+};
+
+static HOTSPOT_Shared g_hotspots;
+
+static uint32_t HOTSPOT_NextInterval(HOTSPOT_Local& local)
+{
+    // xorshift32
+    local.rng ^= local.rng << 13;
+    local.rng ^= local.rng >> 17;
+    local.rng ^= local.rng << 5;
+
+    // Uniform in [1, 2 * HOTSPOT_SAMPLE_INTERVAL - 1], so the mean is the nominal interval
+    return 1 + local.rng % (2 * HOTSPOT_SAMPLE_INTERVAL - 1);
+}
+
+void HOTSPOT_Record(uint32_t address, uint8_t operand, int opcode)
+{
+    HOTSPOT_Local& local = HOTSPOT_GetLocal();
+
+    HOTSPOT_GetCountdown() = HOTSPOT_NextInterval(local);
+
+    local.total++;
+    local.operands[operand]++;
+    if (opcode != HOTSPOT_NO_OPCODE)
+    {
+        local.opcodes[opcode & 0x1f]++;
+    }
+
+    if (!local.slots)
+    {
+        local.slots = std::make_unique<HOTSPOT_Slot[]>(HOTSPOT_TABLE_SIZE);
+        local.used.reserve(HOTSPOT_LOCAL_CAPACITY);
+    }
+
+    uint32_t index = (address * 0x9e3779b1u) >> (32 - HOTSPOT_TABLE_BITS);
+    while (true)
+    {
+        HOTSPOT_Slot& slot = local.slots[index];
+        if (slot.tag == address + 1)
+        {
+            slot.samples++;
+            return;
+        }
+        if (slot.tag == 0)
+        {
+            if (local.used.size() >= HOTSPOT_LOCAL_CAPACITY)
+            {
+                local.dropped++;
+                return;
+            }
+            slot = {address + 1, operand, opcode, 1};
+            local.used.push_back(index);
+            return;
+        }
+        index = (index + 1) & (HOTSPOT_TABLE_SIZE - 1);
+    }
+}
+
+void HOTSPOT_Publish()
+{
+    HOTSPOT_Local& local = HOTSPOT_GetLocal();
+    if (local.total == 0)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard lock(g_hotspots.mutex);
+
+        for (const uint32_t index : local.used)
+        {
+            const HOTSPOT_Slot& slot = local.slots[index];
+
+            HOTSPOT_Address& entry = g_hotspots.addresses[slot.tag - 1];
+            entry.address          = slot.tag - 1;
+            entry.operand          = slot.operand;
+            entry.opcode           = slot.opcode;
+            entry.samples += slot.samples;
+        }
+        for (size_t i = 0; i < std::size(local.operands); ++i)
+        {
+            g_hotspots.operands[i] += local.operands[i];
+        }
+        for (size_t i = 0; i < std::size(local.opcodes); ++i)
+        {
+            g_hotspots.opcodes[i] += local.opcodes[i];
+        }
+        g_hotspots.total += local.total;
+        g_hotspots.dropped += local.dropped;
+    }
+
+    for (const uint32_t index : local.used)
+    {
+        local.slots[index] = {};
+    }
+    local.used.clear();
+
+    std::fill(std::begin(local.operands), std::end(local.operands), 0);
+    std::fill(std::begin(local.opcodes), std::end(local.opcodes), 0);
+    local.total   = 0;
+    local.dropped = 0;
+}
+
+void HOTSPOT_Read(HOTSPOT_Stats& stats)
+{
+    stats = {};
+
+    {
+        std::lock_guard lock(g_hotspots.mutex);
+
+        stats.addresses.reserve(g_hotspots.addresses.size());
+        for (const auto& [address, entry] : g_hotspots.addresses)
+        {
+            stats.addresses.push_back(entry);
+        }
+        std::copy(std::begin(g_hotspots.operands), std::end(g_hotspots.operands), stats.operands);
+        std::copy(std::begin(g_hotspots.opcodes), std::end(g_hotspots.opcodes), stats.opcodes);
+        stats.total   = g_hotspots.total;
+        stats.dropped = g_hotspots.dropped;
+    }
+
+    std::sort(stats.addresses.begin(), stats.addresses.end(), [](const HOTSPOT_Address& a, const HOTSPOT_Address& b) {
+        return a.samples != b.samples ? a.samples > b.samples : a.address < b.address;
+    });
+}
+
+void HOTSPOT_Reset()
+{
+    std::lock_guard lock(g_hotspots.mutex);
+
+    g_hotspots.addresses.clear();
+    std::fill(std::begin(g_hotspots.operands), std::end(g_hotspots.operands), 0);
+    std::fill(std::begin(g_hotspots.opcodes), std::end(g_hotspots.opcodes), 0);
+    g_hotspots.total   = 0;
+    g_hotspots.dropped = 0;
+}
+
+#else
+
+void HOTSPOT_Read(HOTSPOT_Stats& stats)
+{
+    stats = {};
+}
+
+void HOTSPOT_Reset()
+{
+}
+
+#endif
+
+static const char* HOTSPOT_HandlerName(const HOTSPOT_Address& entry)
+{
+    if (entry.opcode != HOTSPOT_NO_OPCODE)
+    {
+        return MCU_OpcodeHandlerName((uint8_t)entry.opcode);
+    }
+    return MCU_OperandHandlerName(entry.operand);
+}
+
+static double HOTSPOT_Percent(uint64_t samples, const HOTSPOT_Stats& stats)
+{
+    return stats.total ? 100.0 * (double)samples / (double)stats.total : 0.0;
+}
+
+bool HOTSPOT_WriteCSV(const std::filesystem::path& path, const HOTSPOT_Stats& stats)
+{
+    FILE* out = fopen(path.string().c_str(), "w");
+    if (!out)
+    {
+        return false;
+    }
+
+    fprintf(out, "kind,key,handler,samples,percent\n");
+
+    for (const HOTSPOT_Address& entry : stats.addresses)
+    {
+        fprintf(out,
+                "address,%02x:%04x,%s,%llu,%.4f\n",
+                entry.address >> 16,
+                entry.address & 0xffff,
+                HOTSPOT_HandlerName(entry),
+                (unsigned long long)entry.samples,
+                HOTSPOT_Percent(entry.samples, stats));
+    }
+    for (size_t i = 0; i < std::size(stats.operands); ++i)
+    {
+        if (stats.operands[i])
+        {
+            fprintf(out,
+                    "operand,%02zx,%s,%llu,%.4f\n",
+                    i,
+                    MCU_OperandHandlerName((uint8_t)i),
+                    (unsigned long long)stats.operands[i],
+                    HOTSPOT_Percent(stats.operands[i], stats));
+        }
+    }
+    for (size_t i = 0; i < std::size(stats.opcodes); ++i)
+    {
+        if (stats.opcodes[i])
+        {
+            fprintf(out,
+                    "opcode,%02zx,%s,%llu,%.4f\n",
+                    i,
+                    MCU_OpcodeHandlerName((uint8_t)i),
+                    (unsigned long long)stats.opcodes[i],
+                    HOTSPOT_Percent(stats.opcodes[i], stats));
+        }
+    }
+    if (stats.dropped)
+    {
+        fprintf(out, "dropped,,,%llu,%.4f\n", (unsigned long long)stats.dropped, HOTSPOT_Percent(stats.dropped, stats));
+    }
+
+    return fclose(out) == 0;
+}
+
+bool HOTSPOT_WriteFolded(const std::filesystem::path& path, const HOTSPOT_Stats& stats)
+{
+    FILE* out = fopen(path.string().c_str(), "w");
+    if (!out)
+    {
+        return false;
+    }
+
+    for (const HOTSPOT_Address& entry : stats.addresses)
+    {
+        const uint32_t page = entry.address >> 16;
+        const uint32_t pc   = entry.address & 0xffff;
+
+        fprintf(out,
+                "page_%02x;%02x:%04x;%02x:%04x %s %llu\n",
+                page,
+                page,
+                pc & 0xff00,
+                page,
+                pc,
+                HOTSPOT_HandlerName(entry),
+                (unsigned long long)entry.samples);
+    }
+
+    return fclose(out) == 0;
+}
+
+void HOTSPOT_WriteToEnvPath()
+{
+#ifdef NUKED_SC55_HOTSPOTS
+    const char* path = std::getenv("NUKED_SC55_HOTSPOT_OUTPUT");
+    if (!path || !*path)
+    {
+        return;
+    }
+
+    HOTSPOT_Stats stats;
+    HOTSPOT_Read(stats);
+
+    const bool folded = std::string_view(path).ends_with(".folded");
+    const bool ok     = folded ? HOTSPOT_WriteFolded(path, stats) : HOTSPOT_WriteCSV(path, stats);
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to write hotspots to %s\n", path);
+    }
+#endif
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Optional sampling profiler of the firmware, enabled by building with NUKED_SC55_HOTSPOTS.
+//
+// About one in HOTSPOT_SAMPLE_INTERVAL instructions executed by the main MCU is sampled. Each sample counts the
+// instruction's address (code page and pc), and the handler it goes through: the entry of MCU_Operand_Table for its
+// first byte, and for general-format instructions also the entry of MCU_Opcode_Table. The intervals between samples
+// are randomized so that loops whose length divides the interval aren't over- or undersampled.
+//
+// An instruction that isn't sampled costs a decrement and a branch, so the profiler can stay enabled in benchmark
+// runs. Like the profiler in profile.h, samples are collected per thread and added to the shared histogram by
+// HOTSPOT_Publish, which Emulator::RenderFrames calls at the end of every call.
+
+constexpr uint32_t HOTSPOT_SAMPLE_INTERVAL = 64;
+
+// Instruction addresses each thread can hold between calls to HOTSPOT_Publish; samples of addresses beyond that are
+// only counted in HOTSPOT_Stats::dropped.
+constexpr size_t HOTSPOT_LOCAL_CAPACITY = 1 << 15;
+
+// Marks an instruction that isn't general-format in HOTSPOT_Sample
+constexpr int HOTSPOT_NO_OPCODE = -1;
+
+struct HOTSPOT_Address
+{
+    // MCU_GetAddress(cp, pc) of the instruction
+    uint32_t address = 0;
+    uint8_t  operand = 0;
+    // Index into MCU_Opcode_Table, or HOTSPOT_NO_OPCODE
+    int      opcode  = HOTSPOT_NO_OPCODE;
+    uint64_t samples = 0;
+};
+
+struct HOTSPOT_Stats
+{
+    // Sorted by descending sample count
+    std::vector<HOTSPOT_Address> addresses;
+
+    uint64_t operands[256]{};
+    uint64_t opcodes[32]{};
+
+    uint64_t total   = 0;
+    uint64_t dropped = 0;
+};
+
+#ifdef NUKED_SC55_HOTSPOTS
+
+// Number of instructions until the next sample of the current thread
+inline uint32_t& HOTSPOT_GetCountdown()
+{
+    static thread_local uint32_t countdown = HOTSPOT_SAMPLE_INTERVAL;
+    return countdown;
+}
+
+// Records a sample and picks the next interval.
+void HOTSPOT_Record(uint32_t address, uint8_t operand, int opcode);
+
+inline void HOTSPOT_Sample(uint32_t address, uint8_t operand, int opcode)
+{
+    if (--HOTSPOT_GetCountdown() == 0)
+    {
+        HOTSPOT_Record(address, operand, opcode);
+    }
+}
+
+#define HOTSPOT_SAMPLE(address, operand, opcode) HOTSPOT_Sample(address, operand, opcode)
+
+// Adds the samples of the current thread to the shared histogram and clears them.
+void HOTSPOT_Publish();
+
+#else
+
+#define HOTSPOT_SAMPLE(address, operand, opcode)
+
+inline void HOTSPOT_Publish()
+{
+}
+
+#endif
+
+// Reads the shared histogram. Without NUKED_SC55_HOTSPOTS, it is empty.
+void HOTSPOT_Read(HOTSPOT_Stats& stats);
+
+// Clears the shared histogram. Samples that other threads haven't published yet are kept.
+void HOTSPOT_Reset();
+
+// Writes one row per instruction address, operand handler and opcode handler:
+//
+//   kind,key,handler,samples,percent
+//   address,02:1a3c,MCU_Opcode_MOVG,1234,1.52
+//   operand,a5,MCU_Operand_General,...
+//   opcode,10,MCU_Opcode_MOVG,...
+bool HOTSPOT_WriteCSV(const std::filesystem::path& path, const HOTSPOT_Stats& stats);
+
+// Writes folded stacks for flamegraph.pl, inferno and speedscope. There are no real call stacks, so the frames are
+// the code page, the 256-byte region and the instruction:
+//
+//   page_02;02:1a00;02:1a3c MCU_Opcode_MOVG 1234
+bool HOTSPOT_WriteFolded(const std::filesystem::path& path, const HOTSPOT_Stats& stats);
+
+// Writes the shared histogram to the file named by the NUKED_SC55_HOTSPOT_OUTPUT environment variable: folded stacks
+// if the name ends in ".folded", CSV otherwise. Does nothing if the variable isn't set or the build doesn't collect
+// anything.
+void HOTSPOT_WriteToEnvPath();
@@ -35,6 +35,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <mutex>
 
@@ -86,6 +87,10 @@ struct lcd_t {
     LCD_Backend* backend = nullptr;
 };
 
+// Range of the controller registers in lcd_t that are captured by EMU_Snapshot.
+static const size_t LCD_STATE_BEGIN = offsetof(lcd_t, LCD_DL);
+static const size_t LCD_STATE_END = offsetof(lcd_t, enable);
+
 
 void LCD_Init(lcd_t& lcd, mcu_t& mcu);
 bool LCD_Start(lcd_t& lcd);
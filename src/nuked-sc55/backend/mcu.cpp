@@ -33,11 +33,14 @@
  */
 
 #include "mcu.h"
+#include "hotspot.h"
 #include "lcd.h"
 #include "mcu_opcodes.h"
 #include "mcu_timer.h"
 #include "pcm.h"
+#include "profile.h"
 #include "submcu.h"
+#include <algorithm>
 
 void MCU_ErrorTrap(mcu_t& mcu)
 {
@@ -163,6 +166,8 @@ void MCU_AnalogSample(mcu_t& mcu, int channel)
 
 void MCU_DeviceWrite(mcu_t& mcu, uint32_t address, uint8_t data)
 {
+    MCU_InvalidateDeadlines(mcu);
+
     address &= 0x7f;
     if (address >= 0x10 && address < 0x40)
     {
@@ -280,6 +285,9 @@ void MCU_DeviceWrite(mcu_t& mcu, uint32_t address, uint8_t data)
         break;
     }
     mcu.dev_register[address] = data;
+
+    if (address == DEV_RAME)
+        MCU_UpdateMemoryMap(mcu);
 }
 
 uint8_t MCU_DeviceRead(mcu_t& mcu, uint32_t address)
@@ -372,7 +380,8 @@ void MCU_DeviceReset(mcu_t& mcu)
     mcu.dev_register[DEV_SSR] = 0x80;
 }
 
-void MCU_UpdateAnalog(mcu_t& mcu, uint64_t cycles)
+// Returns the next deadline of the A/D converter.
+uint64_t MCU_UpdateAnalog(mcu_t& mcu, uint64_t cycles)
 {
     int ctrl = mcu.dev_register[DEV_ADCSR];
     int isscan = (ctrl & 16) != 0;
@@ -403,9 +412,15 @@ void MCU_UpdateAnalog(mcu_t& mcu, uint64_t cycles)
     }
     else
         mcu.analog_end_time = 0;
+
+    // While converting, the end time is always set and the next conversion completes once it has passed. Otherwise
+    // the converter is idle until ADCSR is written.
+    if (mcu.dev_register[DEV_ADCSR] & 0x20)
+        return mcu.analog_end_time + 1;
+    return UINT64_MAX;
 }
 
-uint8_t MCU_Read(mcu_t& mcu, uint32_t address)
+uint8_t MCU_ReadUnmapped(mcu_t& mcu, uint32_t address)
 {
     uint32_t address_rom = address & 0x3ffff;
     if (address & 0x80000 && !mcu.is_jv880)
@@ -607,7 +622,7 @@ uint32_t MCU_Read32(mcu_t& mcu, uint32_t address)
     return (b0 << 24) + (b1 << 16) + (b2 << 8) + b3;
 }
 
-void MCU_Write(mcu_t& mcu, uint32_t address, uint8_t value)
+void MCU_WriteUnmapped(mcu_t& mcu, uint32_t address, uint8_t value)
 {
     uint8_t page = (address >> 16) & 0xf;
     address &= 0xffff;
@@ -750,11 +765,171 @@ void MCU_Write16(mcu_t& mcu, uint32_t address, uint16_t value)
     MCU_Write(mcu, address + 1, value & 0xff);
 }
 
+// Must match MCU_ReadUnmapped and MCU_WriteUnmapped for every region it maps.
+void MCU_UpdateMemoryMap(mcu_t& mcu)
+{
+    for (uint32_t region = 0; region < MCU_REGION_COUNT; region++)
+    {
+        const uint32_t address = region << MCU_REGION_SHIFT;
+        const uint8_t page = (address >> 16) & 0xf;
+        const uint16_t offset = address & 0xffff;
+
+        uint32_t address_rom = address & 0x3ffff;
+        if (address & 0x80000 && !mcu.is_jv880)
+            address_rom |= 0x40000;
+        const uint8_t* rom2 = nullptr;
+        if (mcu.rom2 && mcu.rom2_mask >= (1 << MCU_REGION_SHIFT) - 1)
+            rom2 = &mcu.rom2[address_rom & mcu.rom2_mask];
+
+        const uint8_t* read = nullptr;
+        uint8_t* write = nullptr;
+        switch (page)
+        {
+        case 0:
+            if (!(offset & 0x8000))
+            {
+                if (mcu.rom1)
+                    read = &mcu.rom1[offset & 0x7fff];
+            }
+            else if (offset < 0xe000)
+            {
+                read = write = &mcu.sram[offset & 0x7fff];
+            }
+            else if (offset >= 0xfc00 && offset < 0xff00 && (mcu.dev_register[DEV_RAME] & 0x80) != 0)
+            {
+                // The regions at 0xfb00 and 0xff00 are shared with other devices
+                read = write = &mcu.ram[(offset - 0xfb80) & 0x3ff];
+            }
+            break;
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+            read = rom2;
+            break;
+        case 8:
+        case 9:
+            if (!mcu.is_jv880)
+                read = rom2;
+            break;
+        case 14:
+        case 15:
+            if (!mcu.is_jv880)
+                read = rom2;
+            else
+            {
+                read = &mcu.cardram[offset & 0x7fff];
+                if (page == 14)
+                    write = &mcu.cardram[offset & 0x7fff];
+            }
+            break;
+        case 10:
+        case 11:
+            if (!mcu.is_mk1)
+            {
+                read = &mcu.sram[offset & 0x7fff];
+                if (page == 10)
+                    write = &mcu.sram[offset & 0x7fff];
+            }
+            break;
+        case 12:
+        case 13:
+            if (mcu.is_jv880)
+            {
+                read = &mcu.nvram[offset & 0x7fff];
+                if (page == 12)
+                    write = &mcu.nvram[offset & 0x7fff];
+            }
+            break;
+        case 5:
+            if (mcu.is_mk1)
+                read = write = &mcu.sram[offset & 0x7fff];
+            break;
+        default:
+            break;
+        }
+
+        mcu.read_map[region] = read;
+        mcu.write_map[region] = write;
+    }
+}
+
+// Whether code at `page`:`address` is read from rom. Must match MCU_Read.
+bool MCU_IsRomCode(const mcu_t& mcu, uint8_t page, uint16_t address)
+{
+    switch (page & 0xf)
+    {
+    case 0:
+        return !(address & 0x8000);
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+        return true;
+    case 8:
+    case 9:
+    case 14:
+    case 15:
+        return !mcu.is_jv880;
+    default:
+        return false;
+    }
+}
+
+static uint32_t MCU_DecodeCacheIndex(uint32_t address)
+{
+    return (address ^ (address >> 12)) & (MCU_DECODE_CACHE_SIZE - 1);
+}
+
+void MCU_FlushDecodeCache(mcu_t& mcu)
+{
+    for (mcu_decoded_t& decoded : mcu.decode_cache)
+        decoded.tag = 0;
+}
+
 void MCU_ReadInstruction(mcu_t& mcu)
 {
-    uint8_t operand = MCU_ReadCodeAdvance(mcu);
+    PROFILE_SCOPE(MCU_INSTRUCTION);
+
+    const uint32_t address = MCU_GetAddress(mcu.cp, mcu.pc);
+    mcu_decoded_t& cached = mcu.decode_cache[MCU_DecodeCacheIndex(address)];
+
+    if (cached.tag == address + 1)
+    {
+        HOTSPOT_SAMPLE(address, cached.operand, cached.opcode);
+
+        mcu.pc += cached.length;
+        MCU_Operand_GeneralExecute(mcu, cached);
+    }
+    else
+    {
+        uint8_t operand = MCU_ReadCodeAdvance(mcu);
+
+        if (MCU_Operand_Table[operand] == MCU_Operand_General)
+        {
+            mcu_decoded_t decoded;
+            MCU_Operand_GeneralDecode(mcu, operand, decoded);
+            decoded.length = (uint16_t)(mcu.pc - (address & 0xffff));
 
-    MCU_Operand_Table[operand](mcu, operand);
+            HOTSPOT_SAMPLE(address, operand, decoded.opcode);
+
+            // Code outside of rom may change, so it's decoded every time
+            if (MCU_IsRomCode(mcu, mcu.cp, address & 0xffff) &&
+                MCU_IsRomCode(mcu, mcu.cp, (uint16_t)(mcu.pc - 1)))
+            {
+                decoded.tag = address + 1;
+                cached = decoded;
+            }
+
+            MCU_Operand_GeneralExecute(mcu, decoded);
+        }
+        else
+        {
+            HOTSPOT_SAMPLE(address, operand, HOTSPOT_NO_OPCODE);
+
+            MCU_Operand_Table[operand](mcu, operand);
+        }
+    }
 
     if (mcu.sr & STATUS_T)
     {
@@ -809,6 +984,8 @@ void MCU_Reset(mcu_t& mcu)
     mcu.exception_pending = -1;
 
     MCU_DeviceReset(mcu);
+    MCU_InvalidateDeadlines(mcu);
+    MCU_UpdateMemoryMap(mcu);
 
     if (mcu.is_mk1)
     {
@@ -816,79 +993,113 @@ void MCU_Reset(mcu_t& mcu)
     }
 }
 
-void MCU_PostUART(mcu_t& mcu, uint8_t data)
+bool MCU_PostUART(mcu_t& mcu, uint8_t data, uint64_t time)
 {
+    const uint32_t next_write_ptr = (mcu.uart_write_ptr + 1) % uart_buffer_size;
+    if (next_write_ptr == mcu.uart_read_ptr) // full
+        return false;
+
     mcu.uart_buffer[mcu.uart_write_ptr] = data;
-    mcu.uart_write_ptr = (mcu.uart_write_ptr + 1) % uart_buffer_size;
+    mcu.uart_time[mcu.uart_write_ptr] = time;
+    mcu.uart_write_ptr = next_write_ptr;
+    mcu.deadline[MCU_DEADLINE_UART_RX] = 0;
+    return true;
 }
 
-void MCU_UpdateUART_RX(mcu_t& mcu)
+bool MCU_HasPendingUART(const mcu_t& mcu)
+{
+    return mcu.uart_write_ptr != mcu.uart_read_ptr || (mcu.dev_register[DEV_SSR] & 0x40) != 0;
+}
+
+// Returns the next deadline of the UART receiver.
+uint64_t MCU_UpdateUART_RX(mcu_t& mcu)
 {
     if ((mcu.dev_register[DEV_SCR] & 16) == 0) // RX disabled
-        return;
+        return UINT64_MAX;
     if (mcu.uart_write_ptr == mcu.uart_read_ptr) // no byte
-        return;
+        return UINT64_MAX;
 
     if (mcu.dev_register[DEV_SSR] & 0x40)
-        return;
+        return UINT64_MAX;
 
-    if (mcu.cycles < mcu.uart_rx_delay)
-        return;
+    const uint64_t rx_time = std::max(mcu.uart_rx_delay, mcu.uart_time[mcu.uart_read_ptr]);
+    if (mcu.cycles < rx_time)
+        return rx_time;
 
     mcu.uart_rx_byte = mcu.uart_buffer[mcu.uart_read_ptr];
     mcu.uart_read_ptr = (mcu.uart_read_ptr + 1) % uart_buffer_size;
     mcu.dev_register[DEV_SSR] |= 0x40;
     MCU_Interrupt_SetRequest(mcu, INTERRUPT_SOURCE_UART_RX, (mcu.dev_register[DEV_SCR] & 0x40) != 0);
+
+    // RDR stays full until SSR is written
+    return UINT64_MAX;
 }
 
 // dummy TX
-void MCU_UpdateUART_TX(mcu_t& mcu)
+// Returns the next deadline of the UART transmitter.
+uint64_t MCU_UpdateUART_TX(mcu_t& mcu)
 {
     if ((mcu.dev_register[DEV_SCR] & 32) == 0) // TX disabled
-        return;
+        return UINT64_MAX;
 
     if (mcu.dev_register[DEV_SSR] & 0x80)
-        return;
+        return UINT64_MAX;
 
     if (mcu.cycles < mcu.uart_tx_delay)
-        return;
+        return mcu.uart_tx_delay;
 
     mcu.dev_register[DEV_SSR] |= 0x80;
     MCU_Interrupt_SetRequest(mcu, INTERRUPT_SOURCE_UART_TX, (mcu.dev_register[DEV_SCR] & 0x80) != 0);
 
     // fprintf(stderr, "tx:%x\n", mcu.dev_register[DEV_TDR]);
+
+    // TDR stays empty until SSR is written
+    return UINT64_MAX;
 }
 
-void MCU_Step(mcu_t& mcu)
+void MCU_InvalidateDeadlines(mcu_t& mcu)
+{
+    for (uint64_t& deadline : mcu.deadline)
+        deadline = 0;
+}
+
+void MCU_StepBegin(mcu_t& mcu)
 {
     if (!mcu.ex_ignore)
         MCU_Interrupt_Handle(mcu);
     else
         mcu.ex_ignore = 0;
+}
 
-    if (!mcu.sleep)
-        MCU_ReadInstruction(mcu);
-
+template <typename Model>
+void MCU_StepEnd(mcu_t& mcu)
+{
     mcu.cycles += 12; // FIXME: assume 12 cycles per instruction
 
     // if (mcu.cycles % 24000000 == 0)
     //     fprintf(stderr, "seconds: %i\n", (int)(mcu.cycles / 24000000));
 
-    PCM_Update(*mcu.pcm, mcu.cycles);
+    // The PCM chip's own cycle counter is the time of its next sample
+    if (mcu.pcm->cycles < mcu.cycles)
+        PCM_Update<Model>(*mcu.pcm, mcu.cycles);
 
-    TIMER_Clock(*mcu.timer, mcu.cycles);
+    if (mcu.cycles >= mcu.deadline[MCU_DEADLINE_TIMER])
+        mcu.deadline[MCU_DEADLINE_TIMER] = TIMER_Clock(*mcu.timer, mcu.cycles);
 
-    if (!mcu.is_mk1 && !mcu.is_jv880 && !mcu.is_scb55)
+    if constexpr (Model::has_submcu)
         SM_Update(*mcu.sm, mcu.cycles);
     else
     {
-        MCU_UpdateUART_RX(mcu);
-        MCU_UpdateUART_TX(mcu);
+        if (mcu.cycles >= mcu.deadline[MCU_DEADLINE_UART_RX])
+            mcu.deadline[MCU_DEADLINE_UART_RX] = MCU_UpdateUART_RX(mcu);
+        if (mcu.cycles >= mcu.deadline[MCU_DEADLINE_UART_TX])
+            mcu.deadline[MCU_DEADLINE_UART_TX] = MCU_UpdateUART_TX(mcu);
     }
 
-    MCU_UpdateAnalog(mcu, mcu.cycles);
+    if (mcu.cycles >= mcu.deadline[MCU_DEADLINE_ANALOG])
+        mcu.deadline[MCU_DEADLINE_ANALOG] = MCU_UpdateAnalog(mcu, mcu.cycles);
 
-    if (mcu.is_mk1)
+    if constexpr (Model::is_mk1)
     {
         if (mcu.ga_lcd_counter)
         {
@@ -902,6 +1113,32 @@ void MCU_Step(mcu_t& mcu)
     }
 }
 
+template <typename Model>
+void MCU_Step(mcu_t& mcu)
+{
+    MCU_StepBegin(mcu);
+
+    if (!mcu.sleep)
+        MCU_ReadInstruction(mcu);
+
+    MCU_StepEnd<Model>(mcu);
+}
+
+void MCU_Step(mcu_t& mcu)
+{
+    MCU_WithModel(mcu, [&](auto model) { MCU_Step<decltype(model)>(mcu); });
+}
+
+template void MCU_Step<mcu_model_mk2>(mcu_t& mcu);
+template void MCU_Step<mcu_model_mk1>(mcu_t& mcu);
+template void MCU_Step<mcu_model_jv880>(mcu_t& mcu);
+template void MCU_Step<mcu_model_scb55>(mcu_t& mcu);
+
+template void MCU_StepEnd<mcu_model_mk2>(mcu_t& mcu);
+template void MCU_StepEnd<mcu_model_mk1>(mcu_t& mcu);
+template void MCU_StepEnd<mcu_model_jv880>(mcu_t& mcu);
+template void MCU_StepEnd<mcu_model_scb55>(mcu_t& mcu);
+
 void MCU_PatchROM(mcu_t& mcu)
 {
     (void)mcu;
@@ -945,6 +1182,30 @@ void MCU_WriteP1(mcu_t& mcu, uint8_t data)
 
 void MCU_PostSample(mcu_t& mcu, const AudioFrame<int32_t>& frame)
 {
+    if (MCU_IsRendering(mcu))
+    {
+        if (mcu.render_frames_pos < mcu.render_frames_count)
+        {
+            if (mcu.render_left)
+            {
+                AudioFrame<float> out;
+                Normalize(frame, out);
+                mcu.render_left[mcu.render_frames_pos] = out.left;
+                mcu.render_right[mcu.render_frames_pos] = out.right;
+                mcu.render_frames_pos++;
+            }
+            else
+            {
+                mcu.render_frames[mcu.render_frames_pos++] = frame;
+            }
+        }
+        else
+        {
+            mcu.render_overflow = frame;
+            mcu.has_render_overflow = true;
+        }
+        return;
+    }
     mcu.sample_callback(mcu.callback_userdata, frame);
 }
 
@@ -1007,4 +1268,6 @@ void MCU_SetRomset(mcu_t& mcu, Romset romset)
         mcu.is_scb55 = true;
         break;
     }
+
+    MCU_UpdateMemoryMap(mcu);
 }
@@ -38,6 +38,7 @@
 #include "mcu_interrupt.h"
 #include "rom.h"
 #include <atomic>
+#include <cstddef>
 #include <cstdint>
 
 struct submcu_t;
@@ -190,6 +191,37 @@ static const int ROMSM_SIZE = 0x1000;
 
 static const uint32_t uart_buffer_size = 8192;
 
+struct mcu_t;
+
+// A general-format instruction with its code bytes decoded, see MCU_Operand_GeneralDecode.
+struct mcu_decoded_t {
+    // Address of the instruction plus one, or 0 for an unused cache entry.
+    uint32_t tag = 0;
+    uint8_t operand = 0;
+    // Bytes from the operand up to and including the opcode.
+    uint8_t length = 0;
+    uint8_t opcode = 0;
+    uint8_t opcode_reg = 0;
+    uint8_t opcode_extended = 0;
+    // Displacement, address or immediate data, depending on the addressing mode.
+    uint16_t disp = 0;
+    void (*handler)(mcu_t& mcu, uint8_t opcode, uint8_t opcode_reg) = nullptr;
+};
+
+static const uint32_t MCU_DECODE_CACHE_SIZE = 4096;
+
+// The 1 MiB address space is decoded in regions of 256 bytes, see MCU_UpdateMemoryMap.
+static const uint32_t MCU_REGION_SHIFT = 8;
+static const uint32_t MCU_REGION_COUNT = 0x100000 >> MCU_REGION_SHIFT;
+
+enum mcu_deadline_t {
+    MCU_DEADLINE_TIMER,
+    MCU_DEADLINE_UART_RX,
+    MCU_DEADLINE_UART_TX,
+    MCU_DEADLINE_ANALOG,
+    MCU_DEADLINE_COUNT
+};
+
 typedef void(*mcu_sample_callback)(void* userdata, const AudioFrame<int32_t>& frame);
 
 void MCU_DefaultSampleCallback(void* userdata, const AudioFrame<int32_t>& frame);
@@ -206,8 +238,6 @@ struct mcu_t {
     uint8_t trapa_pending[16]{};
     uint64_t cycles = 0;
 
-    uint8_t rom1[ROM1_SIZE]{};
-    uint8_t rom2[ROM2_SIZE]{};
     uint8_t ram[RAM_SIZE]{};
     uint8_t sram[SRAM_SIZE]{};
     uint8_t nvram[NVRAM_SIZE]{};
@@ -220,14 +250,13 @@ struct mcu_t {
     uint8_t sw_pos = 3;
     uint8_t io_sd = 0;
 
-    submcu_t* sm = nullptr;
-    pcm_t* pcm = nullptr;
-    mcu_timer_t* timer = nullptr;
-    lcd_t* lcd = nullptr;
-
     uint32_t uart_write_ptr = 0;
     uint32_t uart_read_ptr = 0;
     uint8_t uart_buffer[uart_buffer_size]{};
+    // Earliest cycle each byte of uart_buffer may be received at, see MCU_PostUART.
+    uint64_t uart_time[uart_buffer_size]{};
+    // Cycle at which the last timestamped byte has finished arriving over the MIDI cable.
+    uint64_t uart_post_time = 0;
 
     uint8_t uart_rx_byte = 0;
     uint64_t uart_rx_delay = 0;
@@ -249,8 +278,6 @@ struct mcu_t {
     int ga_int_trigger = 0;
     int ga_lcd_counter = 0;
 
-    std::atomic<uint32_t> button_pressed;
-
     uint8_t p0_data = 0;
     uint8_t p1_data = 0;
 
@@ -269,21 +296,142 @@ struct mcu_t {
     uint16_t operand_data = 0;
     uint8_t opcode_extended = 0;
 
+    // Everything above this point is machine state and is captured by EMU_Snapshot. Members below are either
+    // immutable after loading roms, or owned by the frontend.
+
+    // Shared between emulators, see RomImages.
+    const uint8_t* rom1 = nullptr;
+    const uint8_t* rom2 = nullptr;
+
+    submcu_t* sm = nullptr;
+    pcm_t* pcm = nullptr;
+    mcu_timer_t* timer = nullptr;
+    lcd_t* lcd = nullptr;
+
+    std::atomic<uint32_t> button_pressed;
+
     void* callback_userdata = nullptr;
     mcu_sample_callback sample_callback = MCU_DefaultSampleCallback;
+
+    // Earliest value of `cycles` at which each peripheral update in MCU_Step can have an effect, indexed by
+    // mcu_deadline_t. Updates are skipped until then. Derived from machine state, so MCU_InvalidateDeadlines must be
+    // called whenever that state changes outside of the update itself.
+    uint64_t deadline[MCU_DEADLINE_COUNT]{};
+
+    // Direct-mapped cache of decoded instructions in rom, indexed by MCU_DecodeCacheIndex. Only depends on the roms,
+    // so it's kept across snapshot restores and flushed when roms are attached.
+    mcu_decoded_t decode_cache[MCU_DECODE_CACHE_SIZE]{};
+
+    // Host memory backing each region, or null if accesses to the region must go through MCU_ReadUnmapped or
+    // MCU_WriteUnmapped. Depends on the romset, the roms and RAME, see MCU_UpdateMemoryMap.
+    const uint8_t* read_map[MCU_REGION_COUNT]{};
+    uint8_t* write_map[MCU_REGION_COUNT]{};
+
+    // Set by Emulator::RenderFrames. While non-null, samples are stored here instead of being passed to
+    // `sample_callback`.
+    AudioFrame<int32_t>* render_frames = nullptr;
+    // Same for the overload of Emulator::RenderFrames that writes normalized samples into separate channels.
+    float* render_left = nullptr;
+    float* render_right = nullptr;
+    size_t render_frames_pos = 0;
+    size_t render_frames_count = 0;
+
+    // With oversampling the PCM emits two samples at once, so a render can finish with one sample left over. It is
+    // returned first by the next render.
+    AudioFrame<int32_t> render_overflow{};
+    bool has_render_overflow = false;
 };
 
+// Size of the machine state at the start of mcu_t.
+static const size_t MCU_STATE_SIZE = offsetof(mcu_t, rom1);
+
+// Returns true while Emulator::RenderFrames collects the samples.
+inline bool MCU_IsRendering(const mcu_t& mcu)
+{
+    return mcu.render_frames || mcu.render_left;
+}
+
 void MCU_Init(mcu_t& mcu, submcu_t& sm, pcm_t& pcm, mcu_timer_t& timer, lcd_t& lcd);
 void MCU_Reset(mcu_t& mcu);
 void MCU_PatchROM(mcu_t& mcu);
+
+// The romset flags tested on every step, as compile-time constants. Every romset behaves like one of the models below
+// in the inner loop, so MCU_Step, PCM_Update and the block engine are instantiated once per model.
+template <bool MK1, bool JV880, bool SubMCU>
+struct mcu_model_traits {
+    static constexpr bool is_mk1 = MK1;
+    static constexpr bool is_jv880 = JV880;
+    static constexpr bool has_submcu = SubMCU;
+};
+
+using mcu_model_mk2 = mcu_model_traits<false, false, true>; // SC-55mk2, SC-155mk2, SC-55ST
+using mcu_model_mk1 = mcu_model_traits<true, false, false>; // SC-55, SC-155, CM-300/SCC-1
+using mcu_model_jv880 = mcu_model_traits<false, true, false>;
+using mcu_model_scb55 = mcu_model_traits<false, false, false>; // SCB-55, RLP-3237
+
+// Calls `f` with a value of the model type matching the current romset.
+template <typename F>
+decltype(auto) MCU_WithModel(const mcu_t& mcu, F&& f)
+{
+    if (mcu.is_mk1)
+        return f(mcu_model_mk1{});
+    if (mcu.is_jv880)
+        return f(mcu_model_jv880{});
+    if (mcu.is_scb55)
+        return f(mcu_model_scb55{});
+    return f(mcu_model_mk2{});
+}
+
+// Same as MCU_Step<Model> for the model of the current romset.
+void MCU_Step(mcu_t& mcu);
+
+// `Model` must match the romset.
+template <typename Model>
 void MCU_Step(mcu_t& mcu);
 
+// MCU_Step without executing an instruction: MCU_StepBegin handles interrupts, MCU_StepEnd advances the clock and
+// updates the peripherals. For execution engines that run instructions themselves.
+void MCU_StepBegin(mcu_t& mcu);
+template <typename Model>
+void MCU_StepEnd(mcu_t& mcu);
+
+// Executes the instruction at the current pc.
+void MCU_ReadInstruction(mcu_t& mcu);
+
+// Forces every peripheral to be updated on the next step.
+void MCU_InvalidateDeadlines(mcu_t& mcu);
+
+void MCU_FlushDecodeCache(mcu_t& mcu);
+
+// Returns true if `page`:`address` is in rom for the current romset, so code read from there never changes.
+bool MCU_IsRomCode(const mcu_t& mcu, uint8_t page, uint16_t address);
+
 void MCU_ErrorTrap(mcu_t& mcu);
 
-uint8_t MCU_Read(mcu_t& mcu, uint32_t address);
+// Rebuilds `read_map` and `write_map`. Must be called whenever the romset, the roms or RAME change.
+void MCU_UpdateMemoryMap(mcu_t& mcu);
+
+// Full address decoding for regions that aren't plain memory: devices, unmapped addresses and writes to rom.
+uint8_t MCU_ReadUnmapped(mcu_t& mcu, uint32_t address);
+void MCU_WriteUnmapped(mcu_t& mcu, uint32_t address, uint8_t value);
+
+inline uint8_t MCU_Read(mcu_t& mcu, uint32_t address) {
+    const uint8_t* region = mcu.read_map[(address >> MCU_REGION_SHIFT) & (MCU_REGION_COUNT - 1)];
+    if (region)
+        return region[address & ((1 << MCU_REGION_SHIFT) - 1)];
+    return MCU_ReadUnmapped(mcu, address);
+}
+
+inline void MCU_Write(mcu_t& mcu, uint32_t address, uint8_t value) {
+    uint8_t* region = mcu.write_map[(address >> MCU_REGION_SHIFT) & (MCU_REGION_COUNT - 1)];
+    if (region)
+        region[address & ((1 << MCU_REGION_SHIFT) - 1)] = value;
+    else
+        MCU_WriteUnmapped(mcu, address, value);
+}
+
 uint16_t MCU_Read16(mcu_t& mcu, uint32_t address);
 uint32_t MCU_Read32(mcu_t& mcu, uint32_t address);
-void MCU_Write(mcu_t& mcu, uint32_t address, uint8_t value);
 void MCU_Write16(mcu_t& mcu, uint32_t address, uint16_t value);
 
 inline uint32_t MCU_GetAddress(uint8_t page, uint16_t address) {
@@ -526,6 +674,11 @@ void MCU_GA_SetGAInt(mcu_t& mcu, int line, int value);
 void MCU_EncoderTrigger(mcu_t& mcu, int dir);
 
 void MCU_PostSample(mcu_t& mcu, const AudioFrame<int32_t>& frame);
-void MCU_PostUART(mcu_t& mcu, uint8_t data);
+// Queues a byte for the UART receiver. It is received no earlier than cycle `time`, and never before the bytes posted
+// ahead of it. Returns false if the buffer is full. Must be called from the thread running the emulator; other threads
+// should use Emulator::PostMIDI.
+bool MCU_PostUART(mcu_t& mcu, uint8_t data, uint64_t time = 0);
+// Returns true if MIDI bytes posted with MCU_PostUART haven't been read by the firmware yet.
+bool MCU_HasPendingUART(const mcu_t& mcu);
 
 void MCU_SetRomset(mcu_t& mcu, Romset romset);
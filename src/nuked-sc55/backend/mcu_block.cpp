@@ -0,0 +1,116 @@
+#include "mcu_block.h"
+#include "hotspot.h"
+#include "mcu_interrupt.h"
+#include "mcu_opcodes.h"
+#include "profile.h"
+
+static uint32_t MCU_BlockCacheIndex(uint32_t address)
+{
+    return (address ^ (address >> 11)) & (MCU_BLOCK_CACHE_SIZE - 1);
+}
+
+void MCU_FlushBlockCache(mcu_block_cache_t& cache)
+{
+    for (mcu_block_t& block : cache.blocks)
+        block.tag = 0;
+}
+
+// Decodes the block at the current pc without executing it. Reading code from rom has no side effects, so only the pc
+// needs to be restored afterwards.
+static void MCU_BuildBlock(mcu_t& mcu, mcu_block_t& block)
+{
+    const uint16_t start_pc = mcu.pc;
+
+    block.tag = MCU_GetAddress(mcu.cp, mcu.pc) + 1;
+    block.count = 0;
+
+    while (block.count < MCU_BLOCK_MAX_LENGTH)
+    {
+        const uint16_t pc = mcu.pc;
+        if (!MCU_IsRomCode(mcu, mcu.cp, pc))
+            break;
+
+        uint8_t operand = MCU_ReadCodeAdvance(mcu);
+        if (MCU_Operand_Table[operand] != MCU_Operand_General)
+            break;
+
+        mcu_decoded_t& decoded = block.instructions[block.count];
+        MCU_Operand_GeneralDecode(mcu, operand, decoded);
+
+        decoded.tag = MCU_GetAddress(mcu.cp, pc) + 1;
+        decoded.length = (uint8_t)(mcu.pc - pc);
+
+        // The handler reads any immediate data itself, so the next instruction starts after it
+        mcu.pc += MCU_Operand_GeneralImmediateLength(decoded);
+        if (!MCU_IsRomCode(mcu, mcu.cp, (uint16_t)(mcu.pc - 1)))
+            break;
+
+        ++block.count;
+    }
+
+    mcu.pc = start_pc;
+}
+
+template <typename Model>
+uint32_t MCU_StepBlock(mcu_t& mcu, mcu_block_cache_t& cache)
+{
+    const uint32_t address = MCU_GetAddress(mcu.cp, mcu.pc);
+
+    mcu_block_t& block = cache.blocks[MCU_BlockCacheIndex(address)];
+    if (block.tag != address + 1)
+    {
+        if (!MCU_IsRomCode(mcu, mcu.cp, mcu.pc))
+        {
+            MCU_Step<Model>(mcu);
+            return 1;
+        }
+        MCU_BuildBlock(mcu, block);
+    }
+
+    if (block.count == 0)
+    {
+        MCU_Step<Model>(mcu);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < block.count; ++i)
+    {
+        const mcu_decoded_t& decoded = block.instructions[i];
+
+        MCU_StepBegin(mcu);
+
+        // An interrupt was taken or the previous instruction raised an exception
+        if (mcu.sleep || MCU_GetAddress(mcu.cp, mcu.pc) + 1 != decoded.tag)
+        {
+            if (!mcu.sleep)
+                MCU_ReadInstruction(mcu);
+            MCU_StepEnd<Model>(mcu);
+            return i + 1;
+        }
+
+        {
+            PROFILE_SCOPE(MCU_INSTRUCTION);
+            HOTSPOT_SAMPLE(decoded.tag - 1, decoded.operand, decoded.opcode);
+
+            mcu.pc += decoded.length;
+            MCU_Operand_GeneralExecute(mcu, decoded);
+
+            if (mcu.sr & STATUS_T)
+            {
+                MCU_Interrupt_Exception(mcu, EXCEPTION_SOURCE_TRACE);
+            }
+        }
+
+        MCU_StepEnd<Model>(mcu);
+
+        if (MCU_IsRendering(mcu) && mcu.render_frames_pos >= mcu.render_frames_count)
+            return i + 1;
+    }
+
+    return block.count;
+}
+
+template uint32_t MCU_StepBlock<mcu_model_mk2>(mcu_t& mcu, mcu_block_cache_t& cache);
+template uint32_t MCU_StepBlock<mcu_model_mk1>(mcu_t& mcu, mcu_block_cache_t& cache);
+template uint32_t MCU_StepBlock<mcu_model_jv880>(mcu_t& mcu, mcu_block_cache_t& cache);
+template uint32_t MCU_StepBlock<mcu_model_scb55>(mcu_t& mcu, mcu_block_cache_t& cache);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "mcu.h"
+#include <cstddef>
+#include <cstdint>
+
+// Block execution engine for the main MCU.
+//
+// A block is a run of consecutive general-format instructions in rom, decoded once and then executed as threaded code
+// (a list of pre-decoded operands and handlers) without going through the operand table. A block ends before the
+// first instruction that is not general-format, which includes every branch, so the instructions of a block always
+// execute in order unless an interrupt or exception intervenes.
+//
+// Interrupts and peripherals are still handled before and after every instruction exactly like MCU_Step does, so the
+// engine produces the same results as the interpreter. The interpreter remains the fallback for everything that is not
+// in a block.
+
+constexpr size_t MCU_BLOCK_MAX_LENGTH = 16;
+constexpr size_t MCU_BLOCK_CACHE_SIZE = 2048;
+
+struct mcu_block_t {
+    // Address of the first instruction plus one, or 0 for an unused cache entry.
+    uint32_t tag = 0;
+    // Number of instructions. May be 0 if the block starts with an instruction that isn't general-format.
+    uint32_t count = 0;
+    // The `tag` of every instruction holds its own address plus one.
+    mcu_decoded_t instructions[MCU_BLOCK_MAX_LENGTH];
+};
+
+// Direct-mapped cache of blocks, indexed by their start address. Only depends on the roms.
+struct mcu_block_cache_t {
+    mcu_block_t blocks[MCU_BLOCK_CACHE_SIZE];
+};
+
+void MCU_FlushBlockCache(mcu_block_cache_t& cache);
+
+// Runs the block starting at the current pc, or a single MCU_Step if there is none. Stops early if the pc leaves the
+// block, or if `mcu.render_frames` becomes full. Returns the number of steps taken, which is always at least 1.
+// `Model` must match the romset, see mcu_model_traits.
+template <typename Model>
+uint32_t MCU_StepBlock(mcu_t& mcu, mcu_block_cache_t& cache);
@@ -562,13 +562,109 @@ void MCU_Operand_Write(mcu_t& mcu, uint32_t data)
     }
 }
 
-void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
+void MCU_Operand_GeneralDecode(mcu_t& mcu, uint8_t operand, mcu_decoded_t& decoded)
+{
+    uint32_t reg = operand & 0x07;
+    uint32_t disp = 0;
+    uint8_t opcode;
+    switch (operand & 0xf0)
+    {
+    case 0xe0:
+        disp = (int8_t)MCU_ReadCodeAdvance(mcu);
+        break;
+    case 0xf0:
+        disp = MCU_ReadCodeAdvance(mcu);
+        disp <<= 8;
+        disp |= MCU_ReadCodeAdvance(mcu);
+        break;
+    case 0x00:
+        if (reg == 5)
+        {
+            disp = MCU_ReadCodeAdvance(mcu);
+        }
+        else if (reg == 4)
+        {
+            disp = MCU_ReadCodeAdvance(mcu);
+            if (operand & 0x08)
+            {
+                disp <<= 8;
+                disp |= MCU_ReadCodeAdvance(mcu);
+            }
+        }
+        break;
+    case 0x10:
+        if (reg == 5)
+        {
+            disp = MCU_ReadCodeAdvance(mcu) << 8;
+            disp |= MCU_ReadCodeAdvance(mcu);
+        }
+        break;
+    }
+
+    opcode = MCU_ReadCodeAdvance(mcu);
+    decoded.opcode_extended = opcode == 0x00;
+    if (decoded.opcode_extended)
+    {
+        opcode = MCU_ReadCodeAdvance(mcu);
+    }
+
+    decoded.operand = operand;
+    decoded.disp = disp;
+    decoded.opcode = opcode >> 3;
+    decoded.opcode_reg = opcode & 0x07;
+    decoded.handler = MCU_Opcode_Table[decoded.opcode];
+}
+
+void MCU_Opcode_MOVG_Immediate(mcu_t& mcu, uint8_t opcode, uint8_t opcode_reg);
+
+uint8_t MCU_Operand_GeneralImmediateLength(const mcu_decoded_t& decoded)
+{
+    if (decoded.handler != MCU_Opcode_MOVG_Immediate)
+        return 0;
+
+    // Same operand types as MCU_Operand_GeneralExecute; the immediate forms only exist for memory operands
+    const uint8_t reg = decoded.operand & 0x07;
+    bool is_memory;
+    switch (decoded.operand & 0xf0)
+    {
+    case 0xb0:
+    case 0xc0:
+    case 0xd0:
+    case 0xe0:
+    case 0xf0:
+        is_memory = true;
+        break;
+    case 0x00:
+    case 0x10:
+        is_memory = reg == 5;
+        break;
+    default:
+        is_memory = false;
+        break;
+    }
+    if (!is_memory)
+        return 0;
+
+    // Cases of MCU_Opcode_MOVG_Immediate
+    switch (decoded.opcode_reg)
+    {
+    case 4:
+    case 6:
+        return 1;
+    case 5:
+    case 7:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+void MCU_Operand_GeneralExecute(mcu_t& mcu, const mcu_decoded_t& decoded)
 {
+    const uint8_t operand = decoded.operand;
     uint32_t type = GENERAL_DIRECT;
     uint32_t disp = 0;
     uint32_t increase = INCREASE_NONE;
-    uint32_t absolute = 0;
-    (void)absolute; // unused
     uint32_t reg = 0;
     uint32_t siz = OPERAND_BYTE;
     uint32_t data = 0;
@@ -576,8 +672,6 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
     uint32_t addrpage = 0;
     uint32_t ea = 0;
     uint32_t ep = 0;
-    uint8_t opcode;
-    uint8_t opcode_reg;
     if (operand & 0x08)
         siz = OPERAND_WORD;
     else
@@ -592,14 +686,9 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
         type = GENERAL_INDIRECT;
         break;
     case 0xe0:
-        type = GENERAL_INDIRECT;
-        disp = (int8_t)MCU_ReadCodeAdvance(mcu);
-        break;
     case 0xf0:
         type = GENERAL_INDIRECT;
-        disp = MCU_ReadCodeAdvance(mcu);
-        disp <<= 8;
-        disp |= MCU_ReadCodeAdvance(mcu);
+        disp = decoded.disp;
         break;
     case 0xb0:
         type = GENERAL_INDIRECT;
@@ -614,26 +703,20 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
         {
             type = GENERAL_ABSOLUTE;
             addr = mcu.br << 8;
-            addr |= MCU_ReadCodeAdvance(mcu);
+            addr |= decoded.disp;
             addrpage = 0;
         }
         else if (reg == 4)
         {
             type = GENERAL_IMMEDIATE;
-            data = MCU_ReadCodeAdvance(mcu);
-            if (siz)
-            {
-                data <<= 8;
-                data |= MCU_ReadCodeAdvance(mcu);
-            }
+            data = decoded.disp;
         }
         break;
     case 0x10:
         if (reg == 5)
         {
             type = GENERAL_ABSOLUTE;
-            addr = MCU_ReadCodeAdvance(mcu) << 8;
-            addr |= MCU_ReadCodeAdvance(mcu);
+            addr = decoded.disp;
             addrpage = mcu.dp;
         }
         break;
@@ -675,15 +758,7 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
         ep = addrpage & 0xff;
     }
 
-    opcode = MCU_ReadCodeAdvance(mcu);
-    mcu.opcode_extended = opcode == 0x00;
-    if (mcu.opcode_extended)
-    {
-        opcode = MCU_ReadCodeAdvance(mcu);
-    }
-    opcode_reg = opcode & 0x07;
-    opcode >>= 3;
-
+    mcu.opcode_extended = decoded.opcode_extended;
     mcu.operand_type = type;
     mcu.operand_ea = ea;
     mcu.operand_ep = ep;
@@ -692,7 +767,14 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
     mcu.operand_data = data;
     mcu.operand_status = 0;
 
-    MCU_Opcode_Table[opcode](mcu, opcode, opcode_reg);
+    decoded.handler(mcu, decoded.opcode, decoded.opcode_reg);
+}
+
+void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
+{
+    mcu_decoded_t decoded;
+    MCU_Operand_GeneralDecode(mcu, operand, decoded);
+    MCU_Operand_GeneralExecute(mcu, decoded);
 }
 
 void MCU_SetStatusCommon(mcu_t& mcu, uint32_t val, uint32_t siz)
@@ -1805,3 +1887,90 @@ void (*MCU_Opcode_Table[32])(mcu_t& mcu, uint8_t opcode, uint8_t opcode_reg) = {
     MCU_Opcode_BTSTI, // 1E
     MCU_Opcode_BTSTI, // 1F
 };
+
+template <typename Handler>
+struct MCU_HandlerName
+{
+    Handler     handler;
+    const char* name;
+};
+
+#define MCU_HANDLER_NAME(handler) {handler, #handler}
+
+static const MCU_HandlerName<void (*)(mcu_t&, uint8_t)> MCU_Operand_Names[] = {
+    MCU_HANDLER_NAME(MCU_Operand_Nop),
+    MCU_HANDLER_NAME(MCU_Operand_NotImplemented),
+    MCU_HANDLER_NAME(MCU_Operand_General),
+    MCU_HANDLER_NAME(MCU_Operand_Sleep),
+    MCU_HANDLER_NAME(MCU_Jump_JMP),
+    MCU_HANDLER_NAME(MCU_Jump_PJMP),
+    MCU_HANDLER_NAME(MCU_Jump_JSR),
+    MCU_HANDLER_NAME(MCU_Jump_PJSR),
+    MCU_HANDLER_NAME(MCU_Jump_BSR),
+    MCU_HANDLER_NAME(MCU_Jump_Bcc),
+    MCU_HANDLER_NAME(MCU_Jump_RTS),
+    MCU_HANDLER_NAME(MCU_Jump_RTD),
+    MCU_HANDLER_NAME(MCU_Jump_RTE),
+    MCU_HANDLER_NAME(MCU_LDM),
+    MCU_HANDLER_NAME(MCU_STM),
+    MCU_HANDLER_NAME(MCU_TRAPA),
+    MCU_HANDLER_NAME(MCU_Opcode_Short_CMP),
+    MCU_HANDLER_NAME(MCU_Opcode_Short_MOVE),
+    MCU_HANDLER_NAME(MCU_Opcode_Short_MOVI),
+    MCU_HANDLER_NAME(MCU_Opcode_Short_MOVF),
+    MCU_HANDLER_NAME(MCU_Opcode_Short_MOVL),
+    MCU_HANDLER_NAME(MCU_Opcode_Short_MOVS),
+};
+
+static const MCU_HandlerName<void (*)(mcu_t&, uint8_t, uint8_t)> MCU_Opcode_Names[] = {
+    MCU_HANDLER_NAME(MCU_Opcode_MOVG_Immediate),
+    MCU_HANDLER_NAME(MCU_Opcode_ADDQ),
+    MCU_HANDLER_NAME(MCU_Opcode_CLR),
+    MCU_HANDLER_NAME(MCU_Opcode_SHLR),
+    MCU_HANDLER_NAME(MCU_Opcode_ADD),
+    MCU_HANDLER_NAME(MCU_Opcode_ADDS),
+    MCU_HANDLER_NAME(MCU_Opcode_SUB),
+    MCU_HANDLER_NAME(MCU_Opcode_SUBS),
+    MCU_HANDLER_NAME(MCU_Opcode_OR),
+    MCU_HANDLER_NAME(MCU_Opcode_BSET_ORC),
+    MCU_HANDLER_NAME(MCU_Opcode_AND),
+    MCU_HANDLER_NAME(MCU_Opcode_BCLR_ANDC),
+    MCU_HANDLER_NAME(MCU_Opcode_XOR),
+    MCU_HANDLER_NAME(MCU_Opcode_NotImplemented),
+    MCU_HANDLER_NAME(MCU_Opcode_CMP),
+    MCU_HANDLER_NAME(MCU_Opcode_BTST),
+    MCU_HANDLER_NAME(MCU_Opcode_MOVG),
+    MCU_HANDLER_NAME(MCU_Opcode_LDC),
+    MCU_HANDLER_NAME(MCU_Opcode_STC),
+    MCU_HANDLER_NAME(MCU_Opcode_ADDX),
+    MCU_HANDLER_NAME(MCU_Opcode_MULXU),
+    MCU_HANDLER_NAME(MCU_Opcode_SUBX),
+    MCU_HANDLER_NAME(MCU_Opcode_DIVXU),
+    MCU_HANDLER_NAME(MCU_Opcode_BSET),
+    MCU_HANDLER_NAME(MCU_Opcode_BCLR),
+    MCU_HANDLER_NAME(MCU_Opcode_BNOTI),
+    MCU_HANDLER_NAME(MCU_Opcode_BTSTI),
+};
+
+#undef MCU_HANDLER_NAME
+
+template <typename Handler, size_t N>
+static const char* MCU_FindHandlerName(const MCU_HandlerName<Handler> (&names)[N], Handler handler)
+{
+    for (const auto& entry : names)
+    {
+        if (entry.handler == handler)
+            return entry.name;
+    }
+    return "unknown";
+}
+
+const char* MCU_OperandHandlerName(uint8_t operand)
+{
+    return MCU_FindHandlerName(MCU_Operand_Names, MCU_Operand_Table[operand]);
+}
+
+const char* MCU_OpcodeHandlerName(uint8_t opcode)
+{
+    return MCU_FindHandlerName(MCU_Opcode_Names, MCU_Opcode_Table[opcode & 0x1f]);
+}
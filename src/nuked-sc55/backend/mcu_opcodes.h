@@ -37,6 +37,21 @@
 #include <cstdint>
 
 struct mcu_t;
+struct mcu_decoded_t;
 
 extern void (*MCU_Operand_Table[256])(mcu_t& mcu, uint8_t operand);
 extern void (*MCU_Opcode_Table[32])(mcu_t& mcu, uint8_t opcode, uint8_t opcode_reg);
+
+// Function names of the handlers in MCU_Operand_Table and MCU_Opcode_Table, for profiling output.
+const char* MCU_OperandHandlerName(uint8_t operand);
+const char* MCU_OpcodeHandlerName(uint8_t opcode);
+
+// General-format instructions are split into decoding, which only reads code bytes, and executing the result, so that
+// decoded instructions can be cached. MCU_Operand_General does both.
+void MCU_Operand_General(mcu_t& mcu, uint8_t operand);
+void MCU_Operand_GeneralDecode(mcu_t& mcu, uint8_t operand, mcu_decoded_t& decoded);
+void MCU_Operand_GeneralExecute(mcu_t& mcu, const mcu_decoded_t& decoded);
+
+// Number of code bytes that the handler of `decoded` reads by itself when executed, following the `decoded.length`
+// bytes read by MCU_Operand_GeneralDecode. Only the immediate forms of MCU_Opcode_MOVG_Immediate read any.
+uint8_t MCU_Operand_GeneralImmediateLength(const mcu_decoded_t& decoded);
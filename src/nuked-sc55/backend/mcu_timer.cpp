@@ -34,7 +34,14 @@
 
 #include "mcu_timer.h"
 #include "mcu.h"
+#include "profile.h"
+#include <algorithm>
 #include <cstdint>
+#ifdef NUKED_SC55_TIMER_CHECK
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#endif
 
 enum {
     REG_TCR = 0x00,
@@ -49,6 +56,12 @@ enum {
     REG_ICRL = 0x09,
 };
 
+// The timers are only clocked when their next event is due, so bring them up to date before registers are accessed.
+static void TIMER_Sync(mcu_timer_t& timer)
+{
+    TIMER_Clock(timer, timer.mcu->cycles);
+}
+
 void TIMER_Init(mcu_timer_t& timer, mcu_t& mcu)
 {
     timer.mcu = &mcu;
@@ -56,6 +69,8 @@ void TIMER_Init(mcu_timer_t& timer, mcu_t& mcu)
 
 void TIMER_Write(mcu_timer_t& timer, uint32_t address, uint8_t data)
 {
+    TIMER_Sync(timer);
+
     uint32_t t = (address >> 4) - 1;
     if (t > 2)
         return;
@@ -111,6 +126,8 @@ void TIMER_Write(mcu_timer_t& timer, uint32_t address, uint8_t data)
 
 uint8_t TIMER_Read(mcu_timer_t& timer, uint32_t address)
 {
+    TIMER_Sync(timer);
+
     uint32_t t = (address >> 4) - 1;
     if (t > 2)
         return 0xff;
@@ -150,6 +167,8 @@ uint8_t TIMER_Read(mcu_timer_t& timer, uint32_t address)
 
 void TIMER2_Write(mcu_timer_t& timer, uint32_t address, uint8_t data)
 {
+    TIMER_Sync(timer);
+
     switch (address)
     {
     case DEV_TMR_TCR:
@@ -190,6 +209,8 @@ void TIMER2_Write(mcu_timer_t& timer, uint32_t address, uint8_t data)
 }
 uint8_t TIMER_Read2(mcu_timer_t& timer, uint32_t address)
 {
+    TIMER_Sync(timer);
+
     switch (address)
     {
     case DEV_TMR_TCR:
@@ -226,7 +247,141 @@ constexpr uint64_t TIMER_STEP_TABLE_MK1[8] = {
     0, 7, 63, 1023, 0, 3, 3, 3
 };
 
-void TIMER_Clock(mcu_timer_t& timer, uint64_t cycles)
+// Runs one step of FRT `i`. Interrupt requests are written to `pending`, which has the layout of
+// mcu_t::interrupt_pending.
+static void TIMER_StepFRT(mcu_timer_t& timer, int i, uint8_t* pending)
+{
+    frt_t *ftimer = &timer.frt[i];
+
+    uint32_t value = ftimer->frc;
+    uint32_t matcha = value == ftimer->ocra;
+    uint32_t matchb = value == ftimer->ocrb;
+    if ((ftimer->tcsr & 1) != 0 && matcha) // CCLRA
+        value = 0;
+    else
+        value++;
+    uint32_t of = (value >> 16) & 1;
+    value &= 0xffff;
+    ftimer->frc = value;
+
+    // flags
+    if (of)
+        ftimer->tcsr |= 0x10;
+    if (matcha)
+        ftimer->tcsr |= 0x20;
+    if (matchb)
+        ftimer->tcsr |= 0x40;
+    if ((ftimer->tcr & 0x10) != 0 && (ftimer->tcsr & 0x10) != 0)
+        pending[INTERRUPT_SOURCE_FRT0_FOVI + i * 4] = 1;
+    if ((ftimer->tcr & 0x20) != 0 && (ftimer->tcsr & 0x20) != 0)
+        pending[INTERRUPT_SOURCE_FRT0_OCIA + i * 4] = 1;
+    if ((ftimer->tcr & 0x40) != 0 && (ftimer->tcsr & 0x40) != 0)
+        pending[INTERRUPT_SOURCE_FRT0_OCIB + i * 4] = 1;
+}
+
+// Runs one step of the 8-bit timer.
+static void TIMER_StepTMR(mcu_timer_t& timer, uint8_t* pending)
+{
+    uint32_t value = timer.tcnt;
+    uint32_t matcha = value == timer.tcora;
+    uint32_t matchb = value == timer.tcorb;
+    if ((timer.tcr & 24) == 8 && matcha)
+        value = 0;
+    else if ((timer.tcr & 24) == 16 && matchb)
+        value = 0;
+    else
+        value++;
+    uint32_t of = (value >> 8) & 1;
+    value &= 0xff;
+    timer.tcnt = value;
+
+    // flags
+    if (of)
+        timer.tcsr |= 0x20;
+    if (matcha)
+        timer.tcsr |= 0x40;
+    if (matchb)
+        timer.tcsr |= 0x80;
+    if ((timer.tcr & 0x20) != 0 && (timer.tcsr & 0x20) != 0)
+        pending[INTERRUPT_SOURCE_TIMER_OVI] = 1;
+    if ((timer.tcr & 0x40) != 0 && (timer.tcsr & 0x40) != 0)
+        pending[INTERRUPT_SOURCE_TIMER_CMIA] = 1;
+    if ((timer.tcr & 0x80) != 0 && (timer.tcsr & 0x80) != 0)
+        pending[INTERRUPT_SOURCE_TIMER_CMIB] = 1;
+}
+
+// A step of a counter is an event if it can do anything other than increment the counter: a compare match, an
+// overflow, or raising an enabled interrupt that isn't pending yet. Once an enabled flag has raised its interrupt,
+// the request stays pending until the flag is cleared through TCSR, so between events a step only increments.
+//
+// These return the number of steps before the next event, 0 meaning that the next step is one.
+static uint32_t TIMER_StepsToEventFRT(const mcu_timer_t& timer, int i, const uint8_t* pending)
+{
+    const frt_t& ftimer = timer.frt[i];
+
+    const uint32_t flags = ftimer.tcr & ftimer.tcsr;
+    if (((flags & 0x10) && !pending[INTERRUPT_SOURCE_FRT0_FOVI + i * 4]) ||
+        ((flags & 0x20) && !pending[INTERRUPT_SOURCE_FRT0_OCIA + i * 4]) ||
+        ((flags & 0x40) && !pending[INTERRUPT_SOURCE_FRT0_OCIB + i * 4]))
+        return 0;
+
+    const uint32_t value = ftimer.frc;
+    return std::min({(ftimer.ocra - value) & 0xffffu, (ftimer.ocrb - value) & 0xffffu, 0xffff - value});
+}
+
+static uint32_t TIMER_StepsToEventTMR(const mcu_timer_t& timer, const uint8_t* pending)
+{
+    const uint32_t flags = timer.tcr & timer.tcsr;
+    if (((flags & 0x20) && !pending[INTERRUPT_SOURCE_TIMER_OVI]) ||
+        ((flags & 0x40) && !pending[INTERRUPT_SOURCE_TIMER_CMIA]) ||
+        ((flags & 0x80) && !pending[INTERRUPT_SOURCE_TIMER_CMIB]))
+        return 0;
+
+    const uint32_t value = timer.tcnt;
+    return std::min({(timer.tcora - value) & 0xffu, (timer.tcorb - value) & 0xffu, 0xff - value});
+}
+
+// Runs `steps` steps of FRT `i`, jumping straight over the ones that only increment the counter. Returns the number
+// of steps before the next event.
+static uint32_t TIMER_AdvanceFRT(mcu_timer_t& timer, int i, uint64_t steps, uint8_t* pending)
+{
+    for (;;)
+    {
+        const uint32_t to_event = TIMER_StepsToEventFRT(timer, i, pending);
+        if (steps <= to_event)
+        {
+            timer.frt[i].frc += (uint16_t)steps;
+            return to_event - (uint32_t)steps;
+        }
+        timer.frt[i].frc += (uint16_t)to_event;
+        steps -= to_event + 1;
+        TIMER_StepFRT(timer, i, pending);
+    }
+}
+
+static uint32_t TIMER_AdvanceTMR(mcu_timer_t& timer, uint64_t steps, uint8_t* pending)
+{
+    for (;;)
+    {
+        const uint32_t to_event = TIMER_StepsToEventTMR(timer, pending);
+        if (steps <= to_event)
+        {
+            timer.tcnt += (uint8_t)steps;
+            return to_event - (uint32_t)steps;
+        }
+        timer.tcnt += (uint8_t)to_event;
+        steps -= to_event + 1;
+        TIMER_StepTMR(timer, pending);
+    }
+}
+
+// Number of steps a counter that steps every `period` ticks takes in ticks [0, ticks).
+static uint64_t TIMER_StepsBefore(uint64_t ticks, uint64_t period)
+{
+    return (ticks + period - 1) / period;
+}
+
+void TIMER_ClockReference(mcu_timer_t& timer, uint64_t cycles, uint8_t* pending)
 {
     const bool mk1 = timer.mcu->is_mk1;
     const auto& FRT_STEP_TABLE = mk1 ? FRT_STEP_TABLE_MK1 : FRT_STEP_TABLE_GENERIC;
@@ -236,71 +391,67 @@ void TIMER_Clock(mcu_timer_t& timer, uint64_t cycles)
     {
         for (int i = 0; i < 3; i++)
         {
-            frt_t *ftimer = &timer.frt[i];
-
-            const bool frt_step = !(timer.cycles & FRT_STEP_TABLE[ftimer->tcr & 3]);
-
-            if (frt_step)
-            {
-                uint32_t value = ftimer->frc;
-                uint32_t matcha = value == ftimer->ocra;
-                uint32_t matchb = value == ftimer->ocrb;
-                if ((ftimer->tcsr & 1) != 0 && matcha) // CCLRA
-                    value = 0;
-                else
-                    value++;
-                uint32_t of = (value >> 16) & 1;
-                value &= 0xffff;
-                ftimer->frc = value;
-
-                // flags
-                if (of)
-                    ftimer->tcsr |= 0x10;
-                if (matcha)
-                    ftimer->tcsr |= 0x20;
-                if (matchb)
-                    ftimer->tcsr |= 0x40;
-                if ((ftimer->tcr & 0x10) != 0 && (ftimer->tcsr & 0x10) != 0)
-                    MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_FRT0_FOVI + i * 4, 1);
-                if ((ftimer->tcr & 0x20) != 0 && (ftimer->tcsr & 0x20) != 0)
-                    MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_FRT0_OCIA + i * 4, 1);
-                if ((ftimer->tcr & 0x40) != 0 && (ftimer->tcsr & 0x40) != 0)
-                    MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_FRT0_OCIB + i * 4, 1);
-            }
+            if (!(timer.cycles & FRT_STEP_TABLE[timer.frt[i].tcr & 3]))
+                TIMER_StepFRT(timer, i, pending);
         }
 
-        const bool timer_step = !(timer.cycles & TIMER_STEP_TABLE[timer.tcr & 7]);
-
-        if (timer_step)
-        {
-            uint32_t value = timer.tcnt;
-            uint32_t matcha = value == timer.tcora;
-            uint32_t matchb = value == timer.tcorb;
-            if ((timer.tcr & 24) == 8 && matcha)
-                value = 0;
-            else if ((timer.tcr & 24) == 16 && matchb)
-                value = 0;
-            else
-                value++;
-            uint32_t of = (value >> 8) & 1;
-            value &= 0xff;
-            timer.tcnt = value;
-
-            // flags
-            if (of)
-                timer.tcsr |= 0x20;
-            if (matcha)
-                timer.tcsr |= 0x40;
-            if (matchb)
-                timer.tcsr |= 0x80;
-            if ((timer.tcr & 0x20) != 0 && (timer.tcsr & 0x20) != 0)
-                MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_TIMER_OVI, 1);
-            if ((timer.tcr & 0x40) != 0 && (timer.tcsr & 0x40) != 0)
-                MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_TIMER_CMIA, 1);
-            if ((timer.tcr & 0x80) != 0 && (timer.tcsr & 0x80) != 0)
-                MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_TIMER_CMIB, 1);
-        }
+        if (!(timer.cycles & TIMER_STEP_TABLE[timer.tcr & 7]))
+            TIMER_StepTMR(timer, pending);
 
         timer.cycles++;
     }
 }
+
+uint64_t TIMER_Clock(mcu_timer_t& timer, uint64_t cycles)
+{
+    PROFILE_SCOPE(TIMER_CLOCK);
+
+    const bool mk1 = timer.mcu->is_mk1;
+    const auto& FRT_STEP_TABLE = mk1 ? FRT_STEP_TABLE_MK1 : FRT_STEP_TABLE_GENERIC;
+    const auto& TIMER_STEP_TABLE = mk1 ? TIMER_STEP_TABLE_MK1 : TIMER_STEP_TABLE_GENERIC;
+
+    uint8_t* pending = timer.mcu->interrupt_pending;
+
+#ifdef NUKED_SC55_TIMER_CHECK
+    mcu_timer_t ref_timer = timer;
+    uint8_t ref_pending[INTERRUPT_SOURCE_MAX];
+    memcpy(ref_pending, pending, sizeof(ref_pending));
+    TIMER_ClockReference(ref_timer, cycles, ref_pending);
+#endif
+
+    // The counters never affect each other, so each one can be advanced over the whole range of ticks on its own.
+    // Tick `t` is processed once `cycles` exceeds 2 * t, the same bound as the loop in TIMER_ClockReference.
+    const uint64_t begin = timer.cycles;
+    const uint64_t end = std::max(begin, (cycles + 1) / 2);
+
+    uint64_t next_event = UINT64_MAX;
+
+    for (int i = 0; i < 3; i++)
+    {
+        const uint64_t period = FRT_STEP_TABLE[timer.frt[i].tcr & 3] + 1;
+        const uint64_t first = TIMER_StepsBefore(begin, period);
+        const uint64_t last = TIMER_StepsBefore(end, period);
+        const uint64_t to_event = TIMER_AdvanceFRT(timer, i, last - first, pending);
+        next_event = std::min(next_event, (last + to_event) * period);
+    }
+
+    {
+        const uint64_t period = TIMER_STEP_TABLE[timer.tcr & 7] + 1;
+        const uint64_t first = TIMER_StepsBefore(begin, period);
+        const uint64_t last = TIMER_StepsBefore(end, period);
+        const uint64_t to_event = TIMER_AdvanceTMR(timer, last - first, pending);
+        next_event = std::min(next_event, (last + to_event) * period);
+    }
+
+    timer.cycles = end;
+
+#ifdef NUKED_SC55_TIMER_CHECK
+    if (memcmp(&timer, &ref_timer, TIMER_STATE_SIZE) != 0 || memcmp(pending, ref_pending, sizeof(ref_pending)) != 0)
+    {
+        fprintf(stderr, "TIMER_Clock diverged from the reference at cycle %llu\n", (unsigned long long)cycles);
+        abort();
+    }
+#endif
+
+    return 2 * next_event + 1;
+}
@@ -34,6 +34,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 struct mcu_t;
@@ -56,18 +57,31 @@ struct mcu_timer_t {
     uint8_t tcnt = 0;
     uint8_t status_rd = 0;
 
-    mcu_t* mcu = nullptr;
-
     uint64_t cycles = 0;
     uint8_t tempreg = 0;
 
     frt_t frt[3]{};
+
+    // Everything above this point is machine state and is captured by EMU_Snapshot.
+
+    mcu_t* mcu = nullptr;
 };
 
+// Size of the machine state at the start of mcu_timer_t.
+static const size_t TIMER_STATE_SIZE = offsetof(mcu_timer_t, mcu);
+
 void TIMER_Init(mcu_timer_t& timer, mcu_t& mcu);
 void TIMER_Write(mcu_timer_t& timer, uint32_t address, uint8_t data);
 uint8_t TIMER_Read(mcu_timer_t& timer, uint32_t address);
-void TIMER_Clock(mcu_timer_t& timer, uint64_t cycles);
+// Advances the timers to `cycles`. Returns the earliest cycle count at which the timers can raise an interrupt
+// request; until then, calling this again is only required before accessing timer registers, which the register
+// accessors do themselves. Define NUKED_SC55_TIMER_CHECK to verify every call against the original tick-by-tick
+// implementation.
+uint64_t TIMER_Clock(mcu_timer_t& timer, uint64_t cycles);
+
+// The original implementation of TIMER_Clock, which runs one tick at a time. Interrupt requests are raised in
+// `pending` instead of the mcu's. Only used to check TIMER_Clock, by NUKED_SC55_TIMER_CHECK and nuked-sc55-timer-test.
+void TIMER_ClockReference(mcu_timer_t& timer, uint64_t cycles, uint8_t* pending);
 
 void TIMER2_Write(mcu_timer_t& timer, uint32_t address, uint8_t data);
 uint8_t TIMER_Read2(mcu_timer_t& timer, uint32_t address);
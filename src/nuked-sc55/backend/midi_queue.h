@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+// A MIDI byte waiting to be sent to the UART, see Emulator::PostMIDI.
+struct MidiInputByte
+{
+    // Frames after the last rendered frame the byte should arrive at. Only used if `timed` is set; otherwise the byte
+    // is sent as soon as the UART can receive it.
+    double delay_frames = 0.0;
+    uint8_t data = 0;
+    bool timed = false;
+};
+
+// Bounded multi-producer single-consumer queue of MIDI bytes. Any number of threads may push messages concurrently
+// while a single thread pops them. Pushing is lock-free and popping is wait-free, so neither side ever blocks. Each
+// message is pushed as a whole, so messages from different threads never interleave. If a message doesn't fit it is
+// dropped and counted in the overflow counters.
+//
+// Every cell has a sequence number that tells whose turn it is. The cell for position `pos` is free for producers
+// while its sequence equals `pos`, and ready for the consumer once it equals `pos + 1`.
+class MidiInputQueue
+{
+public:
+    // `capacity` must be a power of 2.
+    explicit MidiInputQueue(size_t capacity)
+        : m_cells(std::make_unique<Cell[]>(capacity))
+        , m_mask(capacity - 1)
+    {
+        for (size_t i = 0; i < capacity; i++)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MidiInputQueue(const MidiInputQueue&)            = delete;
+    MidiInputQueue& operator=(const MidiInputQueue&) = delete;
+
+    // Can be called from any thread. Returns false if the message was dropped because the queue is full.
+    bool Push(std::span<const uint8_t> data, bool timed, double delay_frames)
+    {
+        const size_t count = data.size();
+        if (count == 0)
+        {
+            return true;
+        }
+
+        size_t pos = m_write_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            // The consumer frees cells in order, so if the last cell of the message is free the others are too
+            const size_t last_sequence = m_cells[(pos + count - 1) & m_mask].sequence.load(std::memory_order_acquire);
+            if (count > m_mask + 1 || (intptr_t)(last_sequence - (pos + count - 1)) < 0)
+            {
+                m_dropped_messages.fetch_add(1, std::memory_order_relaxed);
+                m_dropped_bytes.fetch_add(count, std::memory_order_relaxed);
+                return false;
+            }
+
+            if (last_sequence == pos + count - 1 &&
+                m_write_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+            {
+                break;
+            }
+
+            // Another producer got there first
+            pos = m_write_pos.load(std::memory_order_relaxed);
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            Cell& cell = m_cells[(pos + i) & m_mask];
+            cell.value = MidiInputByte{delay_frames, data[i], timed};
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+
+        return true;
+    }
+
+    // Consumer only. Returns false if no byte is ready. A message that is still being written by a producer is not
+    // ready yet.
+    bool Peek(MidiInputByte& value) const
+    {
+        const Cell& cell = m_cells[m_read_pos & m_mask];
+        if (cell.sequence.load(std::memory_order_acquire) != m_read_pos + 1)
+        {
+            return false;
+        }
+        value = cell.value;
+        return true;
+    }
+
+    // Consumer only. Must follow a successful Peek.
+    void Pop()
+    {
+        m_cells[m_read_pos & m_mask].sequence.store(m_read_pos + m_mask + 1, std::memory_order_release);
+        m_read_pos++;
+    }
+
+    // Consumer only.
+    bool IsEmpty() const
+    {
+        MidiInputByte value;
+        return !Peek(value);
+    }
+
+    // Number of messages and bytes dropped because the queue was full.
+    uint64_t GetDroppedMessages() const
+    {
+        return m_dropped_messages.load(std::memory_order_relaxed);
+    }
+
+    uint64_t GetDroppedBytes() const
+    {
+        return m_dropped_bytes.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence{0};
+        MidiInputByte value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+
+    // Producers and the consumer write these, so keep them on separate cache lines
+    alignas(64) std::atomic<size_t> m_write_pos{0};
+    alignas(64) size_t m_read_pos = 0;
+
+    alignas(64) std::atomic<uint64_t> m_dropped_messages{0};
+    std::atomic<uint64_t> m_dropped_bytes{0};
+};
@@ -35,10 +35,13 @@
 #include "pcm.h"
 #include "mcu.h"
 #include "mcu_interrupt.h"
+#include "profile.h"
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 
-uint8_t PCM_ReadROM(pcm_t& pcm, uint32_t address)
+template <typename Model>
+static uint8_t PCM_ReadROM(pcm_t& pcm, uint32_t address)
 {
     int bank;
     if (pcm.config_reg_3d & 0x20)
@@ -48,17 +51,17 @@ uint8_t PCM_ReadROM(pcm_t& pcm, uint32_t address)
     switch (bank)
     {
         case 0:
-            if (pcm.mcu->is_mk1)
+            if constexpr (Model::is_mk1)
                 return pcm.waverom1[address & 0xfffff];
             else
                 return pcm.waverom1[address & 0x1fffff];
         case 1:
-            if (!pcm.mcu->is_jv880)
+            if constexpr (!Model::is_jv880)
                 return pcm.waverom2[address & 0xfffff];
             else
                 return pcm.waverom2[address & 0x1fffff];
         case 2:
-            if (pcm.mcu->is_jv880)
+            if constexpr (Model::is_jv880)
                 return pcm.waverom_card[address & 0x1fffff];
             else
                 return pcm.waverom3[address & 0xfffff];
@@ -66,7 +69,7 @@ uint8_t PCM_ReadROM(pcm_t& pcm, uint32_t address)
         case 4:
         case 5:
         case 6:
-            if (pcm.mcu->is_jv880)
+            if constexpr (Model::is_jv880)
                 return pcm.waverom_exp[(address & 0x1fffff) + (bank - 3) * 0x200000];
         default:
             break;
@@ -74,6 +77,11 @@ uint8_t PCM_ReadROM(pcm_t& pcm, uint32_t address)
     return 0;
 }
 
+uint8_t PCM_ReadROM(pcm_t& pcm, uint32_t address)
+{
+    return MCU_WithModel(*pcm.mcu, [&](auto model) { return PCM_ReadROM<decltype(model)>(pcm, address); });
+}
+
 void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data)
 {
     address &= 0x3f;
@@ -268,22 +276,7 @@ uint8_t PCM_Read(pcm_t& pcm, uint32_t address)
 void PCM_Init(pcm_t& pcm, mcu_t& mcu)
 {
     pcm.mcu = &mcu;
-}
-
-// Sign-extends a 20-bit signed integer to a 32-bit signed integer.
-constexpr inline int32_t sx20(int32_t in)
-{
-    return (in << 12) >> 12;
-}
-
-inline int32_t addclip20(int32_t add1, int32_t add2, int32_t cin)
-{
-    return sx20(add1) + sx20(add2) + cin;
-}
-
-inline int32_t multi(int32_t val1, int8_t val2)
-{
-    return sx20(val1) * val2;
+    pcm.output_stage = PCM_GetOutputStage();
 }
 
 static const int interp_lut[3][128] = {
@@ -583,8 +576,500 @@ void PCM_GetConfig(PCM_Config& config, uint8_t config_byte)
     }
 }
 
+// Computes the next sample of a voice up to the output stage, see pcm_voice_batch_t.
+template <typename Model>
+static void PCM_UpdateVoice(pcm_t& pcm, int slot, int voice_active)
+{
+    uint32_t *ram1 = pcm.ram1[slot];
+    uint16_t *ram2 = pcm.ram2[slot];
+    int okey = (ram2[7] & 0x20) != 0;
+    int key = (voice_active >> slot) & 1;
+
+    pcm_voice_batch_t& batch = pcm.voice_batch;
+
+    // A voice without key is silent: its pan and send levels are zero, and PCM_MixVoice clears all of the state written
+    // below except for the level of the third envelope. So only that envelope needs to run. This doesn't hold for slot
+    // 31, whose filter state is also the mix accumulator.
+    if (!key && pcm.nfs && slot != 31)
+    {
+        calc_tv(pcm, 2, ram2[5], &ram2[11], 0, NULL);
+
+        batch.sample[slot] = 0;
+        batch.volmul1[slot] = 0;
+        batch.volmul2[slot] = 0;
+        batch.pan[slot] = 0;
+        batch.rc[slot] = 0;
+
+        batch.key[slot] = 0;
+        batch.active[slot] = 0;
+        return;
+    }
+
+    int active = okey && key;
+    int kon = key && !okey;
+
+    // address generator
+
+    int b15 = (ram2[8] & 0x8000) != 0; // 0
+    int b6 = (ram2[7] & 0x40) != 0; // 1
+    int b7 = (ram2[7] & 0x80) != 0; // 1
+    int hiaddr = (ram2[7] >> 8) & 15; // 1
+    int old_nibble = (ram2[7] >> 12) & 15; // 1
+
+    int address = ram1[4]; // 0
+    int address_end = ram1[0]; // 1 or 2
+    int address_loop = ram1[2]; // 2 or 1
+
+    int cmp1 = b15 ? address_loop : address_end;
+    int cmp2 = address;
+    int nibble_cmp1 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 2
+    int irq_flag = 0;
+
+    // fixme:
+    if (kon)
+        irq_flag = ((cmp1 + address_loop) & 0x100000) != 0;
+    else
+        irq_flag = ((address + ((-address_loop) & 0xfffff)) & 0x100000) != 0;
+    irq_flag ^= b7;
+
+    int nibble_address = (!b6 && nibble_cmp1) ? address_loop : address; // 3
+    int address_b4 = (nibble_address & 0x10) != 0;
+    int wave_address = nibble_address >> 5;
+    int xor2 = (address_b4 ^ b7);
+    int check1 = xor2 && active;
+    int xor1 = (b15 ^ !nibble_cmp1);
+    int nibble_add = b6 ? check1 && xor1 : (!nibble_cmp1 && check1);
+    int nibble_subtract = b6 && !xor1 && active && !xor2;
+    if (b7)
+        wave_address -= nibble_add - nibble_subtract;
+    else
+        wave_address += nibble_add - nibble_subtract;
+    wave_address &= 0xfffff;
+
+    int newnibble = PCM_ReadROM<Model>(pcm, (hiaddr << 20) | wave_address);
+    int newnibble_sel = address_b4 ^ ((b6 || !nibble_cmp1) && okey);
+    if (newnibble_sel)
+        newnibble = (newnibble >> 4) & 15;
+    else
+        newnibble &= 15;
+
+    int sub_phase = (ram2[8] & 0x3fff); // 1
+    int interp_ratio = (sub_phase >> 7) & 127;
+    sub_phase += pcm.ram2[ram2[7] & 31][0]; // 5
+    int sub_phase_of = (sub_phase >> 14) & 7;
+    if (pcm.nfs)
+    {
+        ram2[8] &= ~0x3fff;
+        ram2[8] |= sub_phase & 0x3fff;
+    }
+
+
+    // address 0
+    int address_cnt = address;
+    int samp0 = (int8_t)PCM_ReadROM<Model>(pcm, (hiaddr << 20) | address_cnt); // 18
+
+    cmp1 = address;
+    cmp2 = address_cnt;
+    int nibble_cmp2 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 8
+    cmp1 = b15 ? address_loop : address_end;
+    cmp2 = address_cnt;
+    int address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 9
+
+    int next_address = address_cnt; // 11
+    int usenew = !nibble_cmp2;
+    int next_b15 = b15;
+
+    cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+    cmp2 = address_cnt;
+    int address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
+
+    int address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+    int address_sub = !address_cmp && b6 && b15;
+    if (b7)
+        address_cnt2 -= address_add - address_sub;
+    else
+        address_cnt2 += address_add - address_sub;
+    address_cnt = address_cnt2 & 0xfffff; // 11
+    b15 = b6 && (b15 ^ address_cmp); // 11
+
+    int samp1 = (int8_t)PCM_ReadROM<Model>(pcm, (hiaddr << 20) | address_cnt); // 20
+
+    cmp1 = address;
+    cmp2 = address_cnt;
+    int nibble_cmp3 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 12
+    cmp1 = b15 ? address_loop : address_end;
+    cmp2 = address_cnt;
+    address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 13
+
+    if (sub_phase_of >= 1)
+    {
+        next_address = address_cnt; // 13
+        usenew = !nibble_cmp3;
+        next_b15 = b15;
+    }
+
+    cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+    cmp2 = address_cnt;
+    address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
+
+    address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+    address_sub = !address_cmp && b6 && b15;
+    if (b7)
+        address_cnt2 -= address_add - address_sub;
+    else
+        address_cnt2 += address_add - address_sub;
+    address_cnt = address_cnt2 & 0xfffff; // 15
+    b15 = b6 && (b15 ^ address_cmp); // 15
+
+    int samp2 = (int8_t)PCM_ReadROM<Model>(pcm, (hiaddr << 20) | address_cnt); // 1
+
+    cmp1 = address;
+    cmp2 = address_cnt;
+    int nibble_cmp4 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 16
+    cmp1 = b15 ? address_loop : address_end;
+    cmp2 = address_cnt;
+    address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 17
+
+    if (sub_phase_of >= 2)
+    {
+        next_address = address_cnt; // 17
+        usenew = !nibble_cmp4;
+        next_b15 = b15;
+    }
+
+    cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+    cmp2 = address_cnt;
+    address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
+
+    address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+    address_sub = !address_cmp && b6 && b15;
+    if (b7)
+        address_cnt2 -= address_add - address_sub;
+    else
+        address_cnt2 += address_add - address_sub;
+    address_cnt = address_cnt2 & 0xfffff; // 19
+    b15 = b6 && (b15 ^ address_cmp); // 19
+
+    int samp3 = (int8_t)PCM_ReadROM<Model>(pcm, (hiaddr << 20) | address_cnt); // 5
+
+    cmp1 = address;
+    cmp2 = address_cnt;
+    int nibble_cmp5 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 20
+    cmp1 = b15 ? address_loop : address_end;
+    cmp2 = address_cnt;
+    address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 21
+
+    if (sub_phase_of >= 3)
+    {
+        next_address = address_cnt; // 21
+        usenew = !nibble_cmp5;
+        next_b15 = b15;
+    }
+
+    cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+    cmp2 = address_cnt;
+    address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
+
+    address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+    address_sub = !address_cmp && b6 && b15;
+    if (b7)
+        address_cnt2 -= address_add - address_sub;
+    else
+        address_cnt2 += address_add - address_sub;
+    address_cnt = address_cnt2 & 0xfffff; // 23
+    // b15 = b6 && (b15 ^ address_cmp); // 23
+
+    cmp1 = address;
+    cmp2 = address_cnt;
+    int nibble_cmp6 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 24
+
+    if (sub_phase_of >= 4)
+    {
+        next_address = address_cnt; // 1
+        usenew = !nibble_cmp6;
+        // b15 is not updated?
+    }
+
+    if (active && pcm.nfs)
+        ram1[4] = next_address;
+
+    if (pcm.nfs)
+    {
+        ram2[8] &= ~0x8000;
+        ram2[8] |= next_b15 << 15;
+    }
+
+    // dpcm
+
+    // 18
+    int reference = ram1[5];
+
+    // 19
+    int preshift = samp0 << 10;
+    int select_nibble = nibble_cmp2 ? old_nibble : newnibble;
+    int shift = (10 - select_nibble) & 15;
+
+    int shifted = (preshift << 1) >> shift;
+
+    if (sub_phase_of >= 1)
+        reference = addclip20(reference, shifted >> 1, shifted & 1);
+
+    preshift = samp1 << 10;
+    select_nibble = nibble_cmp3 ? old_nibble : newnibble;
+    shift = (10 - select_nibble) & 15;
+
+    shifted = (preshift << 1) >> shift;
+
+    if (sub_phase_of >= 2)
+        reference = addclip20(reference, shifted >> 1, shifted & 1);
+
+    preshift = samp2 << 10;
+    select_nibble = nibble_cmp4 ? old_nibble : newnibble;
+    shift = (10 - select_nibble) & 15;
+
+    shifted = (preshift << 1) >> shift;
+
+    if (sub_phase_of >= 3)
+        reference = addclip20(reference, shifted >> 1, shifted & 1);
+
+    preshift = samp3 << 10;
+    select_nibble = nibble_cmp5 ? old_nibble : newnibble;
+    shift = (10 - select_nibble) & 15;
+
+    shifted = (preshift << 1) >> shift;
+
+    if (sub_phase_of >= 4)
+        reference = addclip20(reference, shifted >> 1, shifted & 1);
+
+    // interpolation
+
+    int test = ram1[5];
+
+    int step0 = multi(interp_lut[0][interp_ratio] << 6, samp0) >> 8;
+    select_nibble = nibble_cmp2 ? old_nibble : newnibble;
+    shift = (10 - select_nibble) & 15;
+    step0 =  (step0 << 1) >> shift;
+
+    test = addclip20(test, step0 >> 1, step0 & 1);
+
+
+    int step1 = multi(interp_lut[1][interp_ratio] << 6, samp1) >> 8;
+    select_nibble = nibble_cmp3 ? old_nibble : newnibble;
+    shift = (10 - select_nibble) & 15;
+    step1 = (step1 << 1) >> shift;
+
+    test = addclip20(test, step1 >> 1, step1 & 1);
+
+    int step2 = multi(interp_lut[2][interp_ratio] << 6, samp2) >> 8;
+    select_nibble = nibble_cmp4 ? old_nibble : newnibble;
+    shift = (10 - select_nibble) & 15;
+    step2 = (step2 << 1) >> shift;
+
+    int reg1 = ram1[1];
+    int reg3 = ram1[3];
+    int reg2_6 = (ram2[6] >> 8) & 127;
+
+    test = addclip20(test, step2 >> 1, step2 & 1);
+
+    int filter = ram2[11];
+    int v3;
+
+    if constexpr (Model::is_mk1)
+    {
+        int mult1 = multi(reg1, filter >> 8); // 8
+        int mult2 = multi(reg1, (filter >> 1) & 127); // 9
+        int mult3 = multi(reg1, reg2_6); // 10
+
+        int v2 = addclip20(reg3, mult1 >> 6, (mult1 >> 5) & 1); // 9
+        int v1 = addclip20(v2, mult2 >> 13, (mult2 >> 12) & 1); // 10
+        int subvar = addclip20(v1, (mult3 >> 6), (mult3 >> 5) & 1); // 11
+
+        ram1[3] = v1;
+
+        v3 = addclip20(test, subvar ^ 0xfffff, 1); // 12
+
+        int mult4 = multi(v3, filter >> 8);
+        int mult5 = multi(v3, (filter >> 1) & 127);
+        int v4 = addclip20(reg1, mult4 >> 6, (mult4 >> 5) & 1); // 14
+        int v5 = addclip20(v4, mult5 >> 13, (mult5 >> 12) & 1); // 15
+
+        ram1[1] = v5;
+    }
+    else
+    {
+        // hack: use 32-bit math to avoid overflow
+        int mult1 = reg1 * (int8_t)(filter >> 8); // 8
+        int mult2 = reg1 * (int8_t)((filter >> 1) & 127); // 9
+        int mult3 = reg1 * (int8_t)reg2_6; // 10
+
+        int v2 = reg3 + (mult1 >> 6) + ((mult1 >> 5) & 1); // 9
+        int v1 = v2 + (mult2 >> 13) + ((mult2 >> 12) & 1); // 10
+        int subvar = v1 + (mult3 >> 6) + ((mult3 >> 5) & 1); // 11
+
+        ram1[3] = v1;
+
+        int tests = test;
+        tests <<= 12;
+        tests >>= 12;
+
+        v3 = tests - subvar; // 12
+
+        int mult4 = v3 * (int8_t)(filter >> 8);
+        int mult5 = v3 * (int8_t)((filter >> 1) & 127);
+        int v4 = reg1 + (mult4 >> 6) + ((mult4 >> 5) & 1); // 14
+        int v5 = v4 + (mult5 >> 13) + ((mult5 >> 12) & 1); // 15
+
+        ram1[1] = v5;
+    }
+
+
+    ram1[5] = reference;
+
+    if (active && (ram2[6] & 1) != 0 && (ram2[8] & 0x4000) == 0 && !pcm.irq_assert && irq_flag)
+    {
+        //fprintf(stderr, "irq voice %i\n", slot);
+        if (pcm.nfs)
+            ram2[8] |= 0x4000;
+        pcm.irq_assert = 1;
+        pcm.irq_channel = slot;
+        if constexpr (Model::is_jv880)
+            MCU_GA_SetGAInt(*pcm.mcu, 5, 1);
+        else
+            MCU_Interrupt_SetRequest(*pcm.mcu, INTERRUPT_SOURCE_IRQ0, 1);
+    }
+
+    int volmul1 = 0;
+    int volmul2 = 0;
+
+    calc_tv(pcm, 0, ram2[3], &ram2[9], active, &volmul1);
+    calc_tv(pcm, 1, ram2[4], &ram2[10], active, &volmul2);
+    calc_tv(pcm, 2, ram2[5], &ram2[11], active, NULL);
+
+    // if (volmul1 && volmul2)
+    //     volmul1 += 0;
+
+    int sample = (ram2[6] & 2) == 0 ? ram1[3] : v3;
+    //sample = test;
+
+    batch.sample[slot] = sample;
+    batch.volmul1[slot] = volmul1;
+    batch.volmul2[slot] = volmul2;
+    batch.pan[slot] = active ? ram2[1] : 0;
+    batch.rc[slot] = active ? ram2[2] : 0;
+
+    batch.key[slot] = key;
+    batch.active[slot] = active;
+    batch.nibble[slot] = (usenew || kon) ? newnibble : old_nibble;
+}
+
+// Adds the output of a voice to the mix, and updates its state for the next sample.
+static void PCM_MixVoice(pcm_t& pcm, int slot, const int* rcadd, const int* rcadd2)
+{
+    uint32_t *ram1 = pcm.ram1[slot];
+    uint16_t *ram2 = pcm.ram2[slot];
+    const pcm_voice_batch_t& batch = pcm.voice_batch;
+    int key = batch.key[slot];
+    int active = batch.active[slot];
+
+    int sampl = batch.sampl[slot];
+    int sampr = batch.sampr[slot];
+    int rc0 = batch.rc0[slot];
+    int rc1 = batch.rc1[slot];
+
+    // mix reverb/chorus?
+    int slot2 = (slot == pcm.config.reg_slots - 1) ? 31 : slot + 1;
+    switch (slot2)
+    {
+        // 17, 18 - reverb
+
+        case 17:
+            pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[0] >> 1, rcadd[0] & 1);
+            break;
+        case 18:
+            pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[1] >> 1, rcadd[1] & 1);
+            break;
+        case 21:
+            pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[2] >> 1, rcadd[2] & 1);
+            break;
+        case 22:
+            pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[3] >> 1, rcadd[3] & 1);
+            break;
+        case 23:
+            pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[4] >> 1, rcadd[4] & 1);
+            break;
+        case 31:
+            pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[5] >> 1, rcadd[5] & 1);
+            break;
+    }
+
+    int suml = addclip20(pcm.ram1[31][1], sampl >> 6, (sampl >> 5) & 1);
+    int sumr = addclip20(pcm.ram1[31][3], sampr >> 6, (sampr >> 5) & 1);
+
+    switch (slot2)
+    {
+        case 17:
+            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[0] >> 1, rcadd2[0] & 1);
+            break;
+        case 18:
+            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[1] >> 1, rcadd2[1] & 1);
+            break;
+        case 21:
+            pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[2] >> 1, rcadd2[2] & 1);
+            break;
+        case 22:
+            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[3] >> 1, rcadd2[3] & 1);
+            break;
+        case 23:
+            pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[4] >> 1, rcadd2[4] & 1);
+            break;
+        case 31:
+            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[5] >> 1, rcadd2[5] & 1);
+            break;
+    }
+
+    pcm.rcsum[0] = addclip20(pcm.rcsum[0], rc0 >> 1, rc0 & 1);
+    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rc1 >> 1, rc1 & 1);
+
+    if (slot != pcm.config.reg_slots - 1)
+    {
+        pcm.ram1[31][1] = suml;
+        pcm.ram1[31][3] = sumr;
+    }
+    else
+    {
+        pcm.accum_l = suml;
+        pcm.accum_r = sumr;
+    }
+
+    if (key && pcm.nfs)
+    {
+        ram2[7] &= ~0xf020;
+        ram2[7] |= batch.nibble[slot] << 12;
+
+        // update key
+        ram2[7] |= key << 5;
+    }
+
+    if (!active)
+    {
+        if (pcm.nfs)
+        {
+            ram1[1] = 0;
+            ram1[3] = 0;
+            ram1[5] = 0;
+        }
+
+        ram2[8] = 0;
+        ram2[9] = 0;
+        ram2[10] = 0;
+    }
+}
+
+template <typename Model>
 void PCM_Update(pcm_t& pcm, uint64_t cycles)
 {
+    PROFILE_SCOPE(PCM_UPDATE);
+
     while (pcm.cycles < cycles)
     {
         const int voice_active = pcm.voice_mask & pcm.voice_mask_pending;
@@ -1100,465 +1585,20 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
         pcm.rcsum[0] = 0;
         pcm.rcsum[1] = 0;
 
-        for (int slot = 0; slot < pcm.config.reg_slots; slot++)
+        // Slot 31 is also where the voices are mixed, so if it's a voice itself it must only run once all other voices
+        // have been mixed
+        const int batch_size = pcm.config.reg_slots < 32 ? 32 : 31;
+        for (int first = 0; first < pcm.config.reg_slots; first += batch_size)
         {
-            uint32_t *ram1 = pcm.ram1[slot];
-            uint16_t *ram2 = pcm.ram2[slot];
-            int okey = (ram2[7] & 0x20) != 0;
-            int key = (voice_active >> slot) & 1;
-
-            int active = okey && key;
-            int kon = key && !okey;
-
-            // address generator
-
-            int b15 = (ram2[8] & 0x8000) != 0; // 0
-            int b6 = (ram2[7] & 0x40) != 0; // 1
-            int b7 = (ram2[7] & 0x80) != 0; // 1
-            int hiaddr = (ram2[7] >> 8) & 15; // 1
-            int old_nibble = (ram2[7] >> 12) & 15; // 1
-
-            int address = ram1[4]; // 0
-            int address_end = ram1[0]; // 1 or 2
-            int address_loop = ram1[2]; // 2 or 1
-
-            int cmp1 = b15 ? address_loop : address_end;
-            int cmp2 = address;
-            int nibble_cmp1 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 2
-            int irq_flag = 0;
-
-            // fixme:
-            if (kon)
-                irq_flag = ((cmp1 + address_loop) & 0x100000) != 0;
-            else
-                irq_flag = ((address + ((-address_loop) & 0xfffff)) & 0x100000) != 0;
-            irq_flag ^= b7;
-
-            int nibble_address = (!b6 && nibble_cmp1) ? address_loop : address; // 3
-            int address_b4 = (nibble_address & 0x10) != 0;
-            int wave_address = nibble_address >> 5;
-            int xor2 = (address_b4 ^ b7);
-            int check1 = xor2 && active;
-            int xor1 = (b15 ^ !nibble_cmp1);
-            int nibble_add = b6 ? check1 && xor1 : (!nibble_cmp1 && check1);
-            int nibble_subtract = b6 && !xor1 && active && !xor2;
-            if (b7)
-                wave_address -= nibble_add - nibble_subtract;
-            else
-                wave_address += nibble_add - nibble_subtract;
-            wave_address &= 0xfffff;
-
-            int newnibble = PCM_ReadROM(pcm, (hiaddr << 20) | wave_address);
-            int newnibble_sel = address_b4 ^ ((b6 || !nibble_cmp1) && okey);
-            if (newnibble_sel)
-                newnibble = (newnibble >> 4) & 15;
-            else
-                newnibble &= 15;
-
-            int sub_phase = (ram2[8] & 0x3fff); // 1
-            int interp_ratio = (sub_phase >> 7) & 127;
-            sub_phase += pcm.ram2[ram2[7] & 31][0]; // 5
-            int sub_phase_of = (sub_phase >> 14) & 7;
-            if (pcm.nfs)
-            {
-                ram2[8] &= ~0x3fff;
-                ram2[8] |= sub_phase & 0x3fff;
-            }
-
-
-            // address 0
-            int address_cnt = address;
-            int samp0 = (int8_t)PCM_ReadROM(pcm, (hiaddr << 20) | address_cnt); // 18
-
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp2 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 8
-            cmp1 = b15 ? address_loop : address_end;
-            cmp2 = address_cnt;
-            int address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 9
-
-            int next_address = address_cnt; // 11
-            int usenew = !nibble_cmp2;
-            int next_b15 = b15;
-
-            cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-            cmp2 = address_cnt;
-            int address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
-
-            int address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-            int address_sub = !address_cmp && b6 && b15;
-            if (b7)
-                address_cnt2 -= address_add - address_sub;
-            else
-                address_cnt2 += address_add - address_sub;
-            address_cnt = address_cnt2 & 0xfffff; // 11
-            b15 = b6 && (b15 ^ address_cmp); // 11
-
-            int samp1 = (int8_t)PCM_ReadROM(pcm, (hiaddr << 20) | address_cnt); // 20
-
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp3 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 12
-            cmp1 = b15 ? address_loop : address_end;
-            cmp2 = address_cnt;
-            address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 13
-
-            if (sub_phase_of >= 1)
-            {
-                next_address = address_cnt; // 13
-                usenew = !nibble_cmp3;
-                next_b15 = b15;
-            }
-
-            cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-            cmp2 = address_cnt;
-            address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
-
-            address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-            address_sub = !address_cmp && b6 && b15;
-            if (b7)
-                address_cnt2 -= address_add - address_sub;
-            else
-                address_cnt2 += address_add - address_sub;
-            address_cnt = address_cnt2 & 0xfffff; // 15
-            b15 = b6 && (b15 ^ address_cmp); // 15
-
-            int samp2 = (int8_t)PCM_ReadROM(pcm, (hiaddr << 20) | address_cnt); // 1
-
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp4 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 16
-            cmp1 = b15 ? address_loop : address_end;
-            cmp2 = address_cnt;
-            address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 17
-
-            if (sub_phase_of >= 2)
-            {
-                next_address = address_cnt; // 17
-                usenew = !nibble_cmp4;
-                next_b15 = b15;
-            }
-
-            cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-            cmp2 = address_cnt;
-            address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
-
-            address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-            address_sub = !address_cmp && b6 && b15;
-            if (b7)
-                address_cnt2 -= address_add - address_sub;
-            else
-                address_cnt2 += address_add - address_sub;
-            address_cnt = address_cnt2 & 0xfffff; // 19
-            b15 = b6 && (b15 ^ address_cmp); // 19
-
-            int samp3 = (int8_t)PCM_ReadROM(pcm, (hiaddr << 20) | address_cnt); // 5
-
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp5 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 20
-            cmp1 = b15 ? address_loop : address_end;
-            cmp2 = address_cnt;
-            address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 21
-
-            if (sub_phase_of >= 3)
-            {
-                next_address = address_cnt; // 21
-                usenew = !nibble_cmp5;
-                next_b15 = b15;
-            }
-
-            cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-            cmp2 = address_cnt;
-            address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
-
-            address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-            address_sub = !address_cmp && b6 && b15;
-            if (b7)
-                address_cnt2 -= address_add - address_sub;
-            else
-                address_cnt2 += address_add - address_sub;
-            address_cnt = address_cnt2 & 0xfffff; // 23
-            // b15 = b6 && (b15 ^ address_cmp); // 23
-
-            cmp1 = address;
-            cmp2 = address_cnt;
-            int nibble_cmp6 = (cmp1 & 0xffff0) == (cmp2 & 0xffff0); // 24
-
-            if (sub_phase_of >= 4)
-            {
-                next_address = address_cnt; // 1
-                usenew = !nibble_cmp6;
-                // b15 is not updated?
-            }
-
-            if (active && pcm.nfs)
-                ram1[4] = next_address;
-
-            if (pcm.nfs)
-            {
-                ram2[8] &= ~0x8000;
-                ram2[8] |= next_b15 << 15;
-            }
-
-            // dpcm
-
-            // 18
-            int reference = ram1[5];
-
-            // 19
-            int preshift = samp0 << 10;
-            int select_nibble = nibble_cmp2 ? old_nibble : newnibble;
-            int shift = (10 - select_nibble) & 15;
-
-            int shifted = (preshift << 1) >> shift;
-
-            if (sub_phase_of >= 1)
-                reference = addclip20(reference, shifted >> 1, shifted & 1);
-
-            preshift = samp1 << 10;
-            select_nibble = nibble_cmp3 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-
-            shifted = (preshift << 1) >> shift;
-
-            if (sub_phase_of >= 2)
-                reference = addclip20(reference, shifted >> 1, shifted & 1);
-
-            preshift = samp2 << 10;
-            select_nibble = nibble_cmp4 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-
-            shifted = (preshift << 1) >> shift;
-
-            if (sub_phase_of >= 3)
-                reference = addclip20(reference, shifted >> 1, shifted & 1);
-
-            preshift = samp3 << 10;
-            select_nibble = nibble_cmp5 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-
-            shifted = (preshift << 1) >> shift;
-
-            if (sub_phase_of >= 4)
-                reference = addclip20(reference, shifted >> 1, shifted & 1);
-
-            // interpolation
-
-            int test = ram1[5];
+            const int last = std::min(first + batch_size, pcm.config.reg_slots);
 
-            int step0 = multi(interp_lut[0][interp_ratio] << 6, samp0) >> 8;
-            select_nibble = nibble_cmp2 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-            step0 =  (step0 << 1) >> shift;
+            for (int slot = first; slot < last; slot++)
+                PCM_UpdateVoice<Model>(pcm, slot, voice_active);
 
-            test = addclip20(test, step0 >> 1, step0 & 1);
+            pcm.output_stage(pcm.voice_batch, first, last - first);
 
-
-            int step1 = multi(interp_lut[1][interp_ratio] << 6, samp1) >> 8;
-            select_nibble = nibble_cmp3 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-            step1 = (step1 << 1) >> shift;
-
-            test = addclip20(test, step1 >> 1, step1 & 1);
-
-            int step2 = multi(interp_lut[2][interp_ratio] << 6, samp2) >> 8;
-            select_nibble = nibble_cmp4 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-            step2 = (step2 << 1) >> shift;
-
-            int reg1 = ram1[1];
-            int reg3 = ram1[3];
-            int reg2_6 = (ram2[6] >> 8) & 127;
-
-            test = addclip20(test, step2 >> 1, step2 & 1);
-
-            int filter = ram2[11];
-            int v3;
-
-            if (pcm.mcu->is_mk1)
-            {
-                int mult1 = multi(reg1, filter >> 8); // 8
-                int mult2 = multi(reg1, (filter >> 1) & 127); // 9
-                int mult3 = multi(reg1, reg2_6); // 10
-
-                int v2 = addclip20(reg3, mult1 >> 6, (mult1 >> 5) & 1); // 9
-                int v1 = addclip20(v2, mult2 >> 13, (mult2 >> 12) & 1); // 10
-                int subvar = addclip20(v1, (mult3 >> 6), (mult3 >> 5) & 1); // 11
-
-                ram1[3] = v1;
-
-                v3 = addclip20(test, subvar ^ 0xfffff, 1); // 12
-
-                int mult4 = multi(v3, filter >> 8);
-                int mult5 = multi(v3, (filter >> 1) & 127);
-                int v4 = addclip20(reg1, mult4 >> 6, (mult4 >> 5) & 1); // 14
-                int v5 = addclip20(v4, mult5 >> 13, (mult5 >> 12) & 1); // 15
-
-                ram1[1] = v5;
-            }
-            else
-            {
-                // hack: use 32-bit math to avoid overflow
-                int mult1 = reg1 * (int8_t)(filter >> 8); // 8
-                int mult2 = reg1 * (int8_t)((filter >> 1) & 127); // 9
-                int mult3 = reg1 * (int8_t)reg2_6; // 10
-
-                int v2 = reg3 + (mult1 >> 6) + ((mult1 >> 5) & 1); // 9
-                int v1 = v2 + (mult2 >> 13) + ((mult2 >> 12) & 1); // 10
-                int subvar = v1 + (mult3 >> 6) + ((mult3 >> 5) & 1); // 11
-
-                ram1[3] = v1;
-
-                int tests = test;
-                tests <<= 12;
-                tests >>= 12;
-
-                v3 = tests - subvar; // 12
-
-                int mult4 = v3 * (int8_t)(filter >> 8);
-                int mult5 = v3 * (int8_t)((filter >> 1) & 127);
-                int v4 = reg1 + (mult4 >> 6) + ((mult4 >> 5) & 1); // 14
-                int v5 = v4 + (mult5 >> 13) + ((mult5 >> 12) & 1); // 15
-
-                ram1[1] = v5;
-            }
-
-
-            ram1[5] = reference;
-
-            if (active && (ram2[6] & 1) != 0 && (ram2[8] & 0x4000) == 0 && !pcm.irq_assert && irq_flag)
-            {
-                //fprintf(stderr, "irq voice %i\n", slot);
-                if (pcm.nfs)
-                    ram2[8] |= 0x4000;
-                pcm.irq_assert = 1;
-                pcm.irq_channel = slot;
-                if (pcm.mcu->is_jv880)
-                    MCU_GA_SetGAInt(*pcm.mcu, 5, 1);
-                else
-                    MCU_Interrupt_SetRequest(*pcm.mcu, INTERRUPT_SOURCE_IRQ0, 1);
-            }
-
-            int volmul1 = 0;
-            int volmul2 = 0;
-
-            calc_tv(pcm, 0, ram2[3], &ram2[9], active, &volmul1);
-            calc_tv(pcm, 1, ram2[4], &ram2[10], active, &volmul2);
-            calc_tv(pcm, 2, ram2[5], &ram2[11], active, NULL);
-
-            // if (volmul1 && volmul2)
-            //     volmul1 += 0;
-
-            int sample = (ram2[6] & 2) == 0 ? ram1[3] : v3;
-            //sample = test;
-
-            int multiv1 = multi(sample, volmul1 >> 8);
-            int multiv2 = multi(sample, (volmul1 >> 1) & 127);
-
-            int sample2 = addclip20(multiv1 >> 6, multiv2 >> 13, ((multiv2 >> 12) | (multiv1 >> 5)) & 1);
-
-            int multiv3 = multi(sample2, volmul2 >> 8);
-            int multiv4 = multi(sample2, (volmul2 >> 1) & 127);
-
-            int sample3 = addclip20(multiv3 >> 6, multiv4 >> 13, ((multiv4 >> 12) | (multiv3 >> 5)) & 1);
-
-            int pan = active ? ram2[1] : 0;
-            int rc = active ? ram2[2] : 0;
-
-            int sampl = multi(sample3, (pan >> 8) & 255);
-            int sampr = multi(sample3, (pan >> 0) & 255);
-
-            int rc0 = multi(sample3, (rc >> 8) & 255) >> 5; // reverb
-            int rc1 = multi(sample3, (rc >> 0) & 255) >> 5; // chorus
-
-            // mix reverb/chorus?
-            int slot2 = (slot == pcm.config.reg_slots - 1) ? 31 : slot + 1;
-            switch (slot2)
-            {
-                // 17, 18 - reverb
-
-                case 17:
-                    pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[0] >> 1, rcadd[0] & 1);
-                    break;
-                case 18:
-                    pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[1] >> 1, rcadd[1] & 1);
-                    break;
-                case 21:
-                    pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[2] >> 1, rcadd[2] & 1);
-                    break;
-                case 22:
-                    pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[3] >> 1, rcadd[3] & 1);
-                    break;
-                case 23:
-                    pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[4] >> 1, rcadd[4] & 1);
-                    break;
-                case 31:
-                    pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[5] >> 1, rcadd[5] & 1);
-                    break;
-            }
-
-            int suml = addclip20(pcm.ram1[31][1], sampl >> 6, (sampl >> 5) & 1);
-            int sumr = addclip20(pcm.ram1[31][3], sampr >> 6, (sampr >> 5) & 1);
-
-            switch (slot2)
-            {
-                case 17:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[0] >> 1, rcadd2[0] & 1);
-                    break;
-                case 18:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[1] >> 1, rcadd2[1] & 1);
-                    break;
-                case 21:
-                    pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[2] >> 1, rcadd2[2] & 1);
-                    break;
-                case 22:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[3] >> 1, rcadd2[3] & 1);
-                    break;
-                case 23:
-                    pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[4] >> 1, rcadd2[4] & 1);
-                    break;
-                case 31:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[5] >> 1, rcadd2[5] & 1);
-                    break;
-            }
-
-            pcm.rcsum[0] = addclip20(pcm.rcsum[0], rc0 >> 1, rc0 & 1);
-            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rc1 >> 1, rc1 & 1);
-
-            if (slot != pcm.config.reg_slots - 1)
-            {
-                pcm.ram1[31][1] = suml;
-                pcm.ram1[31][3] = sumr;
-            }
-            else
-            {
-                pcm.accum_l = suml;
-                pcm.accum_r = sumr;
-            }
-
-            if (key && pcm.nfs)
-            {
-                ram2[7] &= ~0xf020;
-                ram2[7] |= ((usenew || kon) ? newnibble : old_nibble) << 12;
-
-                // update key
-                ram2[7] |= key << 5;
-            }
-
-            if (!active)
-            {
-                if (pcm.nfs)
-                {
-                    ram1[1] = 0;
-                    ram1[3] = 0;
-                    ram1[5] = 0;
-                }
-
-                ram2[8] = 0;
-                ram2[9] = 0;
-                ram2[10] = 0;
-            }
+            for (int slot = first; slot < last; slot++)
+                PCM_MixVoice(pcm, slot, rcadd, rcadd2);
         }
 
         if (pcm.nfs)
@@ -1570,10 +1610,20 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
 
         int new_cycles = (pcm.config.reg_slots + 1) * 25;
 
-        pcm.cycles += pcm.mcu->is_jv880 ? (new_cycles * 25) / 29 : new_cycles;
+        pcm.cycles += Model::is_jv880 ? (new_cycles * 25) / 29 : new_cycles;
     }
 }
 
+void PCM_Update(pcm_t& pcm, uint64_t cycles)
+{
+    MCU_WithModel(*pcm.mcu, [&](auto model) { PCM_Update<decltype(model)>(pcm, cycles); });
+}
+
+template void PCM_Update<mcu_model_mk2>(pcm_t& pcm, uint64_t cycles);
+template void PCM_Update<mcu_model_mk1>(pcm_t& pcm, uint64_t cycles);
+template void PCM_Update<mcu_model_jv880>(pcm_t& pcm, uint64_t cycles);
+template void PCM_Update<mcu_model_scb55>(pcm_t& pcm, uint64_t cycles);
+
 uint32_t PCM_GetOutputFrequency(const pcm_t& pcm)
 {
     uint32_t freq = (pcm.mcu->is_mk1 || pcm.mcu->is_jv880) ? 64000 : 66207;
@@ -1586,3 +1636,33 @@ uint32_t PCM_GetOutputFrequency(const pcm_t& pcm)
         return freq;
     }
 }
+
+double PCM_GetCyclesPerFrame(const pcm_t& pcm)
+{
+    // Same as the cycle count PCM_Update adds per iteration
+    int cycles = (pcm.config.reg_slots + 1) * 25;
+    if (pcm.mcu->is_jv880)
+        cycles = (cycles * 25) / 29;
+
+    if (!pcm.disable_oversampling && pcm.config.oversampling)
+        return cycles / 2.0;
+    else
+        return cycles;
+}
+
+bool PCM_IsSilent(const pcm_t& pcm, int32_t threshold)
+{
+    if ((pcm.voice_mask & pcm.voice_mask_pending) != 0)
+        return false;
+
+    // Same decoding as eram_unpack
+    for (int addr = 0; addr < 0x4000; addr++)
+    {
+        int data = pcm.eram[addr];
+        int val = ((data & 0x3fff) << 18) >> (18 - ((data >> 14) & 3) * 2);
+        if (val > threshold || val < -threshold)
+            return false;
+    }
+
+    return true;
+}
@@ -34,6 +34,8 @@
 
 #pragma once
 
+#include "pcm_simd.h"
+#include <cstddef>
 #include <cstdint>
 
 struct mcu_t;
@@ -82,20 +84,39 @@ struct pcm_t {
     int accum_r = 0;
     int rcsum[2]{};
 
+    bool disable_oversampling = false;
+
+    // Everything above this point is machine state and is captured by EMU_Snapshot.
+
     mcu_t* mcu = nullptr;
 
-    uint8_t waverom1[0x200000]{};
-    uint8_t waverom2[0x200000]{};
-    uint8_t waverom3[0x100000]{};
-    uint8_t waverom_card[0x200000]{};
-    uint8_t waverom_exp[0x800000]{};
+    // Shared between emulators, see RomImages.
+    const uint8_t* waverom1 = nullptr;
+    const uint8_t* waverom2 = nullptr;
+    const uint8_t* waverom3 = nullptr;
+    const uint8_t* waverom_card = nullptr;
+    const uint8_t* waverom_exp = nullptr;
 
-    bool disable_oversampling = false;
+    // Scratch space for the voice loop in PCM_Update
+    pcm_voice_batch_t voice_batch{};
+    pcm_output_stage_fn output_stage = PCM_OutputStage_Scalar;
 };
 
+// Size of the machine state at the start of pcm_t.
+static const size_t PCM_STATE_SIZE = offsetof(pcm_t, mcu);
+
 void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data);
 uint8_t PCM_Read(pcm_t& pcm, uint32_t address);
 void PCM_Init(pcm_t& pcm, mcu_t& mcu);
+// Same as PCM_Update<Model> for the model of the current romset.
+void PCM_Update(pcm_t& pcm, uint64_t cycles);
+// `Model` is one of the mcu_model_traits in mcu.h and must match the romset.
+template <typename Model>
 void PCM_Update(pcm_t& pcm, uint64_t cycles);
 uint32_t PCM_GetOutputFrequency(const pcm_t& pcm);
+// Returns the number of MCU cycles between two output frames. Depends on the slot count programmed by the firmware.
+double PCM_GetCyclesPerFrame(const pcm_t& pcm);
+// Returns true if no voice is keyed on and every word of the reverb/chorus delay memory is within `threshold` of zero,
+// i.e. the chip can't produce audible output until the firmware keys a voice on again.
+bool PCM_IsSilent(const pcm_t& pcm, int32_t threshold);
 void PCM_GetConfig(PCM_Config& config, uint8_t config_byte);
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pcm_simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only allow intrinsics in functions compiled for the instruction set; MSVC always allows them
+#if defined(__GNUC__) || defined(__clang__)
+#define PCM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PCM_TARGET(isa)
+#endif
+
+static void PCM_OutputStageVoice(pcm_voice_batch_t& batch, int slot)
+{
+    int sample = batch.sample[slot];
+    int volmul1 = batch.volmul1[slot];
+    int volmul2 = batch.volmul2[slot];
+
+    int multiv1 = multi(sample, volmul1 >> 8);
+    int multiv2 = multi(sample, (volmul1 >> 1) & 127);
+
+    int sample2 = addclip20(multiv1 >> 6, multiv2 >> 13, ((multiv2 >> 12) | (multiv1 >> 5)) & 1);
+
+    int multiv3 = multi(sample2, volmul2 >> 8);
+    int multiv4 = multi(sample2, (volmul2 >> 1) & 127);
+
+    int sample3 = addclip20(multiv3 >> 6, multiv4 >> 13, ((multiv4 >> 12) | (multiv3 >> 5)) & 1);
+
+    int pan = batch.pan[slot];
+    int rc = batch.rc[slot];
+
+    batch.sampl[slot] = multi(sample3, (pan >> 8) & 255);
+    batch.sampr[slot] = multi(sample3, (pan >> 0) & 255);
+
+    batch.rc0[slot] = multi(sample3, (rc >> 8) & 255) >> 5; // reverb
+    batch.rc1[slot] = multi(sample3, (rc >> 0) & 255) >> 5; // chorus
+}
+
+void PCM_OutputStage_Scalar(pcm_voice_batch_t& batch, int first, int count)
+{
+    for (int slot = first; slot < first + count; slot++)
+        PCM_OutputStageVoice(batch, slot);
+}
+
+// The vector versions below are the scalar code with one voice per lane. `multi` takes its second operand as int8_t,
+// which is the low byte sign-extended.
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+PCM_TARGET("sse4.1") static inline __m128i sx20_sse41(__m128i v)
+{
+    return _mm_srai_epi32(_mm_slli_epi32(v, 12), 12);
+}
+
+PCM_TARGET("sse4.1") static inline __m128i sx8_sse41(__m128i v)
+{
+    return _mm_srai_epi32(_mm_slli_epi32(v, 24), 24);
+}
+
+PCM_TARGET("sse4.1") static inline __m128i multi_sse41(__m128i val1, __m128i val2)
+{
+    return _mm_mullo_epi32(sx20_sse41(val1), sx8_sse41(val2));
+}
+
+// addclip20(m1 >> 6, m2 >> 13, ((m2 >> 12) | (m1 >> 5)) & 1)
+PCM_TARGET("sse4.1") static inline __m128i volume_sse41(__m128i m1, __m128i m2)
+{
+    __m128i cin = _mm_and_si128(_mm_or_si128(_mm_srai_epi32(m2, 12), _mm_srai_epi32(m1, 5)), _mm_set1_epi32(1));
+    return _mm_add_epi32(_mm_add_epi32(sx20_sse41(_mm_srai_epi32(m1, 6)), sx20_sse41(_mm_srai_epi32(m2, 13))), cin);
+}
+
+PCM_TARGET("sse4.1") void PCM_OutputStage_SSE41(pcm_voice_batch_t& batch, int first, int count)
+{
+    const __m128i mask7 = _mm_set1_epi32(127);
+
+    int slot = first;
+    for (; slot + 4 <= first + count; slot += 4)
+    {
+        __m128i sample = _mm_loadu_si128((const __m128i*)&batch.sample[slot]);
+        __m128i volmul1 = _mm_loadu_si128((const __m128i*)&batch.volmul1[slot]);
+        __m128i volmul2 = _mm_loadu_si128((const __m128i*)&batch.volmul2[slot]);
+
+        __m128i multiv1 = multi_sse41(sample, _mm_srai_epi32(volmul1, 8));
+        __m128i multiv2 = multi_sse41(sample, _mm_and_si128(_mm_srai_epi32(volmul1, 1), mask7));
+        __m128i sample2 = volume_sse41(multiv1, multiv2);
+
+        __m128i multiv3 = multi_sse41(sample2, _mm_srai_epi32(volmul2, 8));
+        __m128i multiv4 = multi_sse41(sample2, _mm_and_si128(_mm_srai_epi32(volmul2, 1), mask7));
+        __m128i sample3 = volume_sse41(multiv3, multiv4);
+
+        __m128i pan = _mm_loadu_si128((const __m128i*)&batch.pan[slot]);
+        __m128i rc = _mm_loadu_si128((const __m128i*)&batch.rc[slot]);
+
+        _mm_storeu_si128((__m128i*)&batch.sampl[slot], multi_sse41(sample3, _mm_srai_epi32(pan, 8)));
+        _mm_storeu_si128((__m128i*)&batch.sampr[slot], multi_sse41(sample3, pan));
+        _mm_storeu_si128((__m128i*)&batch.rc0[slot], _mm_srai_epi32(multi_sse41(sample3, _mm_srai_epi32(rc, 8)), 5));
+        _mm_storeu_si128((__m128i*)&batch.rc1[slot], _mm_srai_epi32(multi_sse41(sample3, rc), 5));
+    }
+
+    for (; slot < first + count; slot++)
+        PCM_OutputStageVoice(batch, slot);
+}
+
+PCM_TARGET("avx2") static inline __m256i sx20_avx2(__m256i v)
+{
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 12), 12);
+}
+
+PCM_TARGET("avx2") static inline __m256i sx8_avx2(__m256i v)
+{
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 24), 24);
+}
+
+PCM_TARGET("avx2") static inline __m256i multi_avx2(__m256i val1, __m256i val2)
+{
+    return _mm256_mullo_epi32(sx20_avx2(val1), sx8_avx2(val2));
+}
+
+PCM_TARGET("avx2") static inline __m256i volume_avx2(__m256i m1, __m256i m2)
+{
+    __m256i cin = _mm256_and_si256(_mm256_or_si256(_mm256_srai_epi32(m2, 12), _mm256_srai_epi32(m1, 5)),
+                                   _mm256_set1_epi32(1));
+    return _mm256_add_epi32(_mm256_add_epi32(sx20_avx2(_mm256_srai_epi32(m1, 6)), sx20_avx2(_mm256_srai_epi32(m2, 13))),
+                            cin);
+}
+
+PCM_TARGET("avx2") void PCM_OutputStage_AVX2(pcm_voice_batch_t& batch, int first, int count)
+{
+    const __m256i mask7 = _mm256_set1_epi32(127);
+
+    int slot = first;
+    for (; slot + 8 <= first + count; slot += 8)
+    {
+        __m256i sample = _mm256_loadu_si256((const __m256i*)&batch.sample[slot]);
+        __m256i volmul1 = _mm256_loadu_si256((const __m256i*)&batch.volmul1[slot]);
+        __m256i volmul2 = _mm256_loadu_si256((const __m256i*)&batch.volmul2[slot]);
+
+        __m256i multiv1 = multi_avx2(sample, _mm256_srai_epi32(volmul1, 8));
+        __m256i multiv2 = multi_avx2(sample, _mm256_and_si256(_mm256_srai_epi32(volmul1, 1), mask7));
+        __m256i sample2 = volume_avx2(multiv1, multiv2);
+
+        __m256i multiv3 = multi_avx2(sample2, _mm256_srai_epi32(volmul2, 8));
+        __m256i multiv4 = multi_avx2(sample2, _mm256_and_si256(_mm256_srai_epi32(volmul2, 1), mask7));
+        __m256i sample3 = volume_avx2(multiv3, multiv4);
+
+        __m256i pan = _mm256_loadu_si256((const __m256i*)&batch.pan[slot]);
+        __m256i rc = _mm256_loadu_si256((const __m256i*)&batch.rc[slot]);
+
+        _mm256_storeu_si256((__m256i*)&batch.sampl[slot], multi_avx2(sample3, _mm256_srai_epi32(pan, 8)));
+        _mm256_storeu_si256((__m256i*)&batch.sampr[slot], multi_avx2(sample3, pan));
+        _mm256_storeu_si256((__m256i*)&batch.rc0[slot],
+                            _mm256_srai_epi32(multi_avx2(sample3, _mm256_srai_epi32(rc, 8)), 5));
+        _mm256_storeu_si256((__m256i*)&batch.rc1[slot], _mm256_srai_epi32(multi_avx2(sample3, rc), 5));
+    }
+
+    // GCC turns the call below into a jump without clearing the upper halves of the ymm registers first. Left dirty,
+    // they slow down every non-VEX SSE instruction that follows, which is the rest of the emulator.
+    _mm256_zeroupper();
+
+    // At most 7 slots are left, so finish with SSE4.1 and then scalar code
+    PCM_OutputStage_SSE41(batch, slot, first + count - slot);
+}
+
+static bool PCM_HasAVX2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static bool PCM_HasSSE41()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+
+static inline int32x4_t sx20_neon(int32x4_t v)
+{
+    return vshrq_n_s32(vshlq_n_s32(v, 12), 12);
+}
+
+static inline int32x4_t sx8_neon(int32x4_t v)
+{
+    return vshrq_n_s32(vshlq_n_s32(v, 24), 24);
+}
+
+static inline int32x4_t multi_neon(int32x4_t val1, int32x4_t val2)
+{
+    return vmulq_s32(sx20_neon(val1), sx8_neon(val2));
+}
+
+static inline int32x4_t volume_neon(int32x4_t m1, int32x4_t m2)
+{
+    int32x4_t cin = vandq_s32(vorrq_s32(vshrq_n_s32(m2, 12), vshrq_n_s32(m1, 5)), vdupq_n_s32(1));
+    return vaddq_s32(vaddq_s32(sx20_neon(vshrq_n_s32(m1, 6)), sx20_neon(vshrq_n_s32(m2, 13))), cin);
+}
+
+void PCM_OutputStage_NEON(pcm_voice_batch_t& batch, int first, int count)
+{
+    const int32x4_t mask7 = vdupq_n_s32(127);
+
+    int slot = first;
+    for (; slot + 4 <= first + count; slot += 4)
+    {
+        int32x4_t sample = vld1q_s32(&batch.sample[slot]);
+        int32x4_t volmul1 = vld1q_s32(&batch.volmul1[slot]);
+        int32x4_t volmul2 = vld1q_s32(&batch.volmul2[slot]);
+
+        int32x4_t multiv1 = multi_neon(sample, vshrq_n_s32(volmul1, 8));
+        int32x4_t multiv2 = multi_neon(sample, vandq_s32(vshrq_n_s32(volmul1, 1), mask7));
+        int32x4_t sample2 = volume_neon(multiv1, multiv2);
+
+        int32x4_t multiv3 = multi_neon(sample2, vshrq_n_s32(volmul2, 8));
+        int32x4_t multiv4 = multi_neon(sample2, vandq_s32(vshrq_n_s32(volmul2, 1), mask7));
+        int32x4_t sample3 = volume_neon(multiv3, multiv4);
+
+        int32x4_t pan = vld1q_s32(&batch.pan[slot]);
+        int32x4_t rc = vld1q_s32(&batch.rc[slot]);
+
+        vst1q_s32(&batch.sampl[slot], multi_neon(sample3, vshrq_n_s32(pan, 8)));
+        vst1q_s32(&batch.sampr[slot], multi_neon(sample3, pan));
+        vst1q_s32(&batch.rc0[slot], vshrq_n_s32(multi_neon(sample3, vshrq_n_s32(rc, 8)), 5));
+        vst1q_s32(&batch.rc1[slot], vshrq_n_s32(multi_neon(sample3, rc), 5));
+    }
+
+    for (; slot < first + count; slot++)
+        PCM_OutputStageVoice(batch, slot);
+}
+
+#endif
+
+pcm_output_stage_fn PCM_GetOutputStage()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    if (PCM_HasAVX2())
+        return PCM_OutputStage_AVX2;
+    if (PCM_HasSSE41())
+        return PCM_OutputStage_SSE41;
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+    return PCM_OutputStage_NEON;
+#else
+    return PCM_OutputStage_Scalar;
+#endif
+}
+
+std::vector<pcm_output_stage_t> PCM_GetOutputStages()
+{
+    std::vector<pcm_output_stage_t> stages{{"scalar", PCM_OutputStage_Scalar}};
+#if defined(__x86_64__) || defined(_M_X64)
+    if (PCM_HasSSE41())
+        stages.push_back({"sse4.1", PCM_OutputStage_SSE41});
+    if (PCM_HasAVX2())
+        stages.push_back({"avx2", PCM_OutputStage_AVX2});
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+    stages.push_back({"neon", PCM_OutputStage_NEON});
+#endif
+    return stages;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021, 2024 nukeykt
+ *
+ *  Redistribution and use of this code or any derivative works are permitted
+ *  provided that the following conditions are met:
+ *
+ *   - Redistributions may not be sold, nor may they be used in a commercial
+ *     product or activity.
+ *
+ *   - Redistributions that are modified from the original source must include the
+ *     complete source code, including the source code for all components used by a
+ *     binary built from the modified sources. However, as a special exception, the
+ *     source code distributed need not include anything that is normally distributed
+ *     (in either source or binary form) with the major components (compiler, kernel,
+ *     and so on) of the operating system on which the executable runs, unless that
+ *     component itself accompanies the executable.
+ *
+ *   - Redistributions must reproduce the above copyright notice, this list of
+ *     conditions and the following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Sign-extends a 20-bit signed integer to a 32-bit signed integer.
+constexpr inline int32_t sx20(int32_t in)
+{
+    return (in << 12) >> 12;
+}
+
+inline int32_t addclip20(int32_t add1, int32_t add2, int32_t cin)
+{
+    return sx20(add1) + sx20(add2) + cin;
+}
+
+inline int32_t multi(int32_t val1, int8_t val2)
+{
+    return sx20(val1) * val2;
+}
+
+// Values passed between the stages of the voice loop in PCM_Update, stored as one array per value with one element per
+// voice slot. The per-voice stage fills the inputs, the output stage computes the outputs for a range of slots at
+// once, and the mixing stage consumes them in slot order.
+struct pcm_voice_batch_t {
+    // Inputs of the output stage
+    alignas(32) int32_t sample[32]{};
+    alignas(32) int32_t volmul1[32]{};
+    alignas(32) int32_t volmul2[32]{};
+    alignas(32) int32_t pan[32]{};
+    alignas(32) int32_t rc[32]{};
+
+    // Outputs of the output stage
+    alignas(32) int32_t sampl[32]{};
+    alignas(32) int32_t sampr[32]{};
+    alignas(32) int32_t rc0[32]{};
+    alignas(32) int32_t rc1[32]{};
+
+    // Only used by the mixing stage
+    int32_t key[32]{};
+    int32_t active[32]{};
+    int32_t nibble[32]{};
+};
+
+// Applies the two envelope volumes, panning and the reverb/chorus send levels to slots [first, first + count).
+typedef void (*pcm_output_stage_fn)(pcm_voice_batch_t& batch, int first, int count);
+
+void PCM_OutputStage_Scalar(pcm_voice_batch_t& batch, int first, int count);
+#if defined(__x86_64__) || defined(_M_X64)
+void PCM_OutputStage_SSE41(pcm_voice_batch_t& batch, int first, int count);
+void PCM_OutputStage_AVX2(pcm_voice_batch_t& batch, int first, int count);
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+void PCM_OutputStage_NEON(pcm_voice_batch_t& batch, int first, int count);
+#endif
+
+// Returns the fastest output stage the host CPU supports. All of them produce identical results.
+pcm_output_stage_fn PCM_GetOutputStage();
+
+struct pcm_output_stage_t {
+    const char* name;
+    pcm_output_stage_fn fn;
+};
+
+// Lists every output stage the host CPU supports, starting with PCM_OutputStage_Scalar.
+std::vector<pcm_output_stage_t> PCM_GetOutputStages();
@@ -0,0 +1,195 @@
+#include "profile.h"
+
+#include <atomic>
+#include <cstdlib>
+
+const char* PROFILE_ZoneName(PROFILE_Zone zone)
+{
+    switch (zone)
+    {
+    case PROFILE_Zone::MCU_INSTRUCTION:
+        return "mcu_instruction";
+    case PROFILE_Zone::PCM_UPDATE:
+        return "pcm_update";
+    case PROFILE_Zone::SM_UPDATE:
+        return "sm_update";
+    case PROFILE_Zone::TIMER_CLOCK:
+        return "timer_clock";
+    case PROFILE_Zone::RESAMPLE:
+        return "resample";
+    case PROFILE_Zone::COUNT:
+        break;
+    }
+    return "invalid zone";
+}
+
+const char* PROFILE_CounterName(PROFILE_Counter counter)
+{
+    switch (counter)
+    {
+    case PROFILE_Counter::RENDERED_FRAMES:
+        return "rendered_frames";
+    case PROFILE_Counter::MIDI_BYTES:
+        return "midi_bytes";
+    case PROFILE_Counter::COUNT:
+        break;
+    }
+    return "invalid counter";
+}
+
+#ifdef NUKED_SC55_PROFILE
+
+using PROFILE_Clock = std::chrono::steady_clock;
+
+// The shared stats; relaxed atomics are enough since every value is independent
+struct PROFILE_Shared
+{
+    std::atomic<uint64_t> calls[PROFILE_ZONE_COUNT]{};
+    std::atomic<uint64_t> ticks[PROFILE_ZONE_COUNT]{};
+    std::atomic<uint64_t> counters[PROFILE_COUNTER_COUNT]{};
+
+    std::atomic<int64_t> reset_time{PROFILE_Clock::now().time_since_epoch().count()};
+};
+
+static PROFILE_Shared g_profile;
+
+// Pairs of counter and clock readings for calibrating the counter rate
+static const uint64_t                  g_calibration_ticks = PROFILE_Now();
+static const PROFILE_Clock::time_point g_calibration_time  = PROFILE_Clock::now();
+
+void PROFILE_Publish()
+{
+    PROFILE_Local& local = PROFILE_GetLocal();
+
+    for (size_t i = 0; i < PROFILE_ZONE_COUNT; ++i)
+    {
+        if (local.calls[i])
+        {
+            g_profile.calls[i].fetch_add(local.calls[i], std::memory_order_relaxed);
+            g_profile.ticks[i].fetch_add(local.ticks[i], std::memory_order_relaxed);
+        }
+    }
+    for (size_t i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+    {
+        if (local.counters[i])
+        {
+            g_profile.counters[i].fetch_add(local.counters[i], std::memory_order_relaxed);
+        }
+    }
+
+    local = {};
+}
+
+void PROFILE_Read(PROFILE_Stats& stats)
+{
+    stats = {};
+
+    for (size_t i = 0; i < PROFILE_ZONE_COUNT; ++i)
+    {
+        stats.calls[i] = g_profile.calls[i].load(std::memory_order_relaxed);
+        stats.ticks[i] = g_profile.ticks[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+    {
+        stats.counters[i] = g_profile.counters[i].load(std::memory_order_relaxed);
+    }
+
+    const auto   now          = PROFILE_Clock::now();
+    const double elapsed_secs = std::chrono::duration<double>(now - g_calibration_time).count();
+    if (elapsed_secs > 0)
+    {
+        stats.ticks_per_second = (double)(PROFILE_Now() - g_calibration_ticks) / elapsed_secs;
+    }
+
+    const auto reset_time = PROFILE_Clock::duration(g_profile.reset_time.load(std::memory_order_relaxed));
+    stats.wall_seconds    = std::chrono::duration<double>(now.time_since_epoch() - reset_time).count();
+}
+
+void PROFILE_Reset()
+{
+    for (size_t i = 0; i < PROFILE_ZONE_COUNT; ++i)
+    {
+        g_profile.calls[i].store(0, std::memory_order_relaxed);
+        g_profile.ticks[i].store(0, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+    {
+        g_profile.counters[i].store(0, std::memory_order_relaxed);
+    }
+    g_profile.reset_time.store(PROFILE_Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+#else
+
+void PROFILE_Read(PROFILE_Stats& stats)
+{
+    stats = {};
+}
+
+void PROFILE_Reset()
+{
+}
+
+#endif
+
+void PROFILE_WriteJSON(FILE* out, const PROFILE_Stats& stats)
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"enabled\": %s,\n", PROFILE_IsEnabled() ? "true" : "false");
+    fprintf(out, "  \"wall_seconds\": %.6g,\n", stats.wall_seconds);
+
+    fprintf(out, "  \"zones\": [\n");
+    for (size_t i = 0; i < PROFILE_ZONE_COUNT; ++i)
+    {
+        const double seconds = stats.ticks_per_second > 0 ? (double)stats.ticks[i] / stats.ticks_per_second : 0.0;
+        const double ns_per_call = stats.calls[i] ? seconds * 1e9 / (double)stats.calls[i] : 0.0;
+
+        fprintf(out,
+                "    {\"name\": \"%s\", \"calls\": %llu, \"seconds\": %.6g, \"ns_per_call\": %.6g}%s\n",
+                PROFILE_ZoneName((PROFILE_Zone)i),
+                (unsigned long long)stats.calls[i],
+                seconds,
+                ns_per_call,
+                i + 1 < PROFILE_ZONE_COUNT ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+
+    fprintf(out, "  \"counters\": {\n");
+    for (size_t i = 0; i < PROFILE_COUNTER_COUNT; ++i)
+    {
+        fprintf(out,
+                "    \"%s\": %llu%s\n",
+                PROFILE_CounterName((PROFILE_Counter)i),
+                (unsigned long long)stats.counters[i],
+                i + 1 < PROFILE_COUNTER_COUNT ? "," : "");
+    }
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+}
+
+bool PROFILE_WriteJSON(const std::filesystem::path& path, const PROFILE_Stats& stats)
+{
+    FILE* out = fopen(path.string().c_str(), "w");
+    if (!out)
+    {
+        return false;
+    }
+    PROFILE_WriteJSON(out, stats);
+    return fclose(out) == 0;
+}
+
+void PROFILE_WriteToEnvPath()
+{
+    const char* path = std::getenv("NUKED_SC55_PROFILE_OUTPUT");
+    if (!PROFILE_IsEnabled() || !path || !*path)
+    {
+        return;
+    }
+
+    PROFILE_Stats stats;
+    PROFILE_Read(stats);
+    if (!PROFILE_WriteJSON(std::filesystem::path(path), stats))
+    {
+        fprintf(stderr, "Failed to write profile to %s\n", path);
+    }
+}
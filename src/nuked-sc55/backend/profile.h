@@ -0,0 +1,166 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+
+#ifdef NUKED_SC55_PROFILE
+#if defined(_M_X64)
+#include <intrin.h>
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#endif
+
+// Optional per-subsystem profiler, enabled by building with NUKED_SC55_PROFILE.
+//
+// Hot paths are wrapped in PROFILE_SCOPE, which counts calls and the time spent in them, and PROFILE_COUNT, which adds
+// to an event counter. Both expand to nothing unless NUKED_SC55_PROFILE is defined, so a normal build is unaffected.
+//
+// Counts are kept per thread without synchronization and added to a shared block of atomics by PROFILE_Publish, which
+// Emulator::RenderFrames calls at the end of every call. The shared block can be read at any time from any thread with
+// PROFILE_Read, or written as JSON.
+//
+// Time is measured with the CPU's timestamp counter where there is one (x86-64, AArch64) and with a steady clock
+// otherwise. Every scope still costs a few nanoseconds, which is noticeable around MCU_ReadInstruction, so compare
+// profiled runs with each other rather than with normal builds.
+
+enum class PROFILE_Zone
+{
+    // MCU_ReadInstruction, and instructions executed by the block engine
+    MCU_INSTRUCTION,
+    PCM_UPDATE,
+    SM_UPDATE,
+    TIMER_CLOCK,
+    // Resampling in the plugin
+    RESAMPLE,
+    COUNT,
+};
+
+enum class PROFILE_Counter
+{
+    // Frames produced by Emulator::RenderFrames
+    RENDERED_FRAMES,
+    // MIDI bytes moved from the input queue to the UART
+    MIDI_BYTES,
+    COUNT,
+};
+
+constexpr size_t PROFILE_ZONE_COUNT    = (size_t)PROFILE_Zone::COUNT;
+constexpr size_t PROFILE_COUNTER_COUNT = (size_t)PROFILE_Counter::COUNT;
+
+struct PROFILE_Stats
+{
+    uint64_t calls[PROFILE_ZONE_COUNT]{};
+    uint64_t ticks[PROFILE_ZONE_COUNT]{};
+    uint64_t counters[PROFILE_COUNTER_COUNT]{};
+
+    // Rate of the timestamp counter
+    double ticks_per_second = 0.0;
+
+    // Time since the process started or PROFILE_Reset was last called
+    double wall_seconds = 0.0;
+};
+
+const char* PROFILE_ZoneName(PROFILE_Zone zone);
+const char* PROFILE_CounterName(PROFILE_Counter counter);
+
+#ifdef NUKED_SC55_PROFILE
+
+// Counts of the current thread that haven't been published yet
+struct PROFILE_Local
+{
+    uint64_t calls[PROFILE_ZONE_COUNT]{};
+    uint64_t ticks[PROFILE_ZONE_COUNT]{};
+    uint64_t counters[PROFILE_COUNTER_COUNT]{};
+};
+
+inline PROFILE_Local& PROFILE_GetLocal()
+{
+    static thread_local PROFILE_Local local;
+    return local;
+}
+
+inline uint64_t PROFILE_Now()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return __rdtsc();
+#elif defined(__aarch64__) && !defined(_MSC_VER)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+class PROFILE_Scope
+{
+public:
+    explicit PROFILE_Scope(PROFILE_Zone zone)
+        : m_zone((size_t)zone), m_start(PROFILE_Now())
+    {
+    }
+
+    ~PROFILE_Scope()
+    {
+        PROFILE_Local& local = PROFILE_GetLocal();
+        local.calls[m_zone]++;
+        local.ticks[m_zone] += PROFILE_Now() - m_start;
+    }
+
+    PROFILE_Scope(const PROFILE_Scope&)            = delete;
+    PROFILE_Scope& operator=(const PROFILE_Scope&) = delete;
+
+private:
+    size_t   m_zone;
+    uint64_t m_start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_SCOPE(zone) PROFILE_Scope PROFILE_CONCAT(profile_scope_, __LINE__)(PROFILE_Zone::zone)
+#define PROFILE_COUNT(counter, n) (PROFILE_GetLocal().counters[(size_t)PROFILE_Counter::counter] += (n))
+
+// Adds the counts of the current thread to the shared stats and clears them.
+void PROFILE_Publish();
+
+#else
+
+#define PROFILE_SCOPE(zone)
+#define PROFILE_COUNT(counter, n)
+
+inline void PROFILE_Publish()
+{
+}
+
+#endif
+
+// Reads the shared stats. Without NUKED_SC55_PROFILE, everything is zero.
+void PROFILE_Read(PROFILE_Stats& stats);
+
+// Clears the shared stats. Counts that other threads haven't published yet are kept.
+void PROFILE_Reset();
+
+// Returns true if the build collects anything.
+constexpr bool PROFILE_IsEnabled()
+{
+#ifdef NUKED_SC55_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Writes `stats` as a JSON object.
+void PROFILE_WriteJSON(FILE* out, const PROFILE_Stats& stats);
+bool PROFILE_WriteJSON(const std::filesystem::path& path, const PROFILE_Stats& stats);
+
+// Writes the shared stats as JSON to the file named by the NUKED_SC55_PROFILE_OUTPUT environment variable. Does
+// nothing if the variable isn't set or the build doesn't collect anything.
+void PROFILE_WriteToEnvPath();
@@ -34,8 +34,11 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <span>
 
@@ -215,9 +218,38 @@ public:
         m_read_head = Mask2(m_read_head + count * sizeof(ElemT));
     }
 
+    // Copies all of `values` into the buffer, wrapping around its end if necessary. There must be enough space for
+    // them.
+    template <typename ElemT>
+    void UncheckedWrite(std::span<const ElemT> values)
+    {
+        assert(GetWritableElements<ElemT>() >= values.size());
+        const size_t byte_count = values.size_bytes();
+        const size_t offset     = Mask(m_write_head);
+        const size_t first      = std::min(byte_count, m_buffer.size() - offset);
+        memcpy(m_buffer.data() + offset, values.data(), first);
+        memcpy(m_buffer.data(), (const uint8_t*)values.data() + first, byte_count - first);
+        m_write_head = Mask2(m_write_head + byte_count);
+    }
+
+    // Fills all of `dest` from the buffer, wrapping around its end if necessary. There must be enough elements to
+    // read.
+    template <typename ElemT>
+    void UncheckedRead(std::span<ElemT> dest)
+    {
+        assert(GetReadableElements<ElemT>() >= dest.size());
+        const size_t byte_count = dest.size_bytes();
+        const size_t offset     = Mask(m_read_head);
+        const size_t first      = std::min(byte_count, m_buffer.size() - offset);
+        memcpy(dest.data(), m_buffer.data() + offset, first);
+        memcpy((uint8_t*)dest.data() + first, m_buffer.data(), byte_count - first);
+        m_read_head = Mask2(m_read_head + byte_count);
+    }
+
+    // The heads run over twice the buffer size so that a full buffer can be told apart from an empty one
     size_t GetReadableBytes() const
     {
-        return Mask(m_write_head - m_read_head);
+        return Mask2(m_write_head - m_read_head);
     }
 
     size_t GetWritableBytes() const
@@ -0,0 +1,168 @@
+#include "rom_cache.h"
+#include "mcu.h"
+#include <algorithm>
+#include <bit>
+#include <compare>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <span>
+
+size_t GetRomCapacity(RomLocation location)
+{
+    switch (location)
+    {
+    case RomLocation::ROM1:
+        return ROM1_SIZE;
+    case RomLocation::ROM2:
+        return ROM2_SIZE;
+    case RomLocation::SMROM:
+        return ROMSM_SIZE;
+    case RomLocation::WAVEROM1:
+        return 0x200000;
+    case RomLocation::WAVEROM2:
+        return 0x200000;
+    case RomLocation::WAVEROM3:
+        return 0x100000;
+    case RomLocation::WAVEROM_CARD:
+        return 0x200000;
+    case RomLocation::WAVEROM_EXP:
+        return 0x800000;
+    }
+    std::abort();
+}
+
+// Backs every location that doesn't have a rom. Large enough for any location. Deliberately not const so that it is
+// placed in .bss rather than taking up 8 MB of the binary; it is never written to.
+static uint8_t zero_rom[0x800000];
+
+std::shared_ptr<const RomImages> GetEmptyRomImages()
+{
+    static const std::shared_ptr<const RomImages> empty = [] {
+        auto images = std::make_shared<RomImages>();
+        for (auto& data : images->data)
+        {
+            data = zero_rom;
+        }
+        return images;
+    }();
+    return empty;
+}
+
+std::unique_ptr<RomImages> MakeRomImages(Romset romset, const RomsetInfo& info)
+{
+    auto images = std::make_unique<RomImages>();
+    images->romset = romset;
+
+    size_t offsets[ROMLOCATION_COUNT]{};
+    size_t total_size = 0;
+
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        const RomLocation location = (RomLocation)i;
+        const size_t      size     = info.rom_data[i].size();
+
+        if (size == 0)
+        {
+            continue;
+        }
+
+        if (size > GetRomCapacity(location))
+        {
+            return nullptr;
+        }
+
+        if (location == RomLocation::ROM2 && !std::has_single_bit(size))
+        {
+            return nullptr;
+        }
+
+        images->size[i] = size;
+        offsets[i]      = total_size;
+        total_size += GetRomCapacity(location);
+    }
+
+    std::shared_ptr<uint8_t[]> storage = std::make_shared<uint8_t[]>(total_size);
+    images->storage                    = storage;
+
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        if (images->size[i] == 0)
+        {
+            images->data[i] = zero_rom;
+            continue;
+        }
+
+        uint8_t* dest = storage.get() + offsets[i];
+        std::copy(info.rom_data[i].begin(), info.rom_data[i].end(), dest);
+        images->data[i] = dest;
+    }
+
+    return images;
+}
+
+// 64-bit FNV-1a over 8-byte words. This is only used to tell rom dumps apart, so it doesn't need to be strong, just
+// fast enough to run over a full set of waveroms every time a plugin instance is created.
+static uint64_t HashRom(std::span<const uint8_t> rom)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    size_t i = 0;
+    for (; i + 8 <= rom.size(); i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, rom.data() + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3;
+    }
+    for (; i < rom.size(); ++i)
+    {
+        hash = (hash ^ rom[i]) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+struct RomCacheKey
+{
+    Romset   romset;
+    size_t   size[ROMLOCATION_COUNT];
+    uint64_t hash[ROMLOCATION_COUNT];
+
+    auto operator<=>(const RomCacheKey&) const = default;
+};
+
+static std::mutex                                            rom_cache_mutex;
+static std::map<RomCacheKey, std::weak_ptr<const RomImages>> rom_cache;
+
+std::shared_ptr<const RomImages> AcquireRomImages(Romset romset, const RomsetInfo& info)
+{
+    RomCacheKey key{};
+    key.romset = romset;
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        key.size[i] = info.rom_data[i].size();
+        key.hash[i] = HashRom(info.rom_data[i]);
+    }
+
+    std::lock_guard lock(rom_cache_mutex);
+
+    if (auto it = rom_cache.find(key); it != rom_cache.end())
+    {
+        if (auto images = it->second.lock())
+        {
+            return images;
+        }
+    }
+
+    std::shared_ptr<const RomImages> images = MakeRomImages(romset, info);
+    if (!images)
+    {
+        return nullptr;
+    }
+
+    std::erase_if(rom_cache, [](const auto& entry) { return entry.second.expired(); });
+    rom_cache[key] = images;
+
+    return images;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "rom.h"
+#include "rom_io.h"
+#include <cstdint>
+#include <memory>
+
+// Unscrambled roms for a single romset, laid out the way the emulator reads them. Emulators never write to roms, so a
+// single RomImages can be shared by any number of emulators.
+struct RomImages
+{
+    Romset romset = Romset::MK2;
+
+    // Array indexed by RomLocation. Each pointer covers `GetRomCapacity(location)` bytes; locations without a rom point
+    // at zeros.
+    const uint8_t* data[ROMLOCATION_COUNT]{};
+
+    // Array indexed by RomLocation. Size of the rom loaded into each location, or 0 if there is none.
+    size_t size[ROMLOCATION_COUNT]{};
+
+    // Keeps the memory behind `data` alive. This is a heap buffer for images built by `MakeRomImages`, but frontends
+    // may also point `data` into memory they manage themselves, e.g. a memory-mapped file.
+    std::shared_ptr<const void> storage;
+};
+
+// Returns the size of the address range the emulator decodes for `location`. Roms larger than this cannot be loaded.
+size_t GetRomCapacity(RomLocation location);
+
+// Returns images that contain no roms at all.
+std::shared_ptr<const RomImages> GetEmptyRomImages();
+
+// Builds images from the `rom_data` in `info`. Returns null if a rom is larger than its location's capacity, or if
+// ROM2 does not have a power-of-2 size.
+std::unique_ptr<RomImages> MakeRomImages(Romset romset, const RomsetInfo& info);
+
+// Like `MakeRomImages`, but images are shared process-wide: callers passing identical roms for the same romset receive
+// the same images. Images are released when the last reference to them goes away.
+std::shared_ptr<const RomImages> AcquireRomImages(Romset romset, const RomsetInfo& info);
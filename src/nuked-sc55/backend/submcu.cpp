@@ -34,6 +34,7 @@
 
 #include "submcu.h"
 #include "mcu.h"
+#include "profile.h"
 
 enum {
     SM_VECTOR_UART3_TX = 0,
@@ -1429,6 +1430,10 @@ void SM_UpdateUART(submcu_t& sm)
     if (sm.cycles < mcu.uart_rx_delay)
         return;
 
+    // uart_time is in main MCU cycles, see SM_Update
+    if (sm.cycles < mcu.uart_time[mcu.uart_read_ptr] * 5)
+        return;
+
     mcu.uart_rx_byte = mcu.uart_buffer[mcu.uart_read_ptr];
     mcu.uart_read_ptr = (mcu.uart_read_ptr + 1) % uart_buffer_size;
     sm.uart_rx_gotbyte = 1;
@@ -1439,6 +1444,8 @@ void SM_UpdateUART(submcu_t& sm)
 
 void SM_Update(submcu_t& sm, uint64_t cycles)
 {
+    PROFILE_SCOPE(SM_UPDATE);
+
     while (sm.cycles < cycles * 5)
     {
         SM_HandleInterrupt(sm);
@@ -34,6 +34,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 struct mcu_t;
@@ -58,8 +59,6 @@ struct submcu_t {
     uint8_t sr = 0;
     uint64_t cycles = 0;
     uint8_t sleep = 0;
-    mcu_t* mcu = nullptr;
-    uint8_t rom[4096]{};
 
     uint8_t ram[128]{};
     uint8_t shared_ram[192]{};
@@ -76,8 +75,18 @@ struct submcu_t {
     uint8_t timer_counter = 0;
 
     uint8_t uart_rx_gotbyte = 0;
+
+    // Everything above this point is machine state and is captured by EMU_Snapshot.
+
+    mcu_t* mcu = nullptr;
+
+    // Shared between emulators, see RomImages.
+    const uint8_t* rom = nullptr;
 };
 
+// Size of the machine state at the start of submcu_t.
+static const size_t SM_STATE_SIZE = offsetof(submcu_t, mcu);
+
 void SM_Init(submcu_t& sm, mcu_t& mcu);
 void SM_Reset(submcu_t& sm);
 void SM_Update(submcu_t& sm, uint64_t cycles);
@@ -0,0 +1,594 @@
+#include "rom_image_cache.h"
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern "C"
+{
+#include "../backend/sha/sha.h"
+}
+
+namespace common
+{
+
+// Bump whenever the layout of the image or index files changes.
+constexpr uint32_t ROM_CACHE_VERSION = 1;
+
+constexpr char IMAGE_MAGIC[8] = {'N', 'S', 'C', '5', '5', 'I', 'M', 'G'};
+constexpr char INDEX_MAGIC[]  = "nuked-sc55-rom-index";
+
+// Roms inside an image start on page boundaries so that every rom is mapped page-aligned.
+constexpr uint64_t IMAGE_ALIGNMENT = 4096;
+
+struct ImageFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t romset;
+
+    // Arrays indexed by RomLocation. Offsets are relative to the start of the file. Each rom is followed by zeros up
+    // to `GetRomCapacity(location)`.
+    uint64_t offset[ROMLOCATION_COUNT];
+    uint64_t size[ROMLOCATION_COUNT];
+};
+
+struct IndexEntry
+{
+    size_t                location;
+    uint64_t              size;
+    int64_t               mtime;
+    std::filesystem::path path;
+};
+
+//----------------------------------------------------------------------------
+// Read-only file mappings
+
+struct MappedFile
+{
+    const uint8_t* data = nullptr;
+    size_t         size = 0;
+
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+MappedFile::~MappedFile()
+{
+    if (!data)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+static std::shared_ptr<const MappedFile> MapFile(const std::filesystem::path& path)
+{
+    auto mapped = std::make_shared<MappedFile>();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_DELETE,
+                              nullptr,
+                              OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return nullptr;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+    {
+        return nullptr;
+    }
+
+    // The view keeps the mapping alive after its handle is closed.
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view)
+    {
+        return nullptr;
+    }
+
+    mapped->data = (const uint8_t*)view;
+    mapped->size = (size_t)size.QuadPart;
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    mapped->data = (const uint8_t*)view;
+    mapped->size = (size_t)st.st_size;
+#endif
+
+    return mapped;
+}
+
+//----------------------------------------------------------------------------
+// Helpers
+
+static uint64_t AlignUp(uint64_t value)
+{
+    return (value + IMAGE_ALIGNMENT - 1) & ~(IMAGE_ALIGNMENT - 1);
+}
+
+static std::string ToHex(const uint8_t* bytes, size_t count)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    std::string result;
+    for (size_t i = 0; i < count; ++i)
+    {
+        result += digits[bytes[i] >> 4];
+        result += digits[bytes[i] & 0xf];
+    }
+    return result;
+}
+
+static bool GetFileStamp(const std::filesystem::path& path, uint64_t& size, int64_t& mtime)
+{
+    std::error_code ec;
+
+    size = std::filesystem::file_size(path, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    const auto time = std::filesystem::last_write_time(path, ec);
+    if (ec)
+    {
+        return false;
+    }
+    mtime = (int64_t)time.time_since_epoch().count();
+
+    return true;
+}
+
+// Writes `contents` to a temporary file next to `path` and moves it into place, so that other processes never observe
+// a partially written file.
+static bool WriteFileAtomically(const std::filesystem::path& path, const std::vector<uint8_t>& contents)
+{
+    std::random_device rd;
+
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp-" + std::to_string(rd()) + std::to_string(rd());
+
+    {
+        std::ofstream out(temp_path, std::ios::binary);
+        out.write((const char*)contents.data(), (std::streamsize)contents.size());
+        if (!out.good())
+        {
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(temp_path, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec)
+    {
+        // On Windows this fails if another process has `path` mapped. Whatever is there was written the same way, so
+        // it is just as good as ours.
+        std::filesystem::remove(temp_path, ec);
+        return std::filesystem::exists(path, ec);
+    }
+
+    return true;
+}
+
+// Name of the index file for roms of `romset` found in `rom_directory`.
+static std::string GetIndexFilename(Romset romset, const std::filesystem::path& rom_directory)
+{
+    const std::u8string dir = std::filesystem::absolute(rom_directory).lexically_normal().u8string();
+
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char8_t c : dir)
+    {
+        hash = (hash ^ (uint8_t)c) * 0x100000001b3;
+    }
+
+    uint8_t hash_bytes[sizeof(hash)];
+    memcpy(hash_bytes, &hash, sizeof(hash));
+
+    return std::string(GetParsableRomsetNames()[(size_t)romset]) + "-" + ToHex(hash_bytes, sizeof(hash)) + ".idx";
+}
+
+// Name of the image file for the unscrambled roms in `info`. Identical roms map to the same image regardless of where
+// they were loaded from.
+static std::string GetImageFilename(Romset romset, const RomsetInfo& info)
+{
+    SHA256Context ctx;
+    SHA256Reset(&ctx);
+
+    for (const auto& rom : info.rom_data)
+    {
+        const uint64_t size = rom.size();
+        SHA256Input(&ctx, (const uint8_t*)&size, sizeof(size));
+        SHA256Input(&ctx, rom.data(), (unsigned int)rom.size());
+    }
+
+    uint8_t digest[SHA256HashSize];
+    SHA256Result(&ctx, digest);
+
+    return std::string(GetParsableRomsetNames()[(size_t)romset]) + "-" + ToHex(digest, sizeof(digest)) + ".img";
+}
+
+//----------------------------------------------------------------------------
+// Image files
+
+static std::shared_ptr<const RomImages> OpenImage(const std::filesystem::path& image_path)
+{
+    auto file = MapFile(image_path);
+    if (!file || file->size < sizeof(ImageFileHeader))
+    {
+        return nullptr;
+    }
+
+    ImageFileHeader header;
+    memcpy(&header, file->data, sizeof(header));
+
+    if (memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 || header.version != ROM_CACHE_VERSION ||
+        header.romset >= ROMSET_COUNT)
+    {
+        return nullptr;
+    }
+
+    const auto empty  = GetEmptyRomImages();
+    auto       images = std::make_shared<RomImages>();
+    images->romset    = (Romset)header.romset;
+
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        const RomLocation location = (RomLocation)i;
+
+        if (header.size[i] == 0)
+        {
+            images->data[i] = empty->data[i];
+            continue;
+        }
+
+        const uint64_t capacity = GetRomCapacity(location);
+        if (header.size[i] > capacity || header.offset[i] > file->size || file->size - header.offset[i] < capacity)
+        {
+            return nullptr;
+        }
+
+        if (location == RomLocation::ROM2 && !std::has_single_bit(header.size[i]))
+        {
+            return nullptr;
+        }
+
+        images->data[i] = file->data + header.offset[i];
+        images->size[i] = (size_t)header.size[i];
+    }
+
+    images->storage = file;
+
+    return images;
+}
+
+static bool WriteImage(const std::filesystem::path& image_path, const RomImages& images)
+{
+    ImageFileHeader header{};
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = ROM_CACHE_VERSION;
+    header.romset  = (uint32_t)images.romset;
+
+    uint64_t file_size = AlignUp(sizeof(header));
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        if (images.size[i] == 0)
+        {
+            continue;
+        }
+        header.offset[i] = file_size;
+        header.size[i]   = images.size[i];
+        file_size        = AlignUp(file_size + GetRomCapacity((RomLocation)i));
+    }
+
+    std::vector<uint8_t> contents(file_size);
+    memcpy(contents.data(), &header, sizeof(header));
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        if (images.size[i] != 0)
+        {
+            memcpy(contents.data() + header.offset[i], images.data[i], GetRomCapacity((RomLocation)i));
+        }
+    }
+
+    return WriteFileAtomically(image_path, contents);
+}
+
+// Images are deduplicated within the process as well, so that instances of the same model don't map the same file
+// more than once.
+static std::mutex                                                      mapped_images_mutex;
+static std::map<std::filesystem::path, std::weak_ptr<const RomImages>> mapped_images;
+
+static std::shared_ptr<const RomImages> AcquireMappedImages(const std::filesystem::path& image_path)
+{
+    std::lock_guard lock(mapped_images_mutex);
+
+    if (auto it = mapped_images.find(image_path); it != mapped_images.end())
+    {
+        if (auto images = it->second.lock())
+        {
+            return images;
+        }
+    }
+
+    auto images = OpenImage(image_path);
+    if (images)
+    {
+        mapped_images[image_path] = images;
+    }
+    return images;
+}
+
+//----------------------------------------------------------------------------
+// Index files
+//
+// Plain text, one line per rom:
+//
+//   nuked-sc55-rom-index <version>
+//   image <image filename>
+//   rom <location> <size> <mtime> <path>
+
+static bool ReadIndex(const std::filesystem::path& index_path, std::string& image_name, std::vector<IndexEntry>& entries)
+{
+    std::ifstream in(index_path, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+
+    std::string magic;
+    uint32_t    version = 0;
+    if (!(in >> magic >> version) || magic != INDEX_MAGIC || version != ROM_CACHE_VERSION)
+    {
+        return false;
+    }
+
+    std::string keyword;
+    if (!(in >> keyword >> image_name) || keyword != "image")
+    {
+        return false;
+    }
+
+    IndexEntry entry;
+    while (in >> keyword >> entry.location >> entry.size >> entry.mtime)
+    {
+        if (keyword != "rom" || entry.location >= ROMLOCATION_COUNT)
+        {
+            return false;
+        }
+
+        // Paths may contain spaces, so they take up the rest of the line.
+        std::string path;
+        in.get();
+        std::getline(in, path);
+        entry.path = std::filesystem::path(std::u8string(path.begin(), path.end()));
+
+        entries.push_back(entry);
+    }
+
+    return !entries.empty();
+}
+
+static bool WriteIndex(const std::filesystem::path& index_path,
+                       const std::string&           image_name,
+                       const RomsetInfo&            info)
+{
+    std::string contents = std::string(INDEX_MAGIC) + " " + std::to_string(ROM_CACHE_VERSION) + "\n";
+    contents += "image " + image_name + "\n";
+
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        if (info.rom_data[i].empty())
+        {
+            continue;
+        }
+
+        // Roms that weren't loaded from a file can't be validated later.
+        if (info.rom_paths[i].empty())
+        {
+            return false;
+        }
+
+        const std::filesystem::path path = std::filesystem::absolute(info.rom_paths[i]);
+
+        uint64_t size;
+        int64_t  mtime;
+        if (!GetFileStamp(path, size, mtime))
+        {
+            return false;
+        }
+
+        const std::u8string u8_path = path.u8string();
+
+        contents += "rom " + std::to_string(i) + " " + std::to_string(size) + " " + std::to_string(mtime) + " ";
+        contents += std::string(u8_path.begin(), u8_path.end());
+        contents += "\n";
+    }
+
+    return WriteFileAtomically(index_path, std::vector<uint8_t>(contents.begin(), contents.end()));
+}
+
+//----------------------------------------------------------------------------
+
+// Returns the cached images for the index at `index_path` if none of the roms it lists have changed.
+static std::shared_ptr<const RomImages> LoadFromCache(const std::filesystem::path& cache_directory,
+                                                      const std::filesystem::path& index_path,
+                                                      Romset                       romset)
+{
+    std::string             image_name;
+    std::vector<IndexEntry> entries;
+    if (!ReadIndex(index_path, image_name, entries))
+    {
+        return nullptr;
+    }
+
+    for (const auto& entry : entries)
+    {
+        uint64_t size;
+        int64_t  mtime;
+        if (!GetFileStamp(entry.path, size, mtime) || size != entry.size || mtime != entry.mtime)
+        {
+            return nullptr;
+        }
+    }
+
+    auto images = AcquireMappedImages(cache_directory / image_name);
+    if (!images || images->romset != romset)
+    {
+        return nullptr;
+    }
+
+    return images;
+}
+
+// Writes the roms in `info` to the cache and returns a mapping of the written image.
+static std::shared_ptr<const RomImages> UpdateCache(const std::filesystem::path& cache_directory,
+                                                    const std::filesystem::path& index_path,
+                                                    Romset                       romset,
+                                                    const RomsetInfo&            info)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(cache_directory, ec);
+    if (ec)
+    {
+        return nullptr;
+    }
+
+    const std::string           image_name = GetImageFilename(romset, info);
+    const std::filesystem::path image_path = cache_directory / image_name;
+
+    auto images = AcquireMappedImages(image_path);
+    if (!images)
+    {
+        auto built = MakeRomImages(romset, info);
+        if (!built || !WriteImage(image_path, *built))
+        {
+            return nullptr;
+        }
+
+        images = AcquireMappedImages(image_path);
+        if (!images)
+        {
+            return nullptr;
+        }
+    }
+
+    // If this fails we'll just take the slow path again next time.
+    (void)WriteIndex(index_path, image_name, info);
+
+    return images;
+}
+
+LoadRomsetError LoadRomImages(const std::filesystem::path&      rom_directory,
+                              std::string_view                  desired_romset,
+                              const std::filesystem::path&      cache_directory,
+                              std::shared_ptr<const RomImages>& images)
+{
+    Romset romset;
+    if (!ParseRomsetName(desired_romset, romset))
+    {
+        return LoadRomsetError::InvalidRomsetName;
+    }
+
+    const bool                  use_cache  = !cache_directory.empty();
+    const std::filesystem::path index_path = use_cache ? cache_directory / GetIndexFilename(romset, rom_directory)
+                                                       : std::filesystem::path{};
+
+    if (use_cache)
+    {
+        if (auto cached = LoadFromCache(cache_directory, index_path, romset))
+        {
+            images = std::move(cached);
+            return LoadRomsetError{};
+        }
+    }
+
+    AllRomsetInfo    all_info{};
+    LoadRomsetResult result{};
+
+    const LoadRomsetError err = LoadRomset(all_info, rom_directory, desired_romset, false, RomOverrides{}, result);
+    if (err != LoadRomsetError{})
+    {
+        return err;
+    }
+
+    const RomsetInfo& info = all_info.romsets[(size_t)result.romset];
+
+    if (use_cache)
+    {
+        if (auto cached = UpdateCache(cache_directory, index_path, result.romset, info))
+        {
+            images = std::move(cached);
+            return LoadRomsetError{};
+        }
+    }
+
+    images = AcquireRomImages(result.romset, info);
+    if (!images)
+    {
+        return LoadRomsetError::RomLoadFailed;
+    }
+
+    return LoadRomsetError{};
+}
+
+} // namespace common
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../backend/rom_cache.h"
+#include "rom_loader.h"
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+namespace common
+{
+
+// Loads `desired_romset` from `rom_directory` into shared rom images, going through an on-disk cache of unscrambled
+// images in `cache_directory`.
+//
+// The cache holds one image file per distinct set of roms, named after a hash of their contents and laid out so that
+// it can be memory-mapped and used by the emulator as-is. An index file per romset and rom directory records the size
+// and modification time of every source rom. As long as those still match, the image is mapped directly without
+// reading, hashing or unscrambling any roms, and its pages are shared by every process on the machine.
+//
+// On a cache miss the roms are loaded with `LoadRomset` and the cache is updated. If `cache_directory` is empty or the
+// cache can't be written, this falls back to in-memory images from `AcquireRomImages`.
+//
+// `desired_romset` must be one of the strings returned by `GetParsableRomsetNames`.
+LoadRomsetError LoadRomImages(const std::filesystem::path&      rom_directory,
+                              std::string_view                  desired_romset,
+                              const std::filesystem::path&      cache_directory,
+                              std::shared_ptr<const RomImages>& images);
+
+} // namespace common
@@ -0,0 +1,67 @@
+#include "rom_path.h"
+#include "rom_image_cache.h"
+#include <cstdlib>
+#include <ranges>
+#include <string>
+
+namespace common
+{
+
+#ifdef _WIN32
+constexpr std::string_view PATH_SEPARATOR = ";";
+#else
+constexpr std::string_view PATH_SEPARATOR = ":";
+#endif
+
+std::vector<std::filesystem::path> GetRomPathDirectories()
+{
+    std::vector<std::filesystem::path> dirs;
+
+    const char* env = std::getenv("SOUNDCANVAS_ROM_PATH");
+    if (!env || !*env)
+    {
+        return dirs;
+    }
+
+    const std::string_view env_dirs = env;
+    for (const auto env_dir : std::views::split(env_dirs, PATH_SEPARATOR))
+    {
+        if (!env_dir.empty())
+        {
+            dirs.emplace_back(std::string(env_dir.begin(), env_dir.end()));
+        }
+    }
+    return dirs;
+}
+
+LoadRomsetError FindRomImages(std::string_view                  desired_romset,
+                              const std::filesystem::path&      cache_directory,
+                              std::shared_ptr<const RomImages>& images,
+                              std::filesystem::path&            rom_directory)
+{
+    for (const auto& base : GetRomPathDirectories())
+    {
+        std::vector<std::filesystem::path> dirs = {base};
+
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(base, ec))
+        {
+            if (entry.is_directory(ec))
+            {
+                dirs.push_back(entry.path());
+            }
+        }
+
+        for (const auto& dir : dirs)
+        {
+            if (LoadRomImages(dir, desired_romset, cache_directory, images) == LoadRomsetError{})
+            {
+                rom_directory = dir;
+                return {};
+            }
+        }
+    }
+    return LoadRomsetError::DetectionFailed;
+}
+
+} // namespace common
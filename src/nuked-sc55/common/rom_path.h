@@ -0,0 +1,27 @@
+#pragma once
+
+#include "../backend/rom_cache.h"
+#include "rom_loader.h"
+#include <filesystem>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace common
+{
+
+// Returns the directories listed in the SOUNDCANVAS_ROM_PATH environment variable, which are separated like the
+// entries of PATH. Returns an empty list if the variable isn't set.
+std::vector<std::filesystem::path> GetRomPathDirectories();
+
+// Loads `desired_romset` with `LoadRomImages` from the first directory of SOUNDCANVAS_ROM_PATH, or immediate
+// subdirectory of one, that contains it. Subdirectories are searched so that the plugin's layout of one directory per
+// model works as is. `rom_directory` receives the directory the roms were loaded from.
+//
+// Returns `DetectionFailed` if no directory contains the romset.
+LoadRomsetError FindRomImages(std::string_view                  desired_romset,
+                              const std::filesystem::path&      cache_directory,
+                              std::shared_ptr<const RomImages>& images,
+                              std::filesystem::path&            rom_directory);
+
+} // namespace common
@@ -0,0 +1,371 @@
+#include "smf.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+
+namespace common
+{
+
+const char* ToCString(SmfError error)
+{
+    switch (error)
+    {
+    case SmfError::FileOpenFailed:
+        return "Failed to open file";
+    case SmfError::InvalidHeader:
+        return "Not a Standard MIDI File";
+    case SmfError::UnsupportedFormat:
+        return "Unsupported MIDI file format";
+    }
+
+    if (error == SmfError{})
+    {
+        return "No error";
+    }
+    else
+    {
+        return "Unknown error";
+    }
+}
+
+// Microseconds per quarter note until the first tempo change
+constexpr uint32_t SMF_DEFAULT_TEMPO = 500000;
+
+// An event of a single track, before the tracks are merged
+struct SmfTrackEvent
+{
+    uint64_t tick;
+
+    // 0 for MIDI messages
+    uint32_t tempo;
+
+    uint32_t offset;
+    uint32_t size;
+};
+
+// Bounds-checked reader over a chunk of the file
+struct SmfReader
+{
+    std::span<const uint8_t> data;
+    size_t                   pos = 0;
+
+    bool AtEnd() const
+    {
+        return pos >= data.size();
+    }
+
+    std::optional<uint8_t> ReadU8()
+    {
+        if (AtEnd())
+        {
+            return {};
+        }
+        return data[pos++];
+    }
+
+    std::optional<uint32_t> ReadBE(size_t count)
+    {
+        if (data.size() - pos < count)
+        {
+            return {};
+        }
+        uint32_t value = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            value = (value << 8) | data[pos++];
+        }
+        return value;
+    }
+
+    // Variable-length quantity; at most 4 bytes
+    std::optional<uint32_t> ReadVLQ()
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            const auto byte = ReadU8();
+            if (!byte)
+            {
+                return {};
+            }
+            value = (value << 7) | (*byte & 0x7f);
+            if ((*byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+        return value;
+    }
+
+    // Returns the next `count` bytes, or fewer at the end of the data
+    std::span<const uint8_t> ReadBytes(size_t count)
+    {
+        count          = std::min(count, data.size() - pos);
+        const auto out = data.subspan(pos, count);
+        pos += count;
+        return out;
+    }
+
+    bool MatchTag(const char* tag)
+    {
+        if (data.size() - pos < 4 || memcmp(data.data() + pos, tag, 4) != 0)
+        {
+            return false;
+        }
+        pos += 4;
+        return true;
+    }
+};
+
+// Returns the SMF inside an RMID file, or `file` itself if it isn't one
+static std::span<const uint8_t> SMF_UnwrapRMID(std::span<const uint8_t> file)
+{
+    SmfReader reader{file};
+    if (!reader.MatchTag("RIFF"))
+    {
+        return file;
+    }
+
+    // RIFF sizes are little endian
+    reader.ReadBytes(4);
+    if (!reader.MatchTag("RMID"))
+    {
+        return file;
+    }
+
+    while (!reader.AtEnd())
+    {
+        const bool is_data = reader.MatchTag("data");
+        if (!is_data)
+        {
+            reader.ReadBytes(4);
+        }
+
+        const auto size_bytes = reader.ReadBytes(4);
+        if (size_bytes.size() < 4)
+        {
+            break;
+        }
+        const uint32_t size = size_bytes[0] | (size_bytes[1] << 8) | (size_bytes[2] << 16) | (size_bytes[3] << 24);
+
+        const auto chunk = reader.ReadBytes(size);
+        if (is_data)
+        {
+            return chunk;
+        }
+
+        // Chunks are padded to an even size
+        reader.ReadBytes(size & 1);
+    }
+    return {};
+}
+
+static void SMF_ReadTrack(SmfReader& track, SmfData& data, std::vector<SmfTrackEvent>& out)
+{
+    uint64_t tick           = 0;
+    uint8_t  running_status = 0;
+
+    while (!track.AtEnd())
+    {
+        const auto delta = track.ReadVLQ();
+        auto       first = track.ReadU8();
+        if (!delta || !first)
+        {
+            return;
+        }
+        tick += *delta;
+
+        uint8_t status = *first;
+        if (status < 0x80)
+        {
+            if (running_status == 0)
+            {
+                // Stray data byte; skip it
+                continue;
+            }
+            status = running_status;
+            track.pos--;
+        }
+
+        const auto offset = (uint32_t)data.bytes.size();
+
+        if (status == 0xf0 || status == 0xf7)
+        {
+            // SysEx, or an escape that sends its bytes as they are
+            running_status = 0;
+
+            const auto length = track.ReadVLQ();
+            if (!length)
+            {
+                return;
+            }
+            if (status == 0xf0)
+            {
+                data.bytes.push_back(0xf0);
+            }
+            const auto body = track.ReadBytes(*length);
+            data.bytes.insert(data.bytes.end(), body.begin(), body.end());
+        }
+        else if (status == 0xff)
+        {
+            running_status = 0;
+
+            const auto type   = track.ReadU8();
+            const auto length = track.ReadVLQ();
+            if (!type || !length)
+            {
+                return;
+            }
+            const auto body = track.ReadBytes(*length);
+
+            if (*type == 0x2f)
+            {
+                // End of track
+                return;
+            }
+            if (*type == 0x51 && body.size() == 3)
+            {
+                const uint32_t tempo = (body[0] << 16) | (body[1] << 8) | body[2];
+                if (tempo > 0)
+                {
+                    out.push_back({tick, tempo, 0, 0});
+                }
+            }
+            continue;
+        }
+        else if (status >= 0xf8)
+        {
+            // Realtime messages have no place in a file; skip them
+            continue;
+        }
+        else
+        {
+            running_status = status;
+
+            const size_t length = (status & 0xe0) == 0xc0 ? 1 : 2;
+            const auto   body   = track.ReadBytes(length);
+            if (body.size() < length)
+            {
+                return;
+            }
+            data.bytes.push_back(status);
+            data.bytes.insert(data.bytes.end(), body.begin(), body.end());
+        }
+
+        const auto size = (uint32_t)data.bytes.size() - offset;
+        if (size > 0)
+        {
+            out.push_back({tick, 0, offset, size});
+        }
+    }
+}
+
+SmfError LoadSmf(const std::filesystem::path& path, SmfData& data)
+{
+    data = {};
+
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+        return SmfError::FileOpenFailed;
+    }
+    const std::vector<uint8_t> file{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+
+    SmfReader reader{SMF_UnwrapRMID(file)};
+
+    if (!reader.MatchTag("MThd"))
+    {
+        return SmfError::InvalidHeader;
+    }
+    const auto header_size = reader.ReadBE(4);
+    const auto format      = reader.ReadBE(2);
+    const auto num_tracks  = reader.ReadBE(2);
+    const auto division    = reader.ReadBE(2);
+    if (!header_size || *header_size < 6 || !format || !num_tracks || !division || *division == 0)
+    {
+        return SmfError::InvalidHeader;
+    }
+    if (*format > 1)
+    {
+        return SmfError::UnsupportedFormat;
+    }
+    reader.ReadBytes(*header_size - 6);
+
+    std::vector<SmfTrackEvent> events;
+
+    for (uint32_t i = 0; i < *num_tracks && !reader.AtEnd(); i++)
+    {
+        const bool is_track = reader.MatchTag("MTrk");
+        if (!is_track)
+        {
+            reader.ReadBytes(4);
+        }
+        const auto size = reader.ReadBE(4);
+        if (!size)
+        {
+            break;
+        }
+        SmfReader chunk{reader.ReadBytes(*size)};
+
+        if (is_track)
+        {
+            SMF_ReadTrack(chunk, data, events);
+        }
+        else
+        {
+            // Unknown chunks don't count as tracks
+            i--;
+        }
+    }
+
+    // The tracks were read one after the other, so a stable sort keeps the track order within a tick
+    std::stable_sort(events.begin(), events.end(), [](const SmfTrackEvent& a, const SmfTrackEvent& b) {
+        return a.tick < b.tick;
+    });
+
+    // With SMPTE timing the division is a negative frame rate and ticks per frame, and tempo changes don't apply
+    const bool smpte = (*division & 0x8000) != 0;
+
+    double seconds_per_tick = 0.0;
+    if (smpte)
+    {
+        const int    fps             = -(int8_t)(*division >> 8);
+        const double frame_rate      = fps == 29 ? 30000.0 / 1001.0 : fps;
+        const int    ticks_per_frame = *division & 0xff;
+        if (frame_rate <= 0 || ticks_per_frame == 0)
+        {
+            return SmfError::InvalidHeader;
+        }
+        seconds_per_tick = 1.0 / (frame_rate * ticks_per_frame);
+    }
+    else
+    {
+        seconds_per_tick = SMF_DEFAULT_TEMPO / 1e6 / *division;
+    }
+
+    uint64_t last_tick = 0;
+    double   time      = 0.0;
+
+    data.events.reserve(events.size());
+    for (const SmfTrackEvent& event : events)
+    {
+        time += (double)(event.tick - last_tick) * seconds_per_tick;
+        last_tick = event.tick;
+
+        if (event.tempo)
+        {
+            if (!smpte)
+            {
+                seconds_per_tick = event.tempo / 1e6 / *division;
+            }
+            continue;
+        }
+        data.events.push_back({time, event.offset, event.size});
+    }
+
+    return SmfError{};
+}
+
+} // namespace common
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace common
+{
+
+// A MIDI message from a Standard MIDI File.
+struct SmfEvent
+{
+    // Seconds from the start of the song, with all tempo changes applied.
+    double time = 0.0;
+
+    // Range of the message in `SmfData::bytes`. SysEx messages start with F0 like on the wire.
+    uint32_t offset = 0;
+    uint32_t size   = 0;
+};
+
+struct SmfData
+{
+    // All MIDI messages of all tracks, merged and sorted by time. Events at the same time keep the order of their
+    // tracks in the file.
+    std::vector<SmfEvent> events;
+
+    std::vector<uint8_t> bytes;
+
+    std::span<const uint8_t> GetMessage(const SmfEvent& event) const
+    {
+        return {bytes.data() + event.offset, event.size};
+    }
+};
+
+enum class SmfError
+{
+    FileOpenFailed = 1,
+
+    // not a Standard MIDI File, or an RMID file without one inside
+    InvalidHeader,
+
+    // format 2 files (independent sequences) can't be played as one song
+    UnsupportedFormat,
+};
+
+// `error`: error code to convert to string
+const char* ToCString(SmfError error);
+
+// Loads a format 0 or 1 Standard MIDI File, optionally wrapped in an RMID container, from `path` into `data`.
+//
+// Meta events are not part of the output; tempo changes are applied to the event times. Damaged files are loaded on a
+// best-effort basis: a truncated track ends at the end of the file, and stray data bytes without a status are skipped.
+SmfError LoadSmf(const std::filesystem::path& path, SmfData& data);
+
+} // namespace common
@@ -0,0 +1,129 @@
+#include "wav_writer.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace common
+{
+
+// Sizes in the header are 32-bit, so the data chunk must stay below 4 GiB
+constexpr uint64_t WAV_MAX_DATA_SIZE = 0xffffffffu - 64;
+
+constexpr uint16_t WAV_FORMAT_PCM        = 1;
+constexpr uint16_t WAV_FORMAT_IEEE_FLOAT = 3;
+
+static void WAV_PutU16(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back((uint8_t)value);
+    out.push_back((uint8_t)(value >> 8));
+}
+
+static void WAV_PutU32(std::vector<uint8_t>& out, uint32_t value)
+{
+    WAV_PutU16(out, (uint16_t)value);
+    WAV_PutU16(out, (uint16_t)(value >> 16));
+}
+
+static void WAV_PutTag(std::vector<uint8_t>& out, const char* tag)
+{
+    out.insert(out.end(), tag, tag + 4);
+}
+
+static uint32_t WAV_BytesPerSample(WavFormat format)
+{
+    return format == WavFormat::S16 ? 2 : 4;
+}
+
+WavWriter::~WavWriter()
+{
+    if (m_output.is_open())
+    {
+        Close();
+    }
+}
+
+bool WavWriter::Open(const std::filesystem::path& path, uint32_t sample_rate, WavFormat format)
+{
+    m_output.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_output)
+    {
+        return false;
+    }
+
+    m_sample_rate    = sample_rate;
+    m_format         = format;
+    m_frames_written = 0;
+
+    // Written again with the final sizes by Close()
+    WriteHeader();
+    return (bool)m_output;
+}
+
+void WavWriter::WriteHeader()
+{
+    const uint32_t bytes_per_frame = 2 * WAV_BytesPerSample(m_format);
+    const uint32_t data_size       = (uint32_t)std::min(m_frames_written * bytes_per_frame, WAV_MAX_DATA_SIZE);
+
+    std::vector<uint8_t> header;
+
+    WAV_PutTag(header, "RIFF");
+    WAV_PutU32(header, 36 + data_size);
+    WAV_PutTag(header, "WAVE");
+
+    WAV_PutTag(header, "fmt ");
+    WAV_PutU32(header, 16);
+    WAV_PutU16(header, m_format == WavFormat::S16 ? WAV_FORMAT_PCM : WAV_FORMAT_IEEE_FLOAT);
+    WAV_PutU16(header, 2);
+    WAV_PutU32(header, m_sample_rate);
+    WAV_PutU32(header, m_sample_rate * bytes_per_frame);
+    WAV_PutU16(header, (uint16_t)bytes_per_frame);
+    WAV_PutU16(header, (uint16_t)(8 * WAV_BytesPerSample(m_format)));
+
+    WAV_PutTag(header, "data");
+    WAV_PutU32(header, data_size);
+
+    m_output.write((const char*)header.data(), (std::streamsize)header.size());
+}
+
+void WavWriter::Write(const float* left, const float* right, size_t count)
+{
+    const uint32_t bytes_per_frame = 2 * WAV_BytesPerSample(m_format);
+
+    // Anything past the size limit would be unreadable
+    const uint64_t max_frames = WAV_MAX_DATA_SIZE / bytes_per_frame;
+    count                     = (size_t)std::min<uint64_t>(count, max_frames - std::min(m_frames_written, max_frames));
+
+    m_buffer.clear();
+    m_buffer.reserve(count * bytes_per_frame);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        for (const float sample : {left[i], right[i]})
+        {
+            if (m_format == WavFormat::S16)
+            {
+                const float scaled = std::clamp(sample * 32768.0f, -32768.0f, 32767.0f);
+                WAV_PutU16(m_buffer, (uint16_t)(int16_t)std::lrint(scaled));
+            }
+            else
+            {
+                WAV_PutU32(m_buffer, std::bit_cast<uint32_t>(sample));
+            }
+        }
+    }
+
+    m_output.write((const char*)m_buffer.data(), (std::streamsize)m_buffer.size());
+    m_frames_written += count;
+}
+
+bool WavWriter::Close()
+{
+    m_output.seekp(0);
+    WriteHeader();
+
+    const bool ok = (bool)m_output;
+    m_output.close();
+    return ok;
+}
+
+} // namespace common
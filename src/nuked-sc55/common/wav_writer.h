@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace common
+{
+
+enum class WavFormat
+{
+    // 16-bit integer PCM, with clipping
+    S16,
+
+    // 32-bit float PCM; samples are written unclipped
+    F32,
+};
+
+// Writes a stereo WAV file incrementally. The sizes in the header are filled in by `Close`.
+class WavWriter
+{
+public:
+    WavWriter() = default;
+    ~WavWriter();
+
+    WavWriter(const WavWriter&)            = delete;
+    WavWriter& operator=(const WavWriter&) = delete;
+
+    bool Open(const std::filesystem::path& path, uint32_t sample_rate, WavFormat format);
+
+    // Writes `count` frames of normalized samples (see `Normalize`).
+    void Write(const float* left, const float* right, size_t count);
+
+    // Finishes the header and closes the file. Returns false if any write failed.
+    bool Close();
+
+    uint64_t GetFramesWritten() const
+    {
+        return m_frames_written;
+    }
+
+private:
+    void WriteHeader();
+
+private:
+    std::ofstream        m_output;
+    uint32_t             m_sample_rate    = 0;
+    WavFormat            m_format         = WavFormat::S16;
+    uint64_t             m_frames_written = 0;
+    std::vector<uint8_t> m_buffer;
+};
+
+} // namespace common
@@ -1,10 +1,13 @@
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <cinttypes>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
-#include <ranges>
+#include <map>
+#include <mutex>
 #include <string>
-#include <string_view>
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -14,7 +17,10 @@
 #endif
 
 #include "nuked_sc55.h"
-#include "nuked-sc55/common/rom_loader.h"
+#include "nuked-sc55/backend/hotspot.h"
+#include "nuked-sc55/backend/profile.h"
+#include "nuked-sc55/common/rom_image_cache.h"
+#include "nuked-sc55/common/rom_path.h"
 
 static std::string get_env_var(const char* var_name);
 
@@ -86,12 +92,6 @@ static std::string get_env_var(const char* var_name)
     return env_var;
 }
 
-#ifdef _WIN32
-    constexpr auto PathSeparator = std::string_view(";");
-#else
-    constexpr auto PathSeparator = std::string_view(":");
-#endif
-
 extern std::string plugin_path;
 
 NukedSc55::NukedSc55(const clap_plugin_t _plugin_class,
@@ -115,19 +115,13 @@ const clap_plugin_t* NukedSc55::GetPluginClass()
     return &plugin_class;
 }
 
-// Get a list of potential ROM directories from an environment variable 
-// if it is set to a non-empty value. The paths must be absolute directory paths.
-// Entries must be separated by the OS PATH separator
+// Get a list of potential ROM directories from the SOUNDCANVAS_ROM_PATH
+// environment variable (see common::GetRomPathDirectories). The paths must be
+// absolute directory paths.
 std::vector<std::filesystem::path> NukedSc55::GetRomEnvDirs()
 {
-    constexpr char env_rom_dir_name[] = "SOUNDCANVAS_ROM_PATH";
     std::vector<std::filesystem::path> paths = {};
-    const auto env_dir_list = get_env_var(env_rom_dir_name);
-    if (env_dir_list.empty()) {
-        return paths;
-    }
-    for (const auto env_dir : std::views::split(env_dir_list, PathSeparator)) {
-        auto dir = std::filesystem::path(std::string(env_dir.data(), env_dir.size()));
+    for (const auto& dir : common::GetRomPathDirectories()) {
         if (dir.is_relative()) {
             log("Error: path is relative: %s", dir.string().c_str());
             continue;
@@ -161,21 +155,70 @@ std::vector<std::filesystem::path> NukedSc55::GetRomBasePaths()
     return paths;
 }
 
+// Directory of the on-disk cache of unscrambled ROM images. Returns an empty
+// path if there's no suitable location, which disables the cache.
+std::filesystem::path NukedSc55::GetRomCacheDir()
+{
+    const char* app_dir = "Nuked-SC55";
+
+#ifdef _WIN32
+    const auto local_app_data = get_env_var("LOCALAPPDATA");
+    if (!local_app_data.empty()) {
+        return std::filesystem::path(local_app_data) / app_dir / "Cache";
+    }
+#else
+    const auto home = get_env_var("HOME");
+
+#ifdef __APPLE__
+    if (!home.empty()) {
+        return std::filesystem::path(home) / "Library" / "Caches" / app_dir;
+    }
+#else
+    const auto xdg_cache_home = get_env_var("XDG_CACHE_HOME");
+    if (!xdg_cache_home.empty()) {
+        return std::filesystem::path(xdg_cache_home) / app_dir;
+    }
+    if (!home.empty()) {
+        return std::filesystem::path(home) / ".cache" / app_dir;
+    }
+#endif
+#endif
+    return {};
+}
+
 bool NukedSc55::Init(const clap_plugin* _plugin_instance)
 {
     log("Init");
 
     plugin_instance = _plugin_instance;
 
+    // Default resampler, e.g. "Polyphase" for the best quality or "Linear"
+    // for the lowest CPU use; see resampler.h
+    const auto resampler_name = get_env_var("NUKED_SC55_RESAMPLER");
+    if (!resampler_name.empty()) {
+        if (const auto type = resampler_type_from_string(resampler_name)) {
+            default_resampler_type = *type;
+        } else {
+            log("Unknown resampler: %s", resampler_name.c_str());
+        }
+    }
+    requested_resampler_type = default_resampler_type;
+
     emu = std::make_unique<Emulator>();
 
-    const EMU_Options opts = {.lcd_backend = nullptr, .nvram_filename = std::filesystem::path{}};
+    const EMU_Options opts = {
+        .lcd_backend    = nullptr,
+        .nvram_filename = std::filesystem::path{},
+        .block_engine   = !get_env_var("NUKED_SC55_BLOCK_ENGINE").empty()};
     if (!emu->Init(opts)) {
         log("emu->Init failed");
         emu.reset(nullptr);
         return false;
     }
 
+    const auto rom_cache_dir = GetRomCacheDir();
+    log("ROM cache dir: %s", rom_cache_dir.string().c_str());
+
     auto rom_paths = GetRomBasePaths();
     for (auto rom_path : rom_paths) {
         auto romset   = "mk1";
@@ -194,20 +237,18 @@ bool NukedSc55::Init(const clap_plugin* _plugin_instance)
 
         log("Trying ROM dir: %s", rom_path.string().c_str());
 
-        AllRomsetInfo romset_info = {};
-        common::LoadRomsetResult load_result = {};
-        common::RomOverrides rom_overrides;
-        common::LoadRomsetError err = common::LoadRomset(romset_info, rom_path, romset, false, rom_overrides, load_result);
+        std::shared_ptr<const RomImages> rom_images = {};
+        common::LoadRomsetError err = common::LoadRomImages(rom_path, romset, rom_cache_dir, rom_images);
         if (err != common::LoadRomsetError{}) {
-            log("emu->LoadRomset failed. Trying next directory");
+            log("LoadRomImages failed. Trying next directory");
             continue;
         }
-        RomLocationSet loaded = {};
-        if (!emu->LoadRoms(load_result.romset, romset_info, &loaded)) {
+        if (!emu->LoadRoms(std::move(rom_images))) {
             log("emu->LoadRoms failed");
             emu.reset(nullptr);
             return false;
         }
+        rom_dir = rom_path;
         return true;
         }
     log("Init failed, tried all ROM directories");
@@ -219,22 +260,60 @@ void NukedSc55::Shutdown()
 {
     log("Shutdown");
 
-    if (resampler) {
-        speex_resampler_destroy(resampler);
-        resampler = nullptr;
+    StopRenderThread();
+
+    resampler = nullptr;
+    for (auto& r : resamplers) {
+        r.reset();
     }
     log_shutdown();
 }
 
-static void receive_sample(void* userdata, const AudioFrame<int32_t>& in)
+//----------------------------------------------------------------------------
+
+// Machine state right after the boot sequence, shared by all instances of the
+// same model loaded from the same ROM directory. Booting takes seconds for the
+// mk2, so we only do it once per process; subsequent activations just restore
+// the snapshot.
+//
+// Each key has its own mutex, held while booting, so instances of the same
+// model wait for the first one to finish instead of booting again, while
+// instances of other models boot in parallel. The global mutex only guards
+// the map itself.
+using BootSnapshotKey = std::pair<NukedSc55::Model, std::filesystem::path>;
+
+struct BootSnapshot {
+    std::mutex mutex      = {};
+    bool is_valid         = false;
+    EMU_Snapshot snapshot = {};
+};
+
+static std::mutex boot_snapshots_mutex = {};
+static std::map<BootSnapshotKey, BootSnapshot> boot_snapshots = {};
+
+void NukedSc55::BootEmulator()
 {
-    assert(userdata);
-    auto emu = reinterpret_cast<NukedSc55*>(userdata);
+    BootSnapshot* boot_snapshot = nullptr;
+    {
+        std::lock_guard lock(boot_snapshots_mutex);
+        // Map nodes are never erased, so the pointer stays valid
+        boot_snapshot = &boot_snapshots[BootSnapshotKey{model, rom_dir}];
+    }
 
-    AudioFrame<float> out = {};
-    Normalize(in, out);
+    std::lock_guard lock(boot_snapshot->mutex);
 
-    emu->PublishFrame(out.left, out.right);
+    if (boot_snapshot->is_valid) {
+        if (emu->RestoreSnapshot(boot_snapshot->snapshot)) {
+            log("Restored boot snapshot");
+            return;
+        }
+    }
+
+    emu->Boot(EMU_SystemReset::GS_RESET);
+
+    emu->SaveSnapshot(boot_snapshot->snapshot);
+    boot_snapshot->is_valid = true;
+    log("Saved boot snapshot");
 }
 
 bool NukedSc55::Activate(const double requested_sample_rate,
@@ -246,48 +325,59 @@ bool NukedSc55::Activate(const double requested_sample_rate,
         min_frame_count,
         max_frame_count);
 
-    emu->Reset();
-    emu->GetPCM().disable_oversampling = true;
-    emu->PostSystemReset(EMU_SystemReset::GS_RESET);
+    StopRenderThread();
 
-    // Speed up the devices' bootup delay
-    const size_t num_steps = (model == Model::Sc55mk2_v1_01) ? 9'500'000 : 700'000;
-
-    for (size_t i = 0; i < num_steps; i++) {
-        MCU_Step(emu->GetMCU());
-    }
-
-    emu->SetSampleCallback(receive_sample, this);
+    BootEmulator();
 
     render_sample_rate_hz = PCM_GetOutputFrequency(emu->GetPCM());
 
     log("render_sample_rate_hz: %g", render_sample_rate_hz);
 
+    // Clean up after a previous activation
+    resampler = nullptr;
+    for (auto& r : resamplers) {
+        r.reset();
+    }
+    render_buf[0].clear();
+    render_buf[1].clear();
+
     if (requested_sample_rate != render_sample_rate_hz) {
         do_resample = true;
 
         output_sample_rate_hz = requested_sample_rate;
 
-        // Initialise Speex resampler
         resample_ratio = render_sample_rate_hz / output_sample_rate_hz;
 
-        const spx_uint32_t in_rate_hz = static_cast<int>(render_sample_rate_hz);
-        const spx_uint32_t out_rate_hz = static_cast<int>(output_sample_rate_hz);
+        for (uint32_t i = 0; i < NumResamplerTypes; ++i) {
+            const auto type = static_cast<ResamplerType>(i);
 
-        constexpr auto NumChannels     = 2; // always stereo
-        constexpr auto ResampleQuality = SPEEX_RESAMPLER_QUALITY_DESKTOP;
+            resamplers[i] = create_resampler(
+                type, render_sample_rate_hz, output_sample_rate_hz);
 
-        resampler = speex_resampler_init(
-            NumChannels, in_rate_hz, out_rate_hz, ResampleQuality, nullptr);
+            if (!resamplers[i]) {
+                log("Failed to create %s resampler", resampler_type_to_string(type));
+            }
+        }
+
+        // Fall back to the first resampler that works
+        resampler_type = requested_resampler_type;
+        resampler      = resamplers[static_cast<size_t>(resampler_type)].get();
 
-        speex_resampler_set_rate(resampler, in_rate_hz, out_rate_hz);
-        speex_resampler_skip_zeros(resampler);
+        for (uint32_t i = 0; !resampler && i < NumResamplerTypes; ++i) {
+            resampler_type = static_cast<ResamplerType>(i);
+            resampler      = resamplers[i].get();
+        }
+        if (!resampler) {
+            log("No resampler available");
+            return false;
+        }
 
         const auto max_render_buf_size = static_cast<size_t>(
             static_cast<double>(max_frame_count) * resample_ratio * 1.10f);
 
         render_buf[0].reserve(max_render_buf_size);
         render_buf[1].reserve(max_render_buf_size);
+        emu_frames.resize(max_render_buf_size);
 
     } else {
         do_resample = false;
@@ -295,17 +385,308 @@ bool NukedSc55::Activate(const double requested_sample_rate,
         output_sample_rate_hz = render_sample_rate_hz;
         resample_ratio        = 1.0;
 
-        render_buf[0].reserve(max_frame_count);
-        render_buf[1].reserve(max_frame_count);
+        // The emulator renders directly into the host's buffers, see
+        // RenderBlock()
+        emu_frames.clear();
     }
 
+    silent_frames = 0;
+    sleeping      = false;
+
     log("do_resample: %s", do_resample ? "true" : "false");
+    log("resampler: %s", resampler_type_to_string(resampler_type));
     log("output_sample_rate_hz: %g", output_sample_rate_hz);
     log("resample_ratio: %g", resample_ratio);
 
+    // Render-ahead mode is opt-in as it adds latency; the value is the
+    // minimum latency in output frames. Offline rendering gains nothing
+    // from it.
+    const auto render_ahead = get_env_var("NUKED_SC55_RENDER_AHEAD_FRAMES");
+    if (!render_ahead.empty() && !offline_render) {
+        const auto requested_frames = static_cast<uint32_t>(
+            std::strtoul(render_ahead.c_str(), nullptr, 10));
+
+        StartRenderThread(requested_frames, max_frame_count);
+    }
+
+    active = true;
     return true;
 }
 
+void NukedSc55::Deactivate()
+{
+    log("Deactivate");
+
+    StopRenderThread();
+
+    if (emu) {
+        log("MIDI queue overflows: %" PRIu64 " messages (%" PRIu64 " bytes) dropped",
+            emu->GetMIDIQueue().GetDroppedMessages(),
+            emu->GetMIDIQueue().GetDroppedBytes());
+    }
+
+    // Profiling builds only
+    PROFILE_WriteToEnvPath();
+    HOTSPOT_WriteToEnvPath();
+
+    active = false;
+}
+
+uint32_t NukedSc55::GetLatency() const
+{
+    return render_ahead_frames;
+}
+
+bool NukedSc55::SetRenderMode(const clap_plugin_render_mode mode)
+{
+    const bool offline = (mode == CLAP_RENDER_OFFLINE);
+
+    log("SetRenderMode: %s", offline ? "offline" : "realtime");
+
+    if (offline == offline_render.exchange(offline)) {
+        return true;
+    }
+
+    // Render-ahead mode is only decided on activation, and turning it on or
+    // off changes our latency
+    if (active && !get_env_var("NUKED_SC55_RENDER_AHEAD_FRAMES").empty()) {
+        host->request_restart(host);
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+// Selects the resampler used when the host's sample rate differs from the
+// emulator's; the value is a ResamplerType. Saved in the plugin state. Cubic
+// and Linear have no anti-aliasing filter (see ResamplerType and the README).
+constexpr clap_id ResamplerParamId = 0;
+
+static ResamplerType param_value_to_resampler_type(const double value)
+{
+    const auto index = std::clamp(static_cast<int>(std::lround(value)),
+                                  0,
+                                  static_cast<int>(NumResamplerTypes) - 1);
+
+    return static_cast<ResamplerType>(index);
+}
+
+uint32_t NukedSc55::GetParamCount() const
+{
+    return 1;
+}
+
+bool NukedSc55::GetParamInfo(const uint32_t param_index, clap_param_info_t* info) const
+{
+    if (param_index != 0) {
+        return false;
+    }
+
+    *info = {};
+
+    info->id    = ResamplerParamId;
+    info->flags = CLAP_PARAM_IS_STEPPED | CLAP_PARAM_IS_ENUM;
+
+    info->min_value     = 0.0;
+    info->max_value     = static_cast<double>(NumResamplerTypes - 1);
+    info->default_value = static_cast<double>(default_resampler_type);
+
+    snprintf(info->name, sizeof(info->name), "%s", "Resampler");
+
+    return true;
+}
+
+bool NukedSc55::GetParamValue(const clap_id param_id, double* value) const
+{
+    if (param_id != ResamplerParamId) {
+        return false;
+    }
+
+    *value = static_cast<double>(requested_resampler_type.load());
+    return true;
+}
+
+bool NukedSc55::ParamValueToText(const clap_id param_id, const double value,
+                                 char* display, const uint32_t size) const
+{
+    if (param_id != ResamplerParamId) {
+        return false;
+    }
+
+    snprintf(display,
+             size,
+             "%s",
+             resampler_type_to_string(param_value_to_resampler_type(value)));
+    return true;
+}
+
+bool NukedSc55::ParamTextToValue(const clap_id param_id, const char* display,
+                                 double* value) const
+{
+    if (param_id != ResamplerParamId) {
+        return false;
+    }
+
+    const auto type = resampler_type_from_string(display);
+    if (!type) {
+        return false;
+    }
+
+    *value = static_cast<double>(*type);
+    return true;
+}
+
+void NukedSc55::SetParamValue(const clap_event_param_value_t* event)
+{
+    if (event->param_id == ResamplerParamId) {
+        requested_resampler_type = param_value_to_resampler_type(event->value);
+    }
+}
+
+// Used for offline rendering regardless of the "Resampler" parameter
+constexpr auto OfflineResamplerType = ResamplerType::Polyphase;
+
+// Makes the resampler requested by the "Resampler" parameter (or the
+// offline one) the current one. The new resampler starts from a clean
+// state, so switching while audio is playing may cause a short click.
+void NukedSc55::SwitchResampler()
+{
+    const auto type = offline_render ? OfflineResamplerType
+                                     : requested_resampler_type.load();
+    if (type == resampler_type) {
+        return;
+    }
+
+    const auto new_resampler = resamplers[static_cast<size_t>(type)].get();
+    if (!new_resampler) {
+        return;
+    }
+
+    log("Switching resampler: %s -> %s",
+        resampler_type_to_string(resampler_type),
+        resampler_type_to_string(type));
+
+    new_resampler->Reset();
+
+    resampler      = new_resampler;
+    resampler_type = type;
+}
+
+//----------------------------------------------------------------------------
+
+// Number of output frames the render thread renders at a time
+constexpr uint32_t RenderAheadChunkFrames = 32;
+
+// Capacity of the MIDI queue in entries; must be a power of 2
+constexpr size_t MidiQueueLength = 4096;
+
+void NukedSc55::StartRenderThread(const uint32_t requested_frames,
+                                  const uint32_t max_frame_count)
+{
+    // We need at least a full block buffered to avoid underruns, plus a chunk
+    // of headroom as the render thread only tops up the ring in whole chunks
+    render_ahead_frames = std::max(requested_frames,
+                                   max_frame_count + RenderAheadChunkFrames);
+
+    const auto ring_frames = std::bit_ceil(
+        static_cast<size_t>(render_ahead_frames) + RenderAheadChunkFrames);
+
+    if (!output_ring_buf.Init(ring_frames * sizeof(AudioFrame<float>)) ||
+        !midi_queue_buf.Init(MidiQueueLength * sizeof(MidiQueueEntry))) {
+        log("Failed to allocate render-ahead buffers");
+        render_ahead_frames = 0;
+        return;
+    }
+
+    output_ring = RingbufferView(output_ring_buf);
+    midi_queue  = RingbufferView(midi_queue_buf);
+
+    read_buf.resize(max_frame_count);
+    chunk_buf[0].resize(RenderAheadChunkFrames);
+    chunk_buf[1].resize(RenderAheadChunkFrames);
+    chunk_frames.resize(RenderAheadChunkFrames);
+
+    read_frame_pos  = 0;
+    frames_to_skip  = 0;
+    write_frame_pos = 0;
+
+    render_thread_stop = false;
+
+    // Prime the ring so the first Process() call has a full buffer to play
+    RenderAhead();
+
+    render_thread = std::thread(&NukedSc55::RenderThreadMain, this);
+
+    log("Render-ahead enabled, latency: %d frames", render_ahead_frames);
+}
+
+void NukedSc55::StopRenderThread()
+{
+    if (render_thread.joinable()) {
+        render_thread_stop = true;
+
+        render_thread_wakeup.fetch_add(1);
+        render_thread_wakeup.notify_one();
+
+        render_thread.join();
+    }
+    render_ahead_frames = 0;
+}
+
+void NukedSc55::RenderThreadMain()
+{
+    while (!render_thread_stop) {
+        const auto wakeup = render_thread_wakeup.load();
+
+        RenderAhead();
+
+        // Sleep until the audio thread has consumed some frames
+        render_thread_wakeup.wait(wakeup);
+    }
+}
+
+// Tops up the output ring to `render_ahead_frames`. Never renders past that
+// point, so MIDI events queued by Process() with the latency added to their
+// timestamp are never late.
+void NukedSc55::RenderAhead()
+{
+    while (!render_thread_stop &&
+           output_ring.GetReadableElements<AudioFrame<float>>() +
+                   RenderAheadChunkFrames <=
+               render_ahead_frames) {
+
+        RenderBlock(
+            RenderAheadChunkFrames,
+            chunk_buf[0].data(),
+            chunk_buf[1].data(),
+            [&]() -> uint32_t {
+                if (midi_queue.GetReadableElements<MidiQueueEntry>() == 0) {
+                    return RenderAheadChunkFrames;
+                }
+                const auto& entry =
+                    midi_queue.UncheckedPrepareRead<MidiQueueEntry>(1)[0];
+
+                if (entry.frame <= write_frame_pos) {
+                    return 0;
+                }
+                return static_cast<uint32_t>(std::min<uint64_t>(
+                    entry.frame - write_frame_pos, RenderAheadChunkFrames));
+            },
+            [&](const double delay_frames) {
+                MidiQueueEntry entry = {};
+                midi_queue.UncheckedReadOne(entry);
+                emu->PostMIDI(std::span{entry.data, entry.size}, delay_frames);
+            });
+
+        for (size_t i = 0; i < RenderAheadChunkFrames; ++i) {
+            chunk_frames[i] = {chunk_buf[0][i], chunk_buf[1][i]};
+        }
+        output_ring.UncheckedWrite(std::span<const AudioFrame<float>>{chunk_frames});
+
+        write_frame_pos += RenderAheadChunkFrames;
+    }
+}
+
 clap_process_status NukedSc55::Process(const clap_process_t* process)
 {
     if (!emu) {
@@ -319,61 +700,214 @@ clap_process_status NukedSc55::Process(const clap_process_t* process)
     const uint32_t num_events = process->in_events->size(process->in_events);
     log("--- num_frames: %d, num_events: %d", num_frames, num_events);
 
-    uint32_t event_index      = 0;
-    uint32_t next_event_frame = (num_events == 0) ? num_frames : 0;
+    auto out_left  = process->audio_outputs[0].data32[0];
+    auto out_right = process->audio_outputs[0].data32[1];
 
-    for (uint32_t curr_frame = 0; curr_frame < num_frames;) {
-        while (event_index < num_events && next_event_frame == curr_frame) {
+    if (render_thread.joinable()) {
+        for (uint32_t i = 0; i < num_events; ++i) {
+            const auto event = process->in_events->get(process->in_events, i);
+            QueueEvent(event, read_frame_pos + event->time + render_ahead_frames);
+        }
 
-            const auto event = process->in_events->get(process->in_events,
-                                                       event_index);
-            if (event->time != curr_frame) {
-                next_event_frame = event->time;
+        // Drop frames the render thread was late with on an underrun, so
+        // that output stays aligned with the event timestamps
+        while (frames_to_skip > 0) {
+            const auto num_skip = std::min<uint64_t>(
+                {frames_to_skip,
+                 output_ring.GetReadableElements<AudioFrame<float>>(),
+                 read_buf.size()});
+            if (num_skip == 0) {
                 break;
             }
+            output_ring.UncheckedRead(std::span{read_buf.data(), num_skip});
+            frames_to_skip -= num_skip;
+        }
 
-            ProcessEvent(event);
-            ++event_index;
+        const auto num_available = std::min<size_t>(
+            output_ring.GetReadableElements<AudioFrame<float>>(), num_frames);
 
+        output_ring.UncheckedRead(std::span{read_buf.data(), num_available});
+
+        for (size_t i = 0; i < num_available; ++i) {
+            out_left[i]  = read_buf[i].left;
+            out_right[i] = read_buf[i].right;
+        }
+        for (size_t i = num_available; i < num_frames; ++i) {
+            out_left[i]  = 0.0f;
+            out_right[i] = 0.0f;
+        }
+
+        if (num_available < num_frames) {
+            log("Render-ahead underrun: %d frames", num_frames - num_available);
+            frames_to_skip += num_frames - num_available;
+        }
+
+        read_frame_pos += num_frames;
+
+        render_thread_wakeup.fetch_add(1);
+        render_thread_wakeup.notify_one();
+
+        return CLAP_PROCESS_CONTINUE;
+    }
+
+    // The host keeps calling us while we're asleep if it doesn't support
+    // CLAP_PROCESS_SLEEP; the emulator stays frozen until the next event
+    if (sleeping && num_events == 0 && !offline_render) {
+        std::fill_n(out_left, num_frames, 0.0f);
+        std::fill_n(out_right, num_frames, 0.0f);
+        return CLAP_PROCESS_SLEEP;
+    }
+    sleeping = false;
+
+    uint32_t event_index = 0;
+
+    RenderBlock(
+        num_frames,
+        out_left,
+        out_right,
+        [&]() -> uint32_t {
             if (event_index == num_events) {
-                // We've reached the end of the event list
-                next_event_frame = num_frames;
-                break;
+                return num_frames;
             }
-        }
+            return process->in_events->get(process->in_events, event_index)->time;
+        },
+        [&](const double delay_frames) {
+            ProcessEvent(process->in_events->get(process->in_events, event_index),
+                         delay_frames);
+            ++event_index;
+        });
+
+    return UpdateSleepState(num_frames, num_events, out_left, out_right);
+}
 
-        const auto num_frames_to_render = static_cast<int>(
-            static_cast<double>(next_event_frame - curr_frame) * resample_ratio);
+// Output level below which a rendered block counts as silent
+constexpr float SilenceThreshold = 1.0f / 65536.0f;
 
-        // Render samples until the next event
-        RenderAudio(num_frames_to_render);
+// Time the emulator has to stay silent before we go to sleep. The firmware
+// may still be working on MIDI it has already read, so a single silent
+// block isn't proof that nothing is going to play.
+constexpr double SleepHoldTimeSecs = 0.5;
 
-        curr_frame = next_event_frame;
+// Returns CLAP_PROCESS_SLEEP once the emulator has been in a silent steady
+// state for `SleepHoldTimeSecs`, and CLAP_PROCESS_CONTINUE otherwise.
+clap_process_status NukedSc55::UpdateSleepState(const uint32_t num_frames,
+                                                const uint32_t num_events,
+                                                const float* out_left,
+                                                const float* out_right)
+{
+    // Freezing the emulator would make the output depend on where the
+    // silent stretches happen to fall
+    if (offline_render) {
+        silent_frames = 0;
+        return CLAP_PROCESS_CONTINUE;
     }
 
-    auto out_left  = process->audio_outputs[0].data32[0];
-    auto out_right = process->audio_outputs[0].data32[1];
+    const auto is_silent_sample = [](const float sample) {
+        return std::abs(sample) < SilenceThreshold;
+    };
+
+    // Checking the output first is cheap and rules out most blocks before
+    // we scan the emulator's delay memory
+    const bool silent =
+        num_events == 0 &&
+        std::all_of(out_left, out_left + num_frames, is_silent_sample) &&
+        std::all_of(out_right, out_right + num_frames, is_silent_sample) &&
+        emu->IsSilent();
+
+    if (!silent) {
+        silent_frames = 0;
+        return CLAP_PROCESS_CONTINUE;
+    }
+
+    silent_frames += num_frames;
 
+    if (static_cast<double>(silent_frames) <
+        SleepHoldTimeSecs * output_sample_rate_hz) {
+        return CLAP_PROCESS_CONTINUE;
+    }
+
+    log("Silent for %" PRIu64 " frames, going to sleep", silent_frames);
+
+    sleeping      = true;
+    silent_frames = 0;
+
+    return CLAP_PROCESS_SLEEP;
+}
+
+// Renders `num_frames` output frames into `out_left` and `out_right`.
+// `next_event_frame` returns the frame offset of the next pending event (or
+// `num_frames` or more if there is none in this block), and
+// `process_next_event` sends it to the emulator to be played the given
+// number of emulator frames from now.
+template <typename NextEventFrame, typename ProcessNextEvent>
+void NukedSc55::RenderBlock(const uint32_t num_frames, float* out_left,
+                            float* out_right, NextEventFrame next_event_frame,
+                            ProcessNextEvent process_next_event)
+{
     if (do_resample) {
+        SwitchResampler();
+    }
+
+    // Frames rendered for an earlier block that the resampler hasn't
+    // consumed yet; they come first in this block
+    const auto num_buffered_frames = static_cast<double>(render_buf[0].size());
+
+    // All events of the block are scheduled up front and the emulator
+    // delivers each one at the exact cycle of its frame, so we can render
+    // the whole block in one go
+    for (auto frame = next_event_frame(); frame < num_frames;
+         frame = next_event_frame()) {
+        process_next_event(static_cast<double>(frame) * resample_ratio -
+                           num_buffered_frames);
+    }
+
+    if (do_resample) {
+        RenderAudio(static_cast<uint32_t>(static_cast<double>(num_frames) * resample_ratio));
+
         ResampleAndPublishFrames(num_frames, out_left, out_right);
 
     } else {
-	assert(out_left && out_right);
+        assert(out_left && out_right);
 
-	assert(render_buf.size() == 2);
-	assert(render_buf[0].size() >= num_frames);
-	assert(render_buf[1].size() >= num_frames);
+        // The emulator writes straight into the output buffers
+        emu->RenderFrames(out_left, out_right, num_frames);
+    }
+}
 
-        for (size_t i = 0; i < num_frames; ++i) {
-            out_left[i]  = render_buf[0][i];
-            out_right[i] = render_buf[1][i];
+// Layout of the saved state:
+//
+//   byte 0  StateVersion
+//   byte 1  value of the "Resampler" parameter (a ResamplerType)
+//
+// Bump StateVersion whenever the layout changes.
+constexpr uint8_t StateVersion = 1;
+constexpr size_t StateSize     = 2;
+
+// The host may transfer fewer bytes than requested per call
+static bool read_state(const clap_istream_t* stream, uint8_t* data, size_t size)
+{
+    while (size > 0) {
+        const auto num_read = stream->read(stream, data, size);
+        if (num_read <= 0) {
+            return false;
         }
-
-        render_buf[0].clear();
-        render_buf[1].clear();
+        data += num_read;
+        size -= static_cast<size_t>(num_read);
     }
+    return true;
+}
 
-    return CLAP_PROCESS_CONTINUE;
+static bool write_state(const clap_ostream_t* stream, const uint8_t* data, size_t size)
+{
+    while (size > 0) {
+        const auto num_written = stream->write(stream, data, size);
+        if (num_written <= 0) {
+            return false;
+        }
+        data += num_written;
+        size -= static_cast<size_t>(num_written);
+    }
+    return true;
 }
 
 bool NukedSc55::LoadState(const clap_istream_t* stream)
@@ -382,18 +916,41 @@ bool NukedSc55::LoadState(const clap_istream_t* stream)
         return false;
     }
 
-    // TODO return true once implemented
-    return false;
+    std::array<uint8_t, StateSize> state = {};
+    if (!read_state(stream, state.data(), state.size())) {
+        log("LoadState: failed to read the state");
+        return false;
+    }
+
+    if (state[0] != StateVersion) {
+        log("LoadState: unknown state version %d", state[0]);
+        return false;
+    }
+
+    requested_resampler_type = param_value_to_resampler_type(state[1]);
+    log("LoadState: resampler: %s",
+        resampler_type_to_string(requested_resampler_type.load()));
+
+    // Let the host pick up the restored parameter value
+    const auto host_params = static_cast<const clap_host_params_t*>(
+        host->get_extension(host, CLAP_EXT_PARAMS));
+    if (host_params) {
+        host_params->rescan(host, CLAP_PARAM_RESCAN_VALUES);
+    }
+    return true;
 }
 
 bool NukedSc55::SaveState(const clap_ostream_t* stream)
 {
     if (!emu) {
-        return 0;
+        return false;
     }
 
-    // TODO return actual number of bytes written once implemented
-    return 0;
+    const std::array<uint8_t, StateSize> state = {
+        StateVersion,
+        static_cast<uint8_t>(requested_resampler_type.load())};
+
+    return write_state(stream, state.data(), state.size());
 }
 
 void NukedSc55::Flush(const clap_input_events_t* in, const clap_output_events_t* out)
@@ -408,16 +965,15 @@ void NukedSc55::Flush(const clap_input_events_t* in, const clap_output_events_t*
 
     // Process events sent to our plugin from the host.
     for (uint32_t event_index = 0; event_index < num_events; ++event_index) {
-        ProcessEvent(in->get(in, event_index));
+        if (render_thread.joinable()) {
+            QueueEvent(in->get(in, event_index),
+                       read_frame_pos + render_ahead_frames);
+        } else {
+            ProcessEvent(in->get(in, event_index));
+        }
     }
 }
 
-void NukedSc55::PublishFrame(const float left, const float right)
-{
-    render_buf[0].emplace_back(left);
-    render_buf[1].emplace_back(right);
-}
-
 constexpr uint8_t NoteOff         = 0x80;
 constexpr uint8_t NoteOn          = 0x90;
 constexpr uint8_t PolyKeyPressure = 0xa0;
@@ -468,27 +1024,37 @@ constexpr uint8_t PitchBend       = 0xe0;
     }
 }
 
-void NukedSc55::ProcessEvent(const clap_event_header_t* event)
+static size_t midi_message_length(const clap_event_midi_t* event)
 {
+    const auto status = event->data[0] & 0xf0;
+
+    // 3-byte messages
+    switch (status) {
+    case NoteOff:
+    case NoteOn:
+    case PolyKeyPressure:
+    case ControlChange:
+    case PitchBend: return 3;
+    default: return 2;
+    }
+}
+
+void NukedSc55::ProcessEvent(const clap_event_header_t* event,
+                             const double delay_frames)
+{
+    // Flush() may send events while we're asleep
+    sleeping      = false;
+    silent_frames = 0;
+
     if (event->space_id == CLAP_CORE_EVENT_SPACE_ID) {
 
         switch (event->type) {
         case CLAP_EVENT_MIDI: {
             const auto midi_event = reinterpret_cast<const clap_event_midi_t*>(event);
 
-            emu->PostMIDI(midi_event->data[0]);
-            emu->PostMIDI(midi_event->data[1]);
-
-            // 3-byte messages
-            const auto status = midi_event->data[0] & 0xf0;
-
-            switch (status) {
-            case NoteOff:
-            case NoteOn:
-            case PolyKeyPressure:
-            case ControlChange:
-            case PitchBend: emu->PostMIDI(midi_event->data[2]); break;
-            }
+            emu->PostMIDI(
+                std::span{midi_event->data, midi_message_length(midi_event)},
+                delay_frames);
 #ifdef DEBUG
             log_midi_message(midi_event);
 #endif
@@ -498,22 +1064,93 @@ void NukedSc55::ProcessEvent(const clap_event_header_t* event)
             const auto sysex_event = reinterpret_cast<const clap_event_midi_sysex*>(
                 event);
 
-            emu->PostMIDI(std::span{sysex_event->buffer, sysex_event->size});
+            emu->PostMIDI(std::span{sysex_event->buffer, sysex_event->size},
+                          delay_frames);
 
             log("SysEx message, length: %d", sysex_event->size);
         } break;
+
+        case CLAP_EVENT_PARAM_VALUE:
+            SetParamValue(reinterpret_cast<const clap_event_param_value_t*>(event));
+            break;
+        }
+    }
+}
+
+void NukedSc55::QueueEvent(const clap_event_header_t* event, const uint64_t frame)
+{
+    if (event->space_id == CLAP_CORE_EVENT_SPACE_ID) {
+
+        switch (event->type) {
+        case CLAP_EVENT_MIDI: {
+            const auto midi_event = reinterpret_cast<const clap_event_midi_t*>(event);
+
+            QueueMidi(std::span{midi_event->data, midi_message_length(midi_event)},
+                      frame);
+        } break;
+
+        case CLAP_EVENT_MIDI_SYSEX: {
+            const auto sysex_event = reinterpret_cast<const clap_event_midi_sysex*>(
+                event);
+
+            QueueMidi(std::span{sysex_event->buffer, sysex_event->size}, frame);
+        } break;
+
+        // The render thread picks up the new value at its next block
+        case CLAP_EVENT_PARAM_VALUE:
+            SetParamValue(reinterpret_cast<const clap_event_param_value_t*>(event));
+            break;
         }
     }
 }
 
+void NukedSc55::QueueMidi(std::span<const uint8_t> data, const uint64_t frame)
+{
+    constexpr size_t ChunkSize = sizeof(MidiQueueEntry::data);
+
+    const auto num_entries = (data.size() + ChunkSize - 1) / ChunkSize;
+
+    // Drop the whole message rather than sending a truncated SysEx
+    if (midi_queue.GetWritableElements<MidiQueueEntry>() < num_entries) {
+        log("MIDI queue full, dropping %zu bytes", data.size());
+        return;
+    }
+
+    while (!data.empty()) {
+        MidiQueueEntry entry = {};
+        entry.frame = frame;
+        entry.size  = static_cast<uint8_t>(std::min(data.size(), ChunkSize));
+
+        std::copy_n(data.begin(), entry.size, entry.data);
+        midi_queue.UncheckedWriteOne(entry);
+
+        data = data.subspan(entry.size);
+    }
+}
+
 void NukedSc55::RenderAudio(const uint32_t num_frames)
 {
     const auto start_size = render_buf[0].size();
 
     log("RenderAudio: num_frames: %d, start_size: %d", num_frames, start_size);
 
-    while (render_buf[0].size() - start_size < num_frames) {
-        MCU_Step(emu->GetMCU());
+    if (emu_frames.size() < num_frames) {
+        emu_frames.resize(num_frames);
+    }
+    emu->RenderFrames(std::span{emu_frames.data(), num_frames});
+
+    render_buf[0].resize(start_size + num_frames);
+    render_buf[1].resize(start_size + num_frames);
+
+    auto left  = render_buf[0].data() + start_size;
+    auto right = render_buf[1].data() + start_size;
+
+    for (size_t i = 0; i < num_frames; ++i) {
+        AudioFrame<float> out = {};
+        Normalize(emu_frames[i], out);
+
+        left[i]  = out.left;
+        right[i] = out.right;
     }
 
     log("  num_rendered: %d", render_buf[0].size() - start_size);
@@ -529,19 +1166,12 @@ void NukedSc55::ResampleAndPublishFrames(const uint32_t num_out_frames,
 
     log("  input_len: %d", input_len);
 
-    spx_uint32_t in_len  = input_len;
-    spx_uint32_t out_len = output_len;
+    uint32_t in_len  = input_len;
+    uint32_t out_len = output_len;
 
-    speex_resampler_process_float(
-        resampler, 0, render_buf[0].data(), &in_len, out_left, &out_len);
+    ResampleChannels(in_len, out_left, out_right, out_len);
 
-    in_len  = input_len;
-    out_len = output_len;
-
-    speex_resampler_process_float(
-        resampler, 1, render_buf[1].data(), &in_len, out_right, &out_len);
-
-    // Speex returns the number actually consumed and written samples in
+    // The resampler returns the number actually consumed and written samples in
     // `in_len` and `out_len`, respectively. There are three outcomes:
     //
     // 1) The input buffer hasn't been fully consumed, but the output buffer
@@ -572,22 +1202,10 @@ void NukedSc55::ResampleAndPublishFrames(const uint32_t num_out_frames,
         in_len  = render_buf[0].size();
         out_len = num_out_frames_remaining;
 
-        speex_resampler_process_float(resampler,
-                                      0,
-                                      render_buf[0].data(),
-                                      &in_len,
-                                      out_left + curr_out_pos,
-                                      &out_len);
-
-        in_len  = render_buf[1].size();
-        out_len = num_out_frames_remaining;
-
-        speex_resampler_process_float(resampler,
-                                      1,
-                                      render_buf[1].data(),
-                                      &in_len,
-                                      out_right + curr_out_pos,
-                                      &out_len);
+        ResampleChannels(in_len,
+                         out_left + curr_out_pos,
+                         out_right + curr_out_pos,
+                         out_len);
     }
 
     if (in_len < input_len) {
@@ -607,4 +1225,23 @@ void NukedSc55::ResampleAndPublishFrames(const uint32_t num_out_frames,
         render_buf[0].clear();
         render_buf[1].clear();
     }
+
+    // The emulator publishes its own counts, but resampling comes after it
+    PROFILE_Publish();
+}
+
+// Resamples `in_len` frames of `render_buf` into at most `out_len` frames of
+// each output channel. On return, `in_len` and `out_len` hold the number of
+// frames consumed and written.
+void NukedSc55::ResampleChannels(uint32_t& in_len, float* out_left,
+                                 float* out_right, uint32_t& out_len)
+{
+    PROFILE_SCOPE(RESAMPLE);
+
+    resampler->Process(render_buf[0].data(),
+                       render_buf[1].data(),
+                       in_len,
+                       out_left,
+                       out_right,
+                       out_len);
 }
@@ -1,13 +1,16 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <filesystem>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #include "clap/clap.h"
 #include "nuked-sc55/backend/emu.h"
-#include "speex/speex_resampler.h"
+#include "nuked-sc55/backend/ringbuffer.h"
+#include "resampler.h"
 
 class NukedSc55 {
 public:
@@ -25,13 +28,30 @@ public:
     bool Activate(const double sample_rate, const uint32_t min_frame_count,
                   const uint32_t max_frame_count);
 
+    void Deactivate();
+
+    // Latency in output frames, non-zero only in render-ahead mode
+    uint32_t GetLatency() const;
+
+    // Render mode
+    bool SetRenderMode(const clap_plugin_render_mode mode);
+
+    // Parameters
+    uint32_t GetParamCount() const;
+    bool GetParamInfo(const uint32_t param_index, clap_param_info_t* info) const;
+    bool GetParamValue(const clap_id param_id, double* value) const;
+
+    bool ParamValueToText(const clap_id param_id, const double value,
+                          char* display, const uint32_t size) const;
+
+    bool ParamTextToValue(const clap_id param_id, const char* display,
+                          double* value) const;
+
     // Processing
     clap_process_status Process(const clap_process_t* process);
 
     void Flush(const clap_input_events_t* in, const clap_output_events_t* out);
 
-    void PublishFrame(const float left, const float right);
-
     // State handling
     bool LoadState(const clap_istream_t* stream);
     bool SaveState(const clap_ostream_t* stream);
@@ -41,6 +61,9 @@ private:
 
     Model model = {};
 
+    // ROM directory the emulator was loaded from
+    std::filesystem::path rom_dir = {};
+
     clap_plugin_t plugin_class         = {};
     const clap_host_t* host            = nullptr;
     const clap_plugin* plugin_instance = nullptr;
@@ -50,20 +73,118 @@ private:
     double render_sample_rate_hz = 0.0;
     double output_sample_rate_hz = 0.0;
 
+    // Only used when resampling; otherwise the emulator renders directly into
+    // the output buffers
     std::array<std::vector<float>, 2> render_buf = {};
 
-    SpeexResamplerState* resampler = nullptr;
-    bool do_resample               = false;
-    double resample_ratio          = 0.0f;
+    // Raw emulator output, converted into `render_buf`
+    std::vector<AudioFrame<int32_t>> emu_frames = {};
+
+    bool do_resample      = false;
+    double resample_ratio = 0.0f;
+
+    // One resampler of each type, all created in Activate() so switching
+    // between them never allocates on the audio thread
+    std::array<std::unique_ptr<Resampler>, NumResamplerTypes> resamplers = {};
+
+    Resampler* resampler         = nullptr;
+    ResamplerType resampler_type = ResamplerType::Speex;
+
+    // Value of the "Resampler" parameter. It can be changed while we render
+    // on another thread, so the new resampler only takes over at the start
+    // of the next block.
+    ResamplerType default_resampler_type                = ResamplerType::Speex;
+    std::atomic<ResamplerType> requested_resampler_type = ResamplerType::Speex;
+
+    // True between Activate() and Deactivate()
+    bool active = false;
+
+    // Offline rendering (CLAP_RENDER_OFFLINE): the host doesn't need the
+    // output in real time, so we go for quality and deterministic output.
+    // Render-ahead and sleep mode are off, and the best resampler is used
+    // regardless of the "Resampler" parameter.
+    std::atomic<bool> offline_render = false;
+
+    // Sleep mode: once the emulator has been in a silent steady state for a
+    // while (see Emulator::IsSilent), Process() returns CLAP_PROCESS_SLEEP
+    // and stops running the emulator until the next event arrives. Not used
+    // in render-ahead mode.
+    uint64_t silent_frames = 0;
+    bool sleeping          = false;
+
+    // Render-ahead mode: the emulator runs on a worker thread that keeps
+    // `render_ahead_frames` frames of output buffered in `output_ring`, and
+    // Process() only moves MIDI events and frames between the audio thread
+    // and the worker. Both rings are single-producer single-consumer.
+    struct MidiQueueEntry {
+        // Output frame the bytes should be sent to the emulator at
+        uint64_t frame;
+        uint8_t size;
+        uint8_t data[7];
+    };
+
+    uint32_t render_ahead_frames = 0;
+
+    GenericBuffer output_ring_buf = {};
+    RingbufferView output_ring    = {};
+
+    GenericBuffer midi_queue_buf = {};
+    RingbufferView midi_queue    = {};
+
+    std::thread render_thread                  = {};
+    std::atomic<bool> render_thread_stop       = false;
+    std::atomic<uint32_t> render_thread_wakeup = 0;
+
+    // Owned by the audio thread
+    uint64_t read_frame_pos = 0;
+    uint64_t frames_to_skip = 0;
+    std::vector<AudioFrame<float>> read_buf = {};
+
+    // Owned by the render thread
+    uint64_t write_frame_pos = 0;
+    std::array<std::vector<float>, 2> chunk_buf = {};
+    std::vector<AudioFrame<float>> chunk_frames = {};
 
     // Methods
     std::vector<std::filesystem::path> GetRomEnvDirs();
     std::vector<std::filesystem::path> GetRomBasePaths();
+    std::filesystem::path GetRomCacheDir();
 
-    void ProcessEvent(const clap_event_header_t* event);
+    void BootEmulator();
+
+    // Sends `event` to the emulator to be played `delay_frames` emulator
+    // frames after the last rendered one
+    void ProcessEvent(const clap_event_header_t* event,
+                      const double delay_frames = 0.0);
+
+    void SetParamValue(const clap_event_param_value_t* event);
+
+    void SwitchResampler();
+
+    clap_process_status UpdateSleepState(const uint32_t num_frames,
+                                         const uint32_t num_events,
+                                         const float* out_left,
+                                         const float* out_right);
+
+    template <typename NextEventFrame, typename ProcessNextEvent>
+    void RenderBlock(const uint32_t num_frames, float* out_left,
+                     float* out_right, NextEventFrame next_event_frame,
+                     ProcessNextEvent process_next_event);
+
+    void StartRenderThread(const uint32_t requested_frames,
+                           const uint32_t max_frame_count);
+    void StopRenderThread();
+    void RenderThreadMain();
+    void RenderAhead();
+
+    void QueueEvent(const clap_event_header_t* event, const uint64_t frame);
+    void QueueMidi(std::span<const uint8_t> data, const uint64_t frame);
 
     void RenderAudio(const uint32_t num_frames);
 
     void ResampleAndPublishFrames(const uint32_t num_out_frames,
                                   float* out_left, float* out_right);
+
+    void ResampleChannels(uint32_t& in_len, float* out_left,
+                          float* out_right, uint32_t& out_len);
 };
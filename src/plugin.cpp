@@ -140,6 +140,58 @@ static const clap_plugin_state_t extension_state = {
         return the_plugin->LoadState(stream);
     }};
 
+static const clap_plugin_latency_t extension_latency = {
+    .get = [](const clap_plugin_t* plugin) -> uint32_t {
+        auto the_plugin = (NukedSc55*)plugin->plugin_data;
+        return the_plugin->GetLatency();
+    }};
+
+static const clap_plugin_render_t extension_render = {
+    .has_hard_realtime_requirement = [](const clap_plugin_t* plugin) -> bool {
+        return false;
+    },
+
+    .set = [](const clap_plugin_t* plugin, clap_plugin_render_mode mode) -> bool {
+        auto the_plugin = (NukedSc55*)plugin->plugin_data;
+        return the_plugin->SetRenderMode(mode);
+    }};
+
+static const clap_plugin_params_t extension_params = {
+    .count = [](const clap_plugin_t* plugin) -> uint32_t {
+        auto the_plugin = (NukedSc55*)plugin->plugin_data;
+        return the_plugin->GetParamCount();
+    },
+
+    .get_info = [](const clap_plugin_t* plugin, uint32_t param_index,
+                   clap_param_info_t* param_info) -> bool {
+        auto the_plugin = (NukedSc55*)plugin->plugin_data;
+        return the_plugin->GetParamInfo(param_index, param_info);
+    },
+
+    .get_value = [](const clap_plugin_t* plugin, clap_id param_id,
+                    double* out_value) -> bool {
+        auto the_plugin = (NukedSc55*)plugin->plugin_data;
+        return the_plugin->GetParamValue(param_id, out_value);
+    },
+
+    .value_to_text = [](const clap_plugin_t* plugin, clap_id param_id, double value,
+                        char* out_buffer, uint32_t out_buffer_capacity) -> bool {
+        auto the_plugin = (NukedSc55*)plugin->plugin_data;
+        return the_plugin->ParamValueToText(param_id, value, out_buffer, out_buffer_capacity);
+    },
+
+    .text_to_value = [](const clap_plugin_t* plugin, clap_id param_id,
+                        const char* param_value_text, double* out_value) -> bool {
+        auto the_plugin = (NukedSc55*)plugin->plugin_data;
+        return the_plugin->ParamTextToValue(param_id, param_value_text, out_value);
+    },
+
+    .flush = [](const clap_plugin_t* plugin, const clap_input_events_t* in,
+                const clap_output_events_t* out) {
+        auto the_plugin = (NukedSc55*)plugin->plugin_data;
+        the_plugin->Flush(in, out);
+    }};
+
 //////////////////////////////////////////////////////////////////////////////
 // Plugin classes
 //////////////////////////////////////////////////////////////////////////////
@@ -155,6 +207,15 @@ static const void* get_extension(const clap_plugin* plugin, const char* id)
     } else if (strcmp(id, CLAP_EXT_STATE) == 0) {
         return &extension_state;
 
+    } else if (strcmp(id, CLAP_EXT_LATENCY) == 0) {
+        return &extension_latency;
+
+    } else if (strcmp(id, CLAP_EXT_RENDER) == 0) {
+        return &extension_render;
+
+    } else if (strcmp(id, CLAP_EXT_PARAMS) == 0) {
+        return &extension_params;
+
     } else {
         return nullptr;
     }
@@ -187,7 +248,11 @@ static const clap_plugin_t my_plugin_class_sc55_v1_00 = {
         return the_plugin->Activate(sample_rate, min_frame_count, max_frame_count);
     },
 
-    .deactivate = [](const clap_plugin* plugin) {},
+    .deactivate =
+        [](const clap_plugin* plugin) {
+            auto the_plugin = (NukedSc55*)plugin->plugin_data;
+            the_plugin->Deactivate();
+        },
 
     .start_processing = [](const clap_plugin* plugin) -> bool { return true; },
 
@@ -234,7 +299,11 @@ static const clap_plugin_t my_plugin_class_sc55_v1_20 = {
         return the_plugin->Activate(sample_rate, min_frame_count, max_frame_count);
     },
 
-    .deactivate = [](const clap_plugin* plugin) {},
+    .deactivate =
+        [](const clap_plugin* plugin) {
+            auto the_plugin = (NukedSc55*)plugin->plugin_data;
+            the_plugin->Deactivate();
+        },
 
     .start_processing = [](const clap_plugin* plugin) -> bool { return true; },
 
@@ -281,7 +350,11 @@ static const clap_plugin_t my_plugin_class_sc55_v1_21 = {
         return the_plugin->Activate(sample_rate, min_frame_count, max_frame_count);
     },
 
-    .deactivate = [](const clap_plugin* plugin) {},
+    .deactivate =
+        [](const clap_plugin* plugin) {
+            auto the_plugin = (NukedSc55*)plugin->plugin_data;
+            the_plugin->Deactivate();
+        },
 
     .start_processing = [](const clap_plugin* plugin) -> bool { return true; },
 
@@ -328,7 +401,11 @@ static const clap_plugin_t my_plugin_class_sc55_v2_00 = {
         return the_plugin->Activate(sample_rate, min_frame_count, max_frame_count);
     },
 
-    .deactivate = [](const clap_plugin* plugin) {},
+    .deactivate =
+        [](const clap_plugin* plugin) {
+            auto the_plugin = (NukedSc55*)plugin->plugin_data;
+            the_plugin->Deactivate();
+        },
 
     .start_processing = [](const clap_plugin* plugin) -> bool { return true; },
 
@@ -375,7 +452,11 @@ static const clap_plugin_t my_plugin_class_sc55mk2_v1_01 = {
         return the_plugin->Activate(sample_rate, min_frame_count, max_frame_count);
     },
 
-    .deactivate = [](const clap_plugin* plugin) {},
+    .deactivate =
+        [](const clap_plugin* plugin) {
+            auto the_plugin = (NukedSc55*)plugin->plugin_data;
+            the_plugin->Deactivate();
+        },
 
     .start_processing = [](const clap_plugin* plugin) -> bool { return true; },
 
@@ -0,0 +1,567 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include "resampler.h"
+#include "speex/speex_resampler.h"
+
+// GCC and Clang only allow intrinsics in functions compiled for the
+// instruction set; MSVC always allows them
+#if defined(__GNUC__) || defined(__clang__)
+#define RESAMPLER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RESAMPLER_TARGET(isa)
+#endif
+
+const char* resampler_type_to_string(const ResamplerType type)
+{
+    switch (type) {
+    case ResamplerType::Speex: return "Speex";
+    case ResamplerType::Polyphase: return "Polyphase";
+    case ResamplerType::Cubic: return "Cubic";
+    case ResamplerType::Linear: return "Linear";
+    default: return "unknown";
+    }
+}
+
+std::optional<ResamplerType> resampler_type_from_string(std::string_view name)
+{
+    for (uint32_t i = 0; i < NumResamplerTypes; ++i) {
+        const auto type           = static_cast<ResamplerType>(i);
+        const std::string_view s  = resampler_type_to_string(type);
+
+        if (std::ranges::equal(name, s, [](const char a, const char b) {
+                return std::tolower(static_cast<unsigned char>(a)) ==
+                       std::tolower(static_cast<unsigned char>(b));
+            })) {
+            return type;
+        }
+    }
+    return {};
+}
+
+//----------------------------------------------------------------------------
+// Speex
+//----------------------------------------------------------------------------
+
+class SpeexResampler : public Resampler {
+public:
+    ~SpeexResampler() override
+    {
+        if (resampler) {
+            speex_resampler_destroy(resampler);
+        }
+    }
+
+    bool Init(const double in_rate_hz, const double out_rate_hz)
+    {
+        const spx_uint32_t in_rate  = static_cast<int>(in_rate_hz);
+        const spx_uint32_t out_rate = static_cast<int>(out_rate_hz);
+
+        constexpr auto NumChannels     = 2; // always stereo
+        constexpr auto ResampleQuality = SPEEX_RESAMPLER_QUALITY_DESKTOP;
+
+        resampler = speex_resampler_init(
+            NumChannels, in_rate, out_rate, ResampleQuality, nullptr);
+        if (!resampler) {
+            return false;
+        }
+
+        speex_resampler_set_rate(resampler, in_rate, out_rate);
+        speex_resampler_skip_zeros(resampler);
+        return true;
+    }
+
+    void Process(const float* in_left, const float* in_right, uint32_t& in_len,
+                 float* out_left, float* out_right, uint32_t& out_len) override
+    {
+        auto in_len_right  = in_len;
+        auto out_len_right = out_len;
+
+        ProcessChannel(0, in_left, in_len, out_left, out_len);
+        ProcessChannel(1, in_right, in_len_right, out_right, out_len_right);
+
+        // Both channels go through the same resampler state, so they always
+        // consume and produce the same number of frames
+        assert(in_len == in_len_right);
+        assert(out_len == out_len_right);
+    }
+
+    void Reset() override
+    {
+        speex_resampler_reset_mem(resampler);
+        speex_resampler_skip_zeros(resampler);
+    }
+
+private:
+    // Both channels share one multi-channel state, so they must not be
+    // processed concurrently
+    void ProcessChannel(const uint32_t channel, const float* in, uint32_t& in_len,
+                        float* out, uint32_t& out_len)
+    {
+        spx_uint32_t spx_in_len  = in_len;
+        spx_uint32_t spx_out_len = out_len;
+
+        speex_resampler_process_float(
+            resampler, channel, in, &spx_in_len, out, &spx_out_len);
+
+        in_len  = spx_in_len;
+        out_len = spx_out_len;
+    }
+
+    SpeexResamplerState* resampler = nullptr;
+};
+
+//----------------------------------------------------------------------------
+// Interpolating resamplers
+//----------------------------------------------------------------------------
+
+// Position of an output frame in input frames, in 32.32 fixed point. Using
+// an integer step keeps the position exact over arbitrarily long streams.
+constexpr int PosFracBits = 32;
+
+constexpr float FracToFloat = 1.0f / 4294967296.0f;
+
+// Number of input frames buffered at a time beyond the filter length
+constexpr size_t HistoryChunkFrames = 1024;
+
+// Buffers the input of both channels and computes each output frame from
+// `kernel.taps` consecutive input frames.
+//
+// Output frame `n` is at input position `n * step`. The window for it
+// starts `kernel.taps / 2 - 1` frames before that, so the history starts
+// with that many frames of silence to line the first window up with the
+// first input frame. This compensates for the filter delay.
+template <typename Kernel>
+class InterpolatingResampler : public Resampler {
+public:
+    InterpolatingResampler(Kernel&& kernel, const double in_rate_hz,
+                           const double out_rate_hz)
+        : kernel(std::move(kernel)),
+          step(static_cast<uint64_t>(std::llround(
+              in_rate_hz / out_rate_hz * static_cast<double>(1ULL << PosFracBits))))
+    {
+        const auto capacity = this->kernel.taps + HistoryChunkFrames;
+        history[0].resize(capacity);
+        history[1].resize(capacity);
+        Reset();
+    }
+
+    void Process(const float* in_left, const float* in_right, uint32_t& in_len,
+                 float* out_left, float* out_right, uint32_t& out_len) override
+    {
+        const size_t taps = kernel.taps;
+
+        uint32_t in_done  = 0;
+        uint32_t out_done = 0;
+
+        for (;;) {
+            const float* left  = history[0].data();
+            const float* right = history[1].data();
+
+            while (out_done < out_len) {
+                const auto start = static_cast<size_t>(pos >> PosFracBits);
+                if (start + taps > history_len) {
+                    break;
+                }
+                kernel.Compute(left + start,
+                               right + start,
+                               static_cast<uint32_t>(pos),
+                               out_left[out_done],
+                               out_right[out_done]);
+                ++out_done;
+                pos += step;
+            }
+
+            if (out_done == out_len || in_done == in_len) {
+                break;
+            }
+
+            // Drop the frames that no window needs anymore and top up the
+            // history from the input
+            const auto num_drop = std::min(
+                static_cast<size_t>(pos >> PosFracBits), history_len);
+
+            for (auto& channel : history) {
+                std::copy(channel.begin() + num_drop,
+                          channel.begin() + history_len,
+                          channel.begin());
+            }
+            history_len -= num_drop;
+            pos -= static_cast<uint64_t>(num_drop) << PosFracBits;
+
+            const auto num_append = std::min<size_t>(
+                in_len - in_done, history[0].size() - history_len);
+
+            std::copy_n(in_left + in_done, num_append, history[0].begin() + history_len);
+            std::copy_n(in_right + in_done, num_append, history[1].begin() + history_len);
+
+            history_len += num_append;
+            in_done += static_cast<uint32_t>(num_append);
+        }
+
+        in_len  = in_done;
+        out_len = out_done;
+    }
+
+    void Reset() override
+    {
+        const auto num_silent = kernel.taps / 2 - 1;
+
+        std::fill_n(history[0].begin(), num_silent, 0.0f);
+        std::fill_n(history[1].begin(), num_silent, 0.0f);
+
+        history_len = num_silent;
+        pos         = 0;
+    }
+
+private:
+    Kernel kernel;
+
+    const uint64_t step;
+    uint64_t pos = 0;
+
+    std::array<std::vector<float>, 2> history = {};
+    size_t history_len = 0;
+};
+
+struct LinearKernel {
+    static constexpr size_t taps = 2;
+
+    void Compute(const float* left, const float* right, const uint32_t frac,
+                 float& out_left, float& out_right) const
+    {
+        const float t = static_cast<float>(frac) * FracToFloat;
+
+        out_left  = left[0] + (left[1] - left[0]) * t;
+        out_right = right[0] + (right[1] - right[0]) * t;
+    }
+};
+
+struct CubicKernel {
+    static constexpr size_t taps = 4;
+
+    // Catmull-Rom spline through x[1] and x[2]
+    static float Interpolate(const float* x, const float t)
+    {
+        const float c1 = 0.5f * (x[2] - x[0]);
+        const float c2 = x[0] - 2.5f * x[1] + 2.0f * x[2] - 0.5f * x[3];
+        const float c3 = 0.5f * (x[3] - x[0]) + 1.5f * (x[1] - x[2]);
+
+        return ((c3 * t + c2) * t + c1) * t + x[1];
+    }
+
+    void Compute(const float* left, const float* right, const uint32_t frac,
+                 float& out_left, float& out_right) const
+    {
+        const float t = static_cast<float>(frac) * FracToFloat;
+
+        out_left  = Interpolate(left, t);
+        out_right = Interpolate(right, t);
+    }
+};
+
+//----------------------------------------------------------------------------
+// Polyphase FIR
+//----------------------------------------------------------------------------
+
+// The filter is tabulated at this many fractional positions per input
+// frame; positions in between interpolate the coefficients linearly
+constexpr int PhaseBits = 7;
+constexpr int NumPhases = 1 << PhaseBits;
+
+// Filter length when upsampling. When downsampling the filter is stretched
+// by the rate ratio so its cutoff follows the output rate.
+constexpr size_t BaseTaps = 64;
+
+// Cutoff relative to the lower Nyquist frequency of the two rates, and
+// Kaiser window shape. Together with the length this gives less than
+// 0.001 dB of passband ripple up to 85% of that Nyquist frequency and
+// better than -93 dB of aliasing; see tools/resampler_bench.cpp.
+constexpr double CutoffRatio = 0.94;
+constexpr double KaiserBeta  = 9.0;
+
+// Computes `sum((coefs[i] + t * deltas[i]) * x[i])` for both channels.
+// `taps` is always a multiple of 8.
+typedef void (*polyphase_kernel_fn)(const float* coefs, const float* deltas,
+                                    const float t, const float* left,
+                                    const float* right, const size_t taps,
+                                    float& out_left, float& out_right);
+
+static void polyphase_kernel_scalar(const float* coefs, const float* deltas,
+                                    const float t, const float* left,
+                                    const float* right, const size_t taps,
+                                    float& out_left, float& out_right)
+{
+    std::array<float, 4> acc_left  = {};
+    std::array<float, 4> acc_right = {};
+
+    for (size_t i = 0; i < taps; i += 4) {
+        for (size_t j = 0; j < 4; ++j) {
+            const float c = coefs[i + j] + t * deltas[i + j];
+            acc_left[j] += c * left[i + j];
+            acc_right[j] += c * right[i + j];
+        }
+    }
+    out_left  = (acc_left[0] + acc_left[1]) + (acc_left[2] + acc_left[3]);
+    out_right = (acc_right[0] + acc_right[1]) + (acc_right[2] + acc_right[3]);
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+static inline float hsum_sse(const __m128 v)
+{
+    const __m128 hi   = _mm_movehl_ps(v, v);
+    const __m128 sum2 = _mm_add_ps(v, hi);
+    const __m128 sum1 = _mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1));
+    return _mm_cvtss_f32(sum1);
+}
+
+// SSE2 is part of x86-64, so this one needs no runtime check
+static void polyphase_kernel_sse(const float* coefs, const float* deltas,
+                                 const float t, const float* left,
+                                 const float* right, const size_t taps,
+                                 float& out_left, float& out_right)
+{
+    const __m128 vt = _mm_set1_ps(t);
+
+    __m128 acc_left  = _mm_setzero_ps();
+    __m128 acc_right = _mm_setzero_ps();
+
+    for (size_t i = 0; i < taps; i += 4) {
+        const __m128 c = _mm_add_ps(_mm_loadu_ps(coefs + i),
+                                    _mm_mul_ps(vt, _mm_loadu_ps(deltas + i)));
+
+        acc_left  = _mm_add_ps(acc_left, _mm_mul_ps(c, _mm_loadu_ps(left + i)));
+        acc_right = _mm_add_ps(acc_right, _mm_mul_ps(c, _mm_loadu_ps(right + i)));
+    }
+    out_left  = hsum_sse(acc_left);
+    out_right = hsum_sse(acc_right);
+}
+
+RESAMPLER_TARGET("avx")
+static void polyphase_kernel_avx(const float* coefs, const float* deltas,
+                                 const float t, const float* left,
+                                 const float* right, const size_t taps,
+                                 float& out_left, float& out_right)
+{
+    const __m256 vt = _mm256_set1_ps(t);
+
+    __m256 acc_left  = _mm256_setzero_ps();
+    __m256 acc_right = _mm256_setzero_ps();
+
+    for (size_t i = 0; i < taps; i += 8) {
+        const __m256 c = _mm256_add_ps(_mm256_loadu_ps(coefs + i),
+                                       _mm256_mul_ps(vt, _mm256_loadu_ps(deltas + i)));
+
+        acc_left = _mm256_add_ps(acc_left, _mm256_mul_ps(c, _mm256_loadu_ps(left + i)));
+        acc_right = _mm256_add_ps(acc_right,
+                                  _mm256_mul_ps(c, _mm256_loadu_ps(right + i)));
+    }
+
+    const __m128 sum_left = _mm_add_ps(_mm256_castps256_ps128(acc_left),
+                                       _mm256_extractf128_ps(acc_left, 1));
+    const __m128 sum_right = _mm_add_ps(_mm256_castps256_ps128(acc_right),
+                                        _mm256_extractf128_ps(acc_right, 1));
+    out_left  = hsum_sse(sum_left);
+    out_right = hsum_sse(sum_right);
+}
+
+static bool has_avx()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx     = (info[2] & (1 << 28)) != 0;
+    return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+    return __builtin_cpu_supports("avx");
+#endif
+}
+
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+
+static void polyphase_kernel_neon(const float* coefs, const float* deltas,
+                                  const float t, const float* left,
+                                  const float* right, const size_t taps,
+                                  float& out_left, float& out_right)
+{
+    float32x4_t acc_left  = vdupq_n_f32(0.0f);
+    float32x4_t acc_right = vdupq_n_f32(0.0f);
+
+    for (size_t i = 0; i < taps; i += 4) {
+        const float32x4_t c = vmlaq_n_f32(vld1q_f32(coefs + i), vld1q_f32(deltas + i), t);
+
+        acc_left  = vmlaq_f32(acc_left, c, vld1q_f32(left + i));
+        acc_right = vmlaq_f32(acc_right, c, vld1q_f32(right + i));
+    }
+    out_left  = vaddvq_f32(acc_left);
+    out_right = vaddvq_f32(acc_right);
+}
+
+#endif
+
+static polyphase_kernel_fn get_polyphase_kernel()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    if (has_avx()) {
+        return polyphase_kernel_avx;
+    }
+    return polyphase_kernel_sse;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    return polyphase_kernel_neon;
+#else
+    return polyphase_kernel_scalar;
+#endif
+}
+
+// Zeroth order modified Bessel function of the first kind
+static double bessel_i0(const double x)
+{
+    double sum  = 1.0;
+    double term = 1.0;
+
+    for (int k = 1; k < 50; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+class PolyphaseKernel {
+public:
+    PolyphaseKernel(const double in_rate_hz, const double out_rate_hz)
+    {
+        const double ratio = std::max(1.0, in_rate_hz / out_rate_hz);
+
+        // Round up to whole AVX vectors
+        taps = (static_cast<size_t>(std::ceil(BaseTaps * ratio)) + 7) & ~size_t{7};
+
+        // Cutoff in cycles per input frame
+        const double cutoff = 0.5 * CutoffRatio / ratio;
+
+        const double half_len = static_cast<double>(taps) / 2.0;
+        const double window_norm = bessel_i0(KaiserBeta);
+
+        // One extra row so the last phase can interpolate towards the next
+        // input frame
+        std::vector<double> rows((NumPhases + 1) * taps);
+
+        for (int phase = 0; phase <= NumPhases; ++phase) {
+            const double frac = static_cast<double>(phase) / NumPhases;
+
+            auto row = rows.begin() + phase * taps;
+            double sum = 0.0;
+
+            for (size_t i = 0; i < taps; ++i) {
+                // Distance of the tap from the output position, see
+                // InterpolatingResampler
+                const double x = static_cast<double>(i) - (half_len - 1.0) - frac;
+
+                const double sinc =
+                    (x == 0.0) ? 1.0
+                               : std::sin(2.0 * std::numbers::pi * cutoff * x) /
+                                     (2.0 * std::numbers::pi * cutoff * x);
+
+                const double w = std::clamp(x / half_len, -1.0, 1.0);
+                const double window =
+                    bessel_i0(KaiserBeta * std::sqrt(1.0 - w * w)) / window_norm;
+
+                row[i] = sinc * window;
+                sum += row[i];
+            }
+
+            // Unity gain at DC for every phase
+            for (size_t i = 0; i < taps; ++i) {
+                row[i] /= sum;
+            }
+        }
+
+        coefs.resize(NumPhases * taps);
+        deltas.resize(NumPhases * taps);
+
+        for (size_t i = 0; i < NumPhases * taps; ++i) {
+            coefs[i]  = static_cast<float>(rows[i]);
+            deltas[i] = static_cast<float>(rows[i + taps] - rows[i]);
+        }
+
+        kernel = get_polyphase_kernel();
+    }
+
+    void Compute(const float* left, const float* right, const uint32_t frac,
+                 float& out_left, float& out_right) const
+    {
+        const uint32_t phase = frac >> (PosFracBits - PhaseBits);
+        const float t = static_cast<float>(frac << PhaseBits) * FracToFloat;
+
+        kernel(coefs.data() + phase * taps,
+               deltas.data() + phase * taps,
+               t,
+               left,
+               right,
+               taps,
+               out_left,
+               out_right);
+    }
+
+    size_t taps = 0;
+
+private:
+    std::vector<float> coefs  = {};
+    std::vector<float> deltas = {};
+
+    polyphase_kernel_fn kernel = polyphase_kernel_scalar;
+};
+
+//----------------------------------------------------------------------------
+
+std::unique_ptr<Resampler> create_resampler(const ResamplerType type,
+                                            const double in_rate_hz,
+                                            const double out_rate_hz)
+{
+    switch (type) {
+    case ResamplerType::Speex: {
+        auto resampler = std::make_unique<SpeexResampler>();
+        if (!resampler->Init(in_rate_hz, out_rate_hz)) {
+            return nullptr;
+        }
+        return resampler;
+    }
+
+    case ResamplerType::Polyphase:
+        return std::make_unique<InterpolatingResampler<PolyphaseKernel>>(
+            PolyphaseKernel(in_rate_hz, out_rate_hz), in_rate_hz, out_rate_hz);
+
+    case ResamplerType::Cubic:
+        return std::make_unique<InterpolatingResampler<CubicKernel>>(
+            CubicKernel(), in_rate_hz, out_rate_hz);
+
+    case ResamplerType::Linear:
+        return std::make_unique<InterpolatingResampler<LinearKernel>>(
+            LinearKernel(), in_rate_hz, out_rate_hz);
+
+    default: return nullptr;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+enum class ResamplerType {
+    // Speex at SPEEX_RESAMPLER_QUALITY_DESKTOP
+    Speex,
+
+    // Kaiser-windowed sinc, polyphase with interpolated coefficients. Both
+    // channels are filtered in the same pass with SIMD kernels.
+    Polyphase,
+
+    // 4-point cubic Hermite interpolation; cheap, but there's no
+    // anti-aliasing filter. Images are only about 10 dB down when
+    // upsampling from the emulator's rates, and aliases only 2-4 dB down
+    // when downsampling from 64/66 kHz to 44.1/48 kHz (see
+    // tools/resampler_bench.cpp).
+    Cubic,
+
+    // Linear interpolation; cheapest, meant for live monitoring. Aliases
+    // like Cubic, with more treble loss.
+    Linear,
+};
+
+constexpr uint32_t NumResamplerTypes = 4;
+
+const char* resampler_type_to_string(const ResamplerType type);
+
+// Parses the names returned by `resampler_type_to_string`, case-insensitively
+std::optional<ResamplerType> resampler_type_from_string(std::string_view name);
+
+// Converts a stereo stream from one sample rate to another. All
+// implementations follow the semantics of speex_resampler_process_float()
+// and compensate for their filter delay like speex_resampler_skip_zeros().
+class Resampler {
+public:
+    virtual ~Resampler() = default;
+
+    // Resamples up to `in_len` frames into at most `out_len` frames. On
+    // return, `in_len` and `out_len` hold the number of frames consumed and
+    // written. Consumed frames that aren't needed for the output yet are
+    // kept internally.
+    virtual void Process(const float* in_left, const float* in_right,
+                         uint32_t& in_len, float* out_left, float* out_right,
+                         uint32_t& out_len) = 0;
+
+    // Clears the internal state as if the resampler had just been created
+    virtual void Reset() = 0;
+};
+
+// Returns null if the resampler couldn't be created
+std::unique_ptr<Resampler> create_resampler(const ResamplerType type,
+                                            const double in_rate_hz,
+                                            const double out_rate_hz);
@@ -0,0 +1,521 @@
+// Benchmarks the emulation core and writes the results as JSON, so runs can
+// be compared across commits.
+//
+// Usage: nuked-sc55-bench [options]
+//
+// Options:
+//   -r, --romset NAME   Romset to load (default: mk2)
+//   -s, --seconds N     Seconds of audio rendered per scenario (default: 10)
+//   -n, --runs N        Runs per measurement; the fastest one is reported
+//                       (default: 3)
+//   -o, --output FILE   Write the JSON here instead of stdout
+//
+// The romset is looked up in the directories listed in SOUNDCANVAS_ROM_PATH
+// and their immediate subdirectories, so the plugin's ROM layout works as
+// is.
+//
+// Measurements:
+//
+//   activation  Cold boot (init, load ROMs, reset and run the boot sequence,
+//               like the plugin's first activation) and restoring the boot
+//               snapshot (every later activation), in milliseconds
+//
+//   scenarios   Emulated MCU cycles and audio seconds per host second:
+//
+//                 boot    the boot sequence with no MIDI input
+//                 dense   16 channels of overlapping notes, far more than
+//                         the available voices
+//                 sysex   a back-to-back stream of GS parameter changes
+//                         with a few notes
+//
+//               `dense` and `sysex` are run on both the interpreter and the
+//               block engine.
+//
+//   resamplers  Milliseconds of CPU time per second of audio, from the
+//               render rate to 48 kHz
+//
+//   output_stages
+//               Nanoseconds per call of each PCM output stage the CPU
+//               supports (see pcm_simd.h), for all voices of the romset
+//
+// In builds with NUKED_SC55_PROFILE, the profiler's totals over all runs are
+// written as JSON to the file named by NUKED_SC55_PROFILE_OUTPUT. Likewise,
+// NUKED_SC55_HOTSPOTS builds write the firmware hotspots to
+// NUKED_SC55_HOTSPOT_OUTPUT (see hotspot.h).
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nuked-sc55/backend/emu.h"
+#include "nuked-sc55/backend/hotspot.h"
+#include "nuked-sc55/backend/pcm_simd.h"
+#include "nuked-sc55/backend/profile.h"
+#include "nuked-sc55/common/rom_path.h"
+#include "resampler.h"
+
+// Frames per RenderFrames() call, like a typical host block
+constexpr size_t BlockFrames = 512;
+
+constexpr double ResamplerOutRateHz = 48000.0;
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_secs(const Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct BenchOptions {
+    std::string romset = "mk2";
+    double seconds     = 10.0;
+    int num_runs       = 3;
+    std::string output = {};
+};
+
+// A MIDI message at a frame position of the render
+struct TimedMessage {
+    double frame;
+    std::vector<uint8_t> data;
+};
+
+struct ScenarioResult {
+    std::string name    = {};
+    std::string engine  = {};
+    double audio_secs   = 0.0;
+    double host_secs    = 0.0;
+    uint64_t mcu_cycles = 0;
+};
+
+//----------------------------------------------------------------------------
+
+static std::shared_ptr<const RomImages> find_romset(const std::string& romset)
+{
+    if (common::GetRomPathDirectories().empty()) {
+        fprintf(stderr, "SOUNDCANVAS_ROM_PATH is not set\n");
+        return nullptr;
+    }
+
+    std::shared_ptr<const RomImages> images = {};
+    std::filesystem::path rom_dir           = {};
+
+    if (common::FindRomImages(romset, {}, images, rom_dir) != common::LoadRomsetError{}) {
+        fprintf(stderr, "Romset '%s' not found in SOUNDCANVAS_ROM_PATH\n", romset.c_str());
+        return nullptr;
+    }
+
+    fprintf(stderr, "Loaded %s from %s\n", romset.c_str(), rom_dir.string().c_str());
+    return images;
+}
+
+static std::unique_ptr<Emulator> create_emulator(const std::shared_ptr<const RomImages>& rom_images,
+                                                 const bool block_engine)
+{
+    auto emu = std::make_unique<Emulator>();
+
+    const EMU_Options opts = {
+        .lcd_backend    = nullptr,
+        .nvram_filename = std::filesystem::path{},
+        .block_engine   = block_engine};
+
+    if (!emu->Init(opts) || !emu->LoadRoms(rom_images)) {
+        return nullptr;
+    }
+    return emu;
+}
+
+//----------------------------------------------------------------------------
+
+// Notes on all 16 channels, a new one every 25 ms per channel, each held for
+// 400 ms
+static std::vector<TimedMessage> make_dense_midi(const double render_rate_hz,
+                                                 const double seconds)
+{
+    std::vector<TimedMessage> messages = {};
+    std::mt19937 rng(1);
+
+    for (uint8_t ch = 0; ch < 16; ++ch) {
+        messages.push_back({0.0, {static_cast<uint8_t>(0xc0 | ch), static_cast<uint8_t>(ch * 8)}});
+    }
+
+    constexpr double NoteIntervalSecs = 0.025;
+    constexpr double NoteLengthSecs   = 0.4;
+
+    for (double t = 0.01; t + NoteLengthSecs < seconds; t += NoteIntervalSecs) {
+        for (uint8_t ch = 0; ch < 16; ++ch) {
+            const auto key = static_cast<uint8_t>(36 + rng() % 48);
+            const auto vel = static_cast<uint8_t>(64 + rng() % 64);
+
+            messages.push_back({t * render_rate_hz, {static_cast<uint8_t>(0x90 | ch), key, vel}});
+            messages.push_back({(t + NoteLengthSecs) * render_rate_hz,
+                                {static_cast<uint8_t>(0x80 | ch), key, 0}});
+        }
+    }
+
+    std::ranges::stable_sort(messages, {}, &TimedMessage::frame);
+    return messages;
+}
+
+// GS part level changes (11-byte DT1 messages) every 4 ms, which keeps the
+// MIDI input about 90% busy, plus a chord every half second
+static std::vector<TimedMessage> make_sysex_midi(const double render_rate_hz,
+                                                 const double seconds)
+{
+    std::vector<TimedMessage> messages = {};
+    std::mt19937 rng(2);
+
+    constexpr double SysExIntervalSecs = 0.004;
+
+    uint32_t n = 0;
+    for (double t = 0.01; t < seconds; t += SysExIntervalSecs, ++n) {
+        const uint8_t part  = n % 16;
+        const uint8_t value = static_cast<uint8_t>(rng() % 128);
+
+        // Address 40 1p 19: part level
+        const uint8_t addr[3] = {0x40, static_cast<uint8_t>(0x10 | part), 0x19};
+        const uint8_t checksum =
+            static_cast<uint8_t>((128 - (addr[0] + addr[1] + addr[2] + value) % 128) & 0x7f);
+
+        messages.push_back({t * render_rate_hz,
+                            {0xf0, 0x41, 0x10, 0x42, 0x12, addr[0], addr[1], addr[2], value, checksum, 0xf7}});
+    }
+
+    for (double t = 0.01; t + 0.4 < seconds; t += 0.5) {
+        for (const uint8_t key : {60, 64, 67}) {
+            messages.push_back({t * render_rate_hz, {0x90, key, 100}});
+            messages.push_back({(t + 0.4) * render_rate_hz, {0x80, key, 0}});
+        }
+    }
+
+    std::ranges::stable_sort(messages, {}, &TimedMessage::frame);
+    return messages;
+}
+
+// Renders `num_frames` from the boot snapshot while playing `messages`
+static ScenarioResult run_scenario(Emulator& emu, const EMU_Snapshot& boot_snapshot,
+                                   const std::vector<TimedMessage>& messages,
+                                   const size_t num_frames)
+{
+    emu.RestoreSnapshot(boot_snapshot);
+
+    std::vector<float> left(BlockFrames);
+    std::vector<float> right(BlockFrames);
+
+    const uint64_t start_cycles = emu.GetMCU().cycles;
+    const auto start            = Clock::now();
+
+    size_t next = 0;
+    for (size_t frame = 0; frame < num_frames; frame += BlockFrames) {
+        const auto block_end = static_cast<double>(frame + BlockFrames);
+
+        while (next < messages.size() && messages[next].frame < block_end) {
+            if (!emu.PostMIDI(messages[next].data, messages[next].frame - static_cast<double>(frame))) {
+                break;
+            }
+            ++next;
+        }
+        emu.RenderFrames(left.data(), right.data(), BlockFrames);
+    }
+
+    ScenarioResult result = {};
+    result.host_secs      = elapsed_secs(start);
+    result.mcu_cycles     = emu.GetMCU().cycles - start_cycles;
+    return result;
+}
+
+static double resampler_ms_per_sec(const ResamplerType type, const double in_rate_hz,
+                                   const double seconds, const int num_runs)
+{
+    auto resampler = create_resampler(type, in_rate_hz, ResamplerOutRateHz);
+    if (!resampler) {
+        return -1.0;
+    }
+
+    std::vector<float> noise(static_cast<size_t>(seconds * in_rate_hz));
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+    for (auto& x : noise) {
+        x = dist(rng);
+    }
+
+    std::vector<float> out_left(BlockFrames);
+    std::vector<float> out_right(BlockFrames);
+
+    double best_secs = 1e30;
+    for (int run = 0; run < num_runs; ++run) {
+        resampler->Reset();
+
+        const auto start = Clock::now();
+
+        size_t pos = 0;
+        while (pos < noise.size()) {
+            auto in_len  = static_cast<uint32_t>(std::min<size_t>(BlockFrames, noise.size() - pos));
+            auto out_len = static_cast<uint32_t>(BlockFrames);
+
+            resampler->Process(noise.data() + pos, noise.data() + pos, in_len,
+                               out_left.data(), out_right.data(), out_len);
+            pos += in_len;
+        }
+
+        best_secs = std::min(best_secs, elapsed_secs(start));
+    }
+    return best_secs * 1000.0 / seconds;
+}
+
+static double output_stage_ns(const pcm_output_stage_fn stage, const int num_voices, const int num_runs)
+{
+    constexpr int NumCalls = 1'000'000;
+
+    pcm_voice_batch_t batch = {};
+    std::mt19937 rng(3);
+    for (int slot = 0; slot < 32; ++slot) {
+        batch.sample[slot]  = static_cast<int32_t>(rng() & 0xfffff);
+        batch.volmul1[slot] = static_cast<int32_t>(rng() & 0xffff);
+        batch.volmul2[slot] = static_cast<int32_t>(rng() & 0xffff);
+        batch.pan[slot]     = static_cast<int32_t>(rng() & 0xffff);
+        batch.rc[slot]      = static_cast<int32_t>(rng() & 0xffff);
+    }
+
+    // Reading an output back makes each call depend on the previous one, so
+    // the calls can't be merged or dropped
+    double best_secs = 1e30;
+    for (int run = 0; run < num_runs; ++run) {
+        const auto start = Clock::now();
+        for (int i = 0; i < NumCalls; ++i) {
+            stage(batch, 0, num_voices);
+            batch.sample[0] ^= batch.sampl[num_voices - 1] & 1;
+        }
+        best_secs = std::min(best_secs, elapsed_secs(start));
+    }
+    return best_secs * 1e9 / NumCalls;
+}
+
+//----------------------------------------------------------------------------
+
+static void print_usage()
+{
+    fprintf(stderr,
+            "Usage: nuked-sc55-bench [options]\n"
+            "\n"
+            "Options:\n"
+            "  -r, --romset NAME   Romset to load (default: mk2)\n"
+            "  -s, --seconds N     Seconds of audio rendered per scenario (default: 10)\n"
+            "  -n, --runs N        Runs per measurement (default: 3)\n"
+            "  -o, --output FILE   Write the JSON here instead of stdout\n");
+}
+
+static bool parse_args(int argc, char* argv[], BenchOptions& opts)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+
+        if (arg == "-r" || arg == "--romset") {
+            opts.romset = value;
+        } else if (arg == "-s" || arg == "--seconds") {
+            opts.seconds = std::max(std::strtod(value, nullptr), 1.0);
+        } else if (arg == "-n" || arg == "--runs") {
+            opts.num_runs = std::max(std::atoi(value), 1);
+        } else if (arg == "-o" || arg == "--output") {
+            opts.output = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions opts = {};
+    if (!parse_args(argc, argv, opts)) {
+        print_usage();
+        return 1;
+    }
+
+    const auto rom_images = find_romset(opts.romset);
+    if (!rom_images) {
+        return 1;
+    }
+
+    // Activation, and the boot scenario along with it
+    double cold_boot_secs        = 1e30;
+    ScenarioResult boot_scenario = {.name = "boot", .engine = "interpreter"};
+    EMU_Snapshot boot_snapshot   = {};
+
+    for (int run = 0; run < opts.num_runs; ++run) {
+        const auto start = Clock::now();
+
+        auto emu = create_emulator(rom_images, false);
+        if (!emu) {
+            fprintf(stderr, "Failed to create the emulator\n");
+            return 1;
+        }
+        const auto boot_start = Clock::now();
+        emu->Boot(EMU_SystemReset::GS_RESET);
+
+        const double boot_secs = elapsed_secs(boot_start);
+        const double secs      = elapsed_secs(start);
+
+        if (secs < cold_boot_secs) {
+            cold_boot_secs = secs;
+
+            boot_scenario.host_secs  = boot_secs;
+            boot_scenario.mcu_cycles = emu->GetMCU().cycles;
+            boot_scenario.audio_secs = static_cast<double>(emu->GetPCM().cycles) /
+                                       PCM_GetCyclesPerFrame(emu->GetPCM()) /
+                                       PCM_GetOutputFrequency(emu->GetPCM());
+        }
+        emu->SaveSnapshot(boot_snapshot);
+    }
+
+    fprintf(stderr, "Booted in %.0f ms\n", cold_boot_secs * 1000.0);
+
+    auto emu = create_emulator(rom_images, false);
+    if (!emu) {
+        fprintf(stderr, "Failed to create the emulator\n");
+        return 1;
+    }
+
+    constexpr int NumRestoreRuns = 100;
+
+    const auto restore_start = Clock::now();
+    for (int i = 0; i < NumRestoreRuns; ++i) {
+        emu->RestoreSnapshot(boot_snapshot);
+    }
+    const double restore_secs = elapsed_secs(restore_start) / NumRestoreRuns;
+
+    const double render_rate_hz = PCM_GetOutputFrequency(emu->GetPCM());
+    const auto num_frames       = static_cast<size_t>(opts.seconds * render_rate_hz);
+
+    // Scenarios
+    std::vector<ScenarioResult> scenarios = {boot_scenario};
+
+    const std::pair<const char*, std::vector<TimedMessage>> streams[] = {
+        {"dense", make_dense_midi(render_rate_hz, opts.seconds)},
+        {"sysex", make_sysex_midi(render_rate_hz, opts.seconds)},
+    };
+
+    for (const auto& [name, messages] : streams) {
+        for (const bool block_engine : {false, true}) {
+            auto scenario_emu = create_emulator(rom_images, block_engine);
+            if (!scenario_emu) {
+                fprintf(stderr, "Failed to create the emulator\n");
+                return 1;
+            }
+
+            ScenarioResult best = {};
+            best.host_secs      = 1e30;
+
+            for (int run = 0; run < opts.num_runs; ++run) {
+                const auto result = run_scenario(*scenario_emu, boot_snapshot, messages, num_frames);
+                if (result.host_secs < best.host_secs) {
+                    best = result;
+                }
+            }
+
+            best.name       = name;
+            best.engine     = block_engine ? "block" : "interpreter";
+            best.audio_secs = static_cast<double>(num_frames) / render_rate_hz;
+
+            fprintf(stderr, "%s (%s): %.2fx realtime\n",
+                    best.name.c_str(), best.engine.c_str(), best.audio_secs / best.host_secs);
+
+            scenarios.push_back(best);
+        }
+    }
+
+    // Output
+    FILE* out = stdout;
+    if (!opts.output.empty()) {
+        out = fopen(opts.output.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "Failed to open %s\n", opts.output.c_str());
+            return 1;
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"romset\": \"%s\",\n", RomsetName(rom_images->romset));
+    fprintf(out, "  \"render_rate_hz\": %.6g,\n", render_rate_hz);
+    fprintf(out, "  \"seconds\": %.6g,\n", opts.seconds);
+    fprintf(out, "  \"runs\": %d,\n", opts.num_runs);
+
+    fprintf(out, "  \"activation\": {\n");
+    fprintf(out, "    \"cold_boot_ms\": %.6g,\n", cold_boot_secs * 1000.0);
+    fprintf(out, "    \"snapshot_restore_ms\": %.6g\n", restore_secs * 1000.0);
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"scenarios\": [\n");
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        const auto& s = scenarios[i];
+        fprintf(out,
+                "    {\"name\": \"%s\", \"engine\": \"%s\", \"audio_seconds\": %.6g, "
+                "\"host_seconds\": %.6g, \"mcu_cycles_per_second\": %.6g, \"realtime_factor\": %.6g}%s\n",
+                s.name.c_str(),
+                s.engine.c_str(),
+                s.audio_secs,
+                s.host_secs,
+                static_cast<double>(s.mcu_cycles) / s.host_secs,
+                s.audio_secs / s.host_secs,
+                i + 1 < scenarios.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+
+    fprintf(out, "  \"resamplers\": [\n");
+    for (uint32_t i = 0; i < NumResamplerTypes; ++i) {
+        const auto type = static_cast<ResamplerType>(i);
+        const auto ms   = resampler_ms_per_sec(type, render_rate_hz, opts.seconds, opts.num_runs);
+
+        // null if the resampler couldn't be created
+        char ms_str[32] = "null";
+        if (ms >= 0.0) {
+            snprintf(ms_str, sizeof(ms_str), "%.6g", ms);
+        }
+
+        fprintf(out,
+                "    {\"name\": \"%s\", \"in_rate_hz\": %.6g, \"out_rate_hz\": %.6g, \"ms_per_second\": %s}%s\n",
+                resampler_type_to_string(type),
+                render_rate_hz,
+                ResamplerOutRateHz,
+                ms_str,
+                i + 1 < NumResamplerTypes ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+
+    const int num_voices = emu->GetPCM().config.reg_slots;
+    const auto stages    = PCM_GetOutputStages();
+
+    fprintf(out, "  \"output_stages\": [\n");
+    for (size_t i = 0; i < stages.size(); ++i) {
+        fprintf(out,
+                "    {\"name\": \"%s\", \"voices\": %d, \"ns_per_call\": %.6g}%s\n",
+                stages[i].name,
+                num_voices,
+                output_stage_ns(stages[i].fn, num_voices, opts.num_runs),
+                i + 1 < stages.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    PROFILE_WriteToEnvPath();
+    HOTSPOT_WriteToEnvPath();
+    return 0;
+}
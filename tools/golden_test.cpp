@@ -0,0 +1,743 @@
+// Bit-exact regression test for the emulation core. Plays fixed MIDI streams
+// into every available romset, hashes the raw 32-bit output, and compares the
+// digests against golden files recorded from a known-good build.
+//
+// Usage: nuked-sc55-golden [options]
+//
+// Options:
+//   -g, --golden-dir DIR         Directory of the golden files (default: golden)
+//   -r, --romset NAME            Only test this romset; may be repeated
+//   -u, --update                 Record the golden files instead of checking them
+//   -n, --frames-per-digest N    Frames covered by each digest when recording
+//                                (default: 1024)
+//   -d, --dump-dir DIR           On a divergence, write the machine state and the
+//                                differing frames here
+//
+// Romsets are looked up in the directories listed in SOUNDCANVAS_ROM_PATH and
+// their immediate subdirectories, like nuked-sc55-bench. Romsets that can't be
+// found are skipped, so the test only covers what is installed locally.
+//
+// Each romset is booted the same way as the plugin, then every stream is
+// played from the boot snapshot. The output is hashed with SHA-224 every N
+// frames; N is stored in the golden file, so a file recorded with
+// `--frames-per-digest 1` pins down the first differing frame exactly.
+// Goldens are recorded with the interpreter, and checked against both the
+// interpreter and the block engine.
+//
+// On the first differing digest of a stream, the test reports the frame range
+// it covers and the machine state at the start of that range. If the
+// interpreter reproduces the golden digest from the same state, the frames are
+// compared against it to report the first differing frame and its samples.
+//
+// Exit status: 0 if everything matched, 1 on a divergence, 2 on a setup error,
+// and 77 if no romset could be tested (ctest reports that as skipped).
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nuked-sc55/backend/emu.h"
+#include "nuked-sc55/common/rom_path.h"
+
+extern "C" {
+#include "nuked-sc55/backend/sha/sha.h"
+}
+
+// Frames rendered between posting MIDI. Output doesn't depend on this, it
+// only bounds how far ahead messages are queued.
+constexpr size_t BlockFrames = 512;
+
+constexpr double StreamSeconds = 4.0;
+
+constexpr uint32_t DefaultFramesPerDigest = 1024;
+
+constexpr int ExitMismatch   = 1;
+constexpr int ExitSetupError = 2;
+constexpr int ExitSkipped    = 77;
+
+using Frame = AudioFrame<int32_t>;
+
+struct TestOptions {
+    std::filesystem::path golden_dir = "golden";
+    std::filesystem::path dump_dir   = {};
+    std::vector<std::string> romsets = {};
+    uint32_t frames_per_digest       = DefaultFramesPerDigest;
+    bool update                      = false;
+};
+
+// A MIDI message at a frame position of the render
+struct TimedMessage {
+    double frame;
+    std::vector<uint8_t> data;
+};
+
+struct TestStream {
+    const char* name;
+    std::vector<TimedMessage> messages;
+};
+
+// Digests of one stream in a golden file
+struct GoldenStream {
+    std::string name                 = {};
+    size_t num_frames                = 0;
+    std::vector<std::string> digests = {};
+};
+
+struct GoldenFile {
+    uint32_t frames_per_digest        = 0;
+    std::vector<GoldenStream> streams = {};
+};
+
+// Where a render first stopped matching its golden digests
+struct Divergence {
+    size_t start_frame        = 0;
+    EMU_Snapshot start_state  = {};
+    std::vector<Frame> frames = {};
+    std::string digest        = {};
+};
+
+//----------------------------------------------------------------------------
+
+static std::shared_ptr<const RomImages> find_romset(const std::string& romset)
+{
+    std::shared_ptr<const RomImages> images = {};
+    std::filesystem::path rom_dir           = {};
+
+    if (common::FindRomImages(romset, {}, images, rom_dir) != common::LoadRomsetError{}) {
+        return nullptr;
+    }
+    return images;
+}
+
+static std::unique_ptr<Emulator> create_emulator(const std::shared_ptr<const RomImages>& rom_images,
+                                                 const bool block_engine)
+{
+    auto emu = std::make_unique<Emulator>();
+
+    const EMU_Options opts = {
+        .lcd_backend    = nullptr,
+        .nvram_filename = std::filesystem::path{},
+        .block_engine   = block_engine};
+
+    if (!emu->Init(opts) || !emu->LoadRoms(rom_images)) {
+        return nullptr;
+    }
+    return emu;
+}
+
+static const char* engine_name(const bool block_engine)
+{
+    return block_engine ? "block" : "interpreter";
+}
+
+//----------------------------------------------------------------------------
+// Test streams
+//
+// Only std::mt19937 is used for randomness: unlike the distributions, its
+// output is fully specified by the standard, so the streams are the same on
+// every platform.
+
+static std::vector<uint8_t> gs_dt1(const uint8_t addr0, const uint8_t addr1, const uint8_t addr2,
+                                   const uint8_t value)
+{
+    const auto checksum = static_cast<uint8_t>((128 - (addr0 + addr1 + addr2 + value) % 128) & 0x7f);
+    return {0xf0, 0x41, 0x10, 0x42, 0x12, addr0, addr1, addr2, value, checksum, 0xf7};
+}
+
+// Melodic parts with program changes, controllers and pitch bends
+static TestStream make_notes_stream(const double rate)
+{
+    TestStream stream = {"notes", {}};
+    auto& messages    = stream.messages;
+    std::mt19937 rng(23);
+
+    for (uint8_t ch = 0; ch < 16; ++ch) {
+        if (ch == 9) {
+            continue;
+        }
+        messages.push_back({0.0, {static_cast<uint8_t>(0xc0 | ch), static_cast<uint8_t>(rng() % 128)}});
+        messages.push_back({0.0, {static_cast<uint8_t>(0xb0 | ch), 10, static_cast<uint8_t>(ch * 8)}});
+    }
+
+    for (double t = 0.02; t + 0.5 < StreamSeconds; t += 0.06) {
+        const auto ch  = static_cast<uint8_t>(rng() % 9);
+        const auto key = static_cast<uint8_t>(36 + rng() % 48);
+        const auto vel = static_cast<uint8_t>(1 + rng() % 127);
+        const double length = 0.05 + static_cast<double>(rng() % 400) / 1000.0;
+
+        messages.push_back({t * rate, {static_cast<uint8_t>(0x90 | ch), key, vel}});
+        messages.push_back({(t + length) * rate, {static_cast<uint8_t>(0x80 | ch), key, 64}});
+    }
+
+    // Modulation, volume, expression, sustain and pitch bend sweeps
+    for (double t = 0.03; t < StreamSeconds; t += 0.05) {
+        const auto ch    = static_cast<uint8_t>(rng() % 9);
+        const auto value = static_cast<uint8_t>(rng() % 128);
+
+        switch (rng() % 5) {
+        case 0:
+            messages.push_back({t * rate, {static_cast<uint8_t>(0xb0 | ch), 1, value}});
+            break;
+        case 1:
+            messages.push_back({t * rate, {static_cast<uint8_t>(0xb0 | ch), 7, value}});
+            break;
+        case 2:
+            messages.push_back({t * rate, {static_cast<uint8_t>(0xb0 | ch), 11, value}});
+            break;
+        case 3:
+            messages.push_back({t * rate, {static_cast<uint8_t>(0xb0 | ch), 64, value}});
+            break;
+        default:
+            messages.push_back({t * rate, {static_cast<uint8_t>(0xe0 | ch), static_cast<uint8_t>(rng() % 128), value}});
+            break;
+        }
+    }
+
+    std::ranges::stable_sort(messages, {}, &TimedMessage::frame);
+    return stream;
+}
+
+// GS sysex: every reverb and chorus type, part parameters and master volume
+static TestStream make_gs_stream(const double rate)
+{
+    TestStream stream = {"gs", {}};
+    auto& messages    = stream.messages;
+    std::mt19937 rng(24);
+
+    for (uint8_t i = 0; i < 8; ++i) {
+        const double t = 0.01 + i * (StreamSeconds / 8.0);
+
+        // Reverb macro (40 01 30) and chorus macro (40 01 38)
+        messages.push_back({t * rate, gs_dt1(0x40, 0x01, 0x30, i)});
+        messages.push_back({t * rate, gs_dt1(0x40, 0x01, 0x38, i)});
+
+        // Reverb and chorus send levels of part 1 (40 11 22, 40 11 21)
+        messages.push_back({t * rate, gs_dt1(0x40, 0x11, 0x22, 127)});
+        messages.push_back({t * rate, gs_dt1(0x40, 0x11, 0x21, 127)});
+    }
+
+    for (double t = 0.05; t < StreamSeconds; t += 0.1) {
+        const auto part = static_cast<uint8_t>(rng() % 4);
+
+        // Part level (40 1p 19), pan (40 1p 1C) and master volume (40 00 04)
+        messages.push_back({t * rate, gs_dt1(0x40, static_cast<uint8_t>(0x11 + part), 0x19,
+                                             static_cast<uint8_t>(64 + rng() % 64))});
+        messages.push_back({t * rate, gs_dt1(0x40, static_cast<uint8_t>(0x11 + part), 0x1c,
+                                             static_cast<uint8_t>(rng() % 128))});
+        messages.push_back({t * rate, gs_dt1(0x40, 0x00, 0x04, static_cast<uint8_t>(96 + rng() % 32))});
+    }
+
+    for (double t = 0.02; t + 0.3 < StreamSeconds; t += 0.25) {
+        const auto ch = static_cast<uint8_t>(rng() % 4);
+        for (const uint8_t key : {48, 55, 60, 64}) {
+            messages.push_back({t * rate, {static_cast<uint8_t>(0x90 | ch), key, 100}});
+            messages.push_back({(t + 0.2) * rate, {static_cast<uint8_t>(0x80 | ch), key, 0}});
+        }
+    }
+
+    std::ranges::stable_sort(messages, {}, &TimedMessage::frame);
+    return stream;
+}
+
+// Drum kits on channel 10, and a second drum part set up with sysex
+static TestStream make_drums_stream(const double rate)
+{
+    TestStream stream = {"drums", {}};
+    auto& messages    = stream.messages;
+    std::mt19937 rng(25);
+
+    // Part 11 (block 1A) plays drum map 2 on channel 11 (40 1A 15)
+    messages.push_back({0.0, gs_dt1(0x40, 0x1a, 0x15, 2)});
+
+    constexpr uint8_t Kits[] = {0, 8, 16, 24, 25, 32, 40, 48, 56};
+    for (size_t i = 0; i < std::size(Kits); ++i) {
+        const double t = i * (StreamSeconds / std::size(Kits));
+        messages.push_back({t * rate, {0xc9, Kits[i]}});
+        messages.push_back({t * rate, {0xca, Kits[(i + 4) % std::size(Kits)]}});
+    }
+
+    for (double t = 0.02; t < StreamSeconds; t += 0.03) {
+        const uint8_t status = (rng() % 4 == 0) ? 0x9a : 0x99;
+        const auto key       = static_cast<uint8_t>(27 + rng() % 61);
+        const auto vel       = static_cast<uint8_t>(1 + rng() % 127);
+
+        messages.push_back({t * rate, {status, key, vel}});
+        messages.push_back({(t + 0.01) * rate, {static_cast<uint8_t>(status - 0x10), key, 0}});
+    }
+
+    std::ranges::stable_sort(messages, {}, &TimedMessage::frame);
+    return stream;
+}
+
+// Held notes cut off by All Notes Off, a GM reset and a GS reset
+static TestStream make_reset_stream(const double rate)
+{
+    TestStream stream = {"reset", {}};
+    auto& messages    = stream.messages;
+
+    const double phase = StreamSeconds / 4.0;
+
+    for (int i = 0; i < 4; ++i) {
+        const double t = 0.01 + i * phase;
+        for (uint8_t ch = 0; ch < 4; ++ch) {
+            messages.push_back({t * rate, {static_cast<uint8_t>(0x90 | ch), static_cast<uint8_t>(48 + ch * 7), 110}});
+        }
+    }
+
+    messages.push_back({(0.5 * phase) * rate, {0xb0, 123, 0}});
+    messages.push_back({(1.5 * phase) * rate, {0xf0, 0x7e, 0x7f, 0x09, 0x01, 0xf7}});
+    messages.push_back({(2.5 * phase) * rate, {0xf0, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7f, 0x00, 0x41, 0xf7}});
+
+    std::ranges::stable_sort(messages, {}, &TimedMessage::frame);
+    return stream;
+}
+
+//----------------------------------------------------------------------------
+
+// SHA-224 of the frames as little endian 32-bit samples, left first
+static std::string hash_frames(const std::span<const Frame> frames)
+{
+    std::vector<uint8_t> bytes;
+    bytes.reserve(frames.size() * 8);
+    for (const Frame& frame : frames) {
+        for (const int32_t sample : {frame.left, frame.right}) {
+            const auto value = static_cast<uint32_t>(sample);
+            bytes.push_back(static_cast<uint8_t>(value));
+            bytes.push_back(static_cast<uint8_t>(value >> 8));
+            bytes.push_back(static_cast<uint8_t>(value >> 16));
+            bytes.push_back(static_cast<uint8_t>(value >> 24));
+        }
+    }
+
+    SHA224Context ctx;
+    uint8_t digest[SHA224HashSize];
+    SHA224Reset(&ctx);
+    SHA224Input(&ctx, bytes.data(), static_cast<unsigned int>(bytes.size()));
+    SHA224Result(&ctx, digest);
+
+    std::string hex;
+    for (const uint8_t byte : digest) {
+        constexpr char Digits[] = "0123456789abcdef";
+        hex += Digits[byte >> 4];
+        hex += Digits[byte & 0xf];
+    }
+    return hex;
+}
+
+// Renders `num_frames` of `stream` from the boot snapshot and returns the
+// digest of every `frames_per_digest` frames. If `expected` is given, stops at
+// the first digest that differs from it and describes it in `divergence`.
+static std::optional<std::vector<std::string>> render_stream(Emulator& emu, const EMU_Snapshot& boot_snapshot,
+                                                             const TestStream& stream, const size_t num_frames,
+                                                             const uint32_t frames_per_digest,
+                                                             const std::vector<std::string>* expected,
+                                                             std::optional<Divergence>& divergence)
+{
+    emu.RestoreSnapshot(boot_snapshot);
+
+    std::vector<std::string> digests = {};
+    std::vector<Frame> chunk(frames_per_digest);
+    EMU_Snapshot chunk_start = {};
+
+    size_t next = 0;
+    for (size_t frame = 0; frame < num_frames; frame += frames_per_digest) {
+        const size_t chunk_frames = std::min<size_t>(frames_per_digest, num_frames - frame);
+
+        if (expected) {
+            emu.SaveSnapshot(chunk_start);
+        }
+
+        for (size_t pos = 0; pos < chunk_frames; pos += BlockFrames) {
+            const size_t block_frames = std::min(BlockFrames, chunk_frames - pos);
+            const auto block_start    = static_cast<double>(frame + pos);
+
+            while (next < stream.messages.size() &&
+                   stream.messages[next].frame < block_start + static_cast<double>(block_frames)) {
+                // The queue is never close to full with these streams, so a failure here would make the output
+                // depend on the block size
+                if (!emu.PostMIDI(stream.messages[next].data, stream.messages[next].frame - block_start)) {
+                    fprintf(stderr, "MIDI queue overflow in stream '%s'\n", stream.name);
+                    return std::nullopt;
+                }
+                ++next;
+            }
+            emu.RenderFrames(std::span(chunk).subspan(pos, block_frames));
+        }
+
+        const auto frames = std::span<const Frame>(chunk).first(chunk_frames);
+        digests.push_back(hash_frames(frames));
+
+        if (expected && (digests.size() > expected->size() || digests.back() != (*expected)[digests.size() - 1])) {
+            divergence = Divergence{
+                .start_frame = frame,
+                .start_state = std::move(chunk_start),
+                .frames      = std::vector<Frame>(frames.begin(), frames.end()),
+                .digest      = digests.back()};
+            break;
+        }
+    }
+    return digests;
+}
+
+//----------------------------------------------------------------------------
+// Golden files
+//
+// Text files, one per romset:
+//
+//   frames_per_digest 1024
+//   stream notes 128000
+//   <one hex digest per line>
+//   ...
+
+static std::filesystem::path golden_path(const std::filesystem::path& dir, const char* romset)
+{
+    return dir / (std::string(romset) + ".golden");
+}
+
+static bool read_golden(const std::filesystem::path& path, GoldenFile& golden)
+{
+    std::ifstream input(path);
+    if (!input) {
+        return false;
+    }
+
+    golden = {};
+
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword) || keyword.starts_with('#')) {
+            continue;
+        }
+
+        if (keyword == "frames_per_digest") {
+            words >> golden.frames_per_digest;
+        } else if (keyword == "stream") {
+            GoldenStream stream = {};
+            words >> stream.name >> stream.num_frames;
+            golden.streams.push_back(std::move(stream));
+        } else if (!golden.streams.empty()) {
+            golden.streams.back().digests.push_back(keyword);
+        } else {
+            return false;
+        }
+    }
+    return golden.frames_per_digest > 0;
+}
+
+static bool write_golden(const std::filesystem::path& path, const GoldenFile& golden)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    std::ofstream output(path, std::ios::trunc);
+    if (!output) {
+        return false;
+    }
+
+    output << "# Recorded by nuked-sc55-golden --update\n";
+    output << "frames_per_digest " << golden.frames_per_digest << "\n";
+    for (const GoldenStream& stream : golden.streams) {
+        output << "stream " << stream.name << " " << stream.num_frames << "\n";
+        for (const std::string& digest : stream.digests) {
+            output << digest << "\n";
+        }
+    }
+    return static_cast<bool>(output);
+}
+
+//----------------------------------------------------------------------------
+// Divergence reports
+
+static void print_machine_state(Emulator& emu)
+{
+    const mcu_t& mcu = emu.GetMCU();
+    const pcm_t& pcm = emu.GetPCM();
+
+    fprintf(stderr,
+            "    mcu: pc=%02x:%04x sr=%04x dp=%02x ep=%02x tp=%02x br=%02x sleep=%d cycles=%llu\n",
+            mcu.cp, mcu.pc, mcu.sr, mcu.dp, mcu.ep, mcu.tp, mcu.br, mcu.sleep,
+            static_cast<unsigned long long>(mcu.cycles));
+    fprintf(stderr, "    mcu: r0-r7=%04x %04x %04x %04x %04x %04x %04x %04x\n",
+            mcu.r[0], mcu.r[1], mcu.r[2], mcu.r[3], mcu.r[4], mcu.r[5], mcu.r[6], mcu.r[7]);
+    fprintf(stderr, "    mcu: uart read=%u write=%u\n", mcu.uart_read_ptr, mcu.uart_write_ptr);
+    fprintf(stderr, "    pcm: cycles=%llu voice_mask=%08x\n",
+            static_cast<unsigned long long>(pcm.cycles), pcm.voice_mask);
+}
+
+static bool write_file(const std::filesystem::path& path, const std::vector<uint8_t>& data)
+{
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(output);
+}
+
+// Writes the state at the start of the differing range and the rendered frames,
+// so they can be compared against a dump from a known-good build
+static void dump_divergence(const std::filesystem::path& dir, const std::string& prefix, const Divergence& divergence)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    const EMU_Snapshot& state = divergence.start_state;
+    const std::pair<const char*, const std::vector<uint8_t>*> parts[] = {
+        {"mcu", &state.mcu},
+        {"sm", &state.sm},
+        {"timer", &state.timer},
+        {"pcm", &state.pcm},
+        {"lcd", &state.lcd},
+    };
+
+    bool ok = true;
+    for (const auto& [name, data] : parts) {
+        ok &= write_file(dir / (prefix + "." + name + ".bin"), *data);
+    }
+
+    std::ofstream frames(dir / (prefix + ".frames.txt"), std::ios::trunc);
+    for (size_t i = 0; i < divergence.frames.size(); ++i) {
+        frames << (divergence.start_frame + i) << " " << divergence.frames[i].left << " "
+               << divergence.frames[i].right << "\n";
+    }
+    ok &= static_cast<bool>(frames);
+
+    fprintf(stderr, "  %s the state and frames to %s\n", ok ? "Wrote" : "Failed to write", dir.string().c_str());
+}
+
+static void report_divergence(const std::shared_ptr<const RomImages>& rom_images, Emulator& emu,
+                              const char* romset, const char* stream, const bool block_engine,
+                              const std::string& expected, const Divergence& divergence,
+                              const TestOptions& opts)
+{
+    const size_t end_frame = divergence.start_frame + divergence.frames.size();
+
+    fprintf(stderr, "%s/%s (%s): digest of frames [%zu, %zu) differs\n",
+            romset, stream, engine_name(block_engine), divergence.start_frame, end_frame);
+    fprintf(stderr, "  expected %s\n", expected.empty() ? "(end of stream)" : expected.c_str());
+    fprintf(stderr, "  got      %s\n", divergence.digest.c_str());
+
+    // Narrow it down to a frame if the interpreter still reproduces the golden output from the same state
+    auto reference = create_emulator(rom_images, false);
+    if (reference && reference->RestoreSnapshot(divergence.start_state)) {
+        std::vector<Frame> frames(divergence.frames.size());
+        reference->RenderFrames(frames);
+
+        if (hash_frames(frames) == expected) {
+            for (size_t i = 0; i < frames.size(); ++i) {
+                const Frame& want = frames[i];
+                const Frame& got  = divergence.frames[i];
+                if (want.left != got.left || want.right != got.right) {
+                    fprintf(stderr, "  first differing frame: %zu (expected %d %d, got %d %d)\n",
+                            divergence.start_frame + i, want.left, want.right, got.left, got.right);
+                    break;
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "  machine state at frame %zu:\n", divergence.start_frame);
+    emu.RestoreSnapshot(divergence.start_state);
+    print_machine_state(emu);
+
+    if (!opts.dump_dir.empty()) {
+        const std::string prefix = std::string(romset) + "-" + stream + "-" + engine_name(block_engine);
+        dump_divergence(opts.dump_dir, prefix, divergence);
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Tests or records one romset. Returns the exit status for it.
+static int run_romset(const char* romset, const std::shared_ptr<const RomImages>& rom_images,
+                      const TestOptions& opts)
+{
+    const auto path = golden_path(opts.golden_dir, romset);
+
+    GoldenFile golden = {};
+    if (!opts.update && !read_golden(path, golden)) {
+        fprintf(stderr, "%s: no golden file at %s; record one with --update\n", romset, path.string().c_str());
+        return ExitSetupError;
+    }
+
+    auto emu = create_emulator(rom_images, false);
+    if (!emu) {
+        fprintf(stderr, "%s: failed to create the emulator\n", romset);
+        return ExitSetupError;
+    }
+    // Same boot sequence as the plugin
+    emu->Boot(EMU_SystemReset::GS_RESET);
+
+    EMU_Snapshot boot_snapshot = {};
+    emu->SaveSnapshot(boot_snapshot);
+
+    const double rate        = PCM_GetOutputFrequency(emu->GetPCM());
+    const auto stream_frames = static_cast<size_t>(StreamSeconds * rate);
+
+    const TestStream streams[] = {
+        make_notes_stream(rate),
+        make_gs_stream(rate),
+        make_drums_stream(rate),
+        make_reset_stream(rate),
+    };
+
+    if (opts.update) {
+        golden.frames_per_digest = opts.frames_per_digest;
+
+        for (const TestStream& stream : streams) {
+            std::optional<Divergence> divergence = {};
+            auto digests = render_stream(*emu, boot_snapshot, stream, stream_frames, golden.frames_per_digest,
+                                         nullptr, divergence);
+            if (!digests) {
+                return ExitSetupError;
+            }
+            golden.streams.push_back({stream.name, stream_frames, std::move(*digests)});
+        }
+
+        if (!write_golden(path, golden)) {
+            fprintf(stderr, "%s: failed to write %s\n", romset, path.string().c_str());
+            return ExitSetupError;
+        }
+        fprintf(stderr, "%s: recorded %s\n", romset, path.string().c_str());
+        return 0;
+    }
+
+    int status = 0;
+
+    for (const bool block_engine : {false, true}) {
+        auto test_emu = create_emulator(rom_images, block_engine);
+        if (!test_emu) {
+            fprintf(stderr, "%s: failed to create the emulator\n", romset);
+            return ExitSetupError;
+        }
+
+        for (const TestStream& stream : streams) {
+            const auto golden_stream = std::ranges::find(golden.streams, std::string_view(stream.name),
+                                                         &GoldenStream::name);
+            if (golden_stream == golden.streams.end()) {
+                fprintf(stderr, "%s/%s: missing from %s; record it with --update\n",
+                        romset, stream.name, path.string().c_str());
+                status = std::max(status, ExitMismatch);
+                continue;
+            }
+
+            std::optional<Divergence> divergence = {};
+            const auto digests = render_stream(*test_emu, boot_snapshot, stream, golden_stream->num_frames,
+                                               golden.frames_per_digest, &golden_stream->digests, divergence);
+            if (!digests) {
+                return ExitSetupError;
+            }
+
+            if (divergence) {
+                const size_t index         = digests->size() - 1;
+                const std::string expected = index < golden_stream->digests.size() ? golden_stream->digests[index]
+                                                                                  : std::string();
+                report_divergence(rom_images, *test_emu, romset, stream.name, block_engine, expected, *divergence,
+                                  opts);
+                status = std::max(status, ExitMismatch);
+            } else if (digests->size() != golden_stream->digests.size()) {
+                fprintf(stderr, "%s/%s (%s): golden file has %zu digests, rendered %zu\n",
+                        romset, stream.name, engine_name(block_engine),
+                        golden_stream->digests.size(), digests->size());
+                status = std::max(status, ExitMismatch);
+            } else {
+                fprintf(stderr, "%s/%s (%s): ok\n", romset, stream.name, engine_name(block_engine));
+            }
+        }
+    }
+    return status;
+}
+
+//----------------------------------------------------------------------------
+
+static void print_usage()
+{
+    fprintf(stderr,
+            "Usage: nuked-sc55-golden [options]\n"
+            "\n"
+            "Options:\n"
+            "  -g, --golden-dir DIR         Directory of the golden files (default: golden)\n"
+            "  -r, --romset NAME            Only test this romset; may be repeated\n"
+            "  -u, --update                 Record the golden files instead of checking them\n"
+            "  -n, --frames-per-digest N    Frames covered by each digest when recording (default: 1024)\n"
+            "  -d, --dump-dir DIR           On a divergence, write the machine state and frames here\n");
+}
+
+static bool parse_args(int argc, char* argv[], TestOptions& opts)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+
+        if (arg == "-u" || arg == "--update") {
+            opts.update = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+
+        if (arg == "-g" || arg == "--golden-dir") {
+            opts.golden_dir = value;
+        } else if (arg == "-r" || arg == "--romset") {
+            Romset romset;
+            if (!ParseRomsetName(value, romset)) {
+                fprintf(stderr, "Unknown romset '%s'\n", value);
+                return false;
+            }
+            opts.romsets.push_back(value);
+        } else if (arg == "-n" || arg == "--frames-per-digest") {
+            opts.frames_per_digest = static_cast<uint32_t>(std::max(std::atoi(value), 1));
+        } else if (arg == "-d" || arg == "--dump-dir") {
+            opts.dump_dir = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    TestOptions opts = {};
+    if (!parse_args(argc, argv, opts)) {
+        print_usage();
+        return ExitSetupError;
+    }
+
+    if (opts.romsets.empty()) {
+        for (const char* name : GetParsableRomsetNames()) {
+            opts.romsets.push_back(name);
+        }
+    }
+
+    int status      = 0;
+    int num_romsets = 0;
+
+    for (const std::string& romset : opts.romsets) {
+        const auto rom_images = find_romset(romset);
+        if (!rom_images) {
+            fprintf(stderr, "%s: not found in SOUNDCANVAS_ROM_PATH, skipped\n", romset.c_str());
+            continue;
+        }
+
+        status = std::max(status, run_romset(romset.c_str(), rom_images, opts));
+        ++num_romsets;
+    }
+
+    if (num_romsets == 0) {
+        fprintf(stderr, "No romsets found; set SOUNDCANVAS_ROM_PATH\n");
+        return ExitSkipped;
+    }
+    return status;
+}
@@ -0,0 +1,266 @@
+// Stress test of MidiInputQueue. Four producer threads push messages of
+// varying length into a small queue while the main thread pops them, and the
+// consumer checks that:
+//
+//   - messages from different producers never interleave,
+//   - every producer's messages arrive complete, in order and with the timing
+//     they were pushed with,
+//   - every push that failed is counted in the overflow counters, and every
+//     push that succeeded is popped.
+//
+// Usage: nuked-sc55-midi-queue-test [messages per producer]
+//
+// Producers retry dropped messages, so the queue runs full most of the time.
+// The test only uses the queue's own synchronization, so it is meant to be run
+// under ThreadSanitizer as well (-fsanitize=thread). No ROMs are needed.
+//
+// Exit status: 0 if everything matched, 1 on a mismatch.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "nuked-sc55/backend/midi_queue.h"
+
+constexpr int Producers = 4;
+
+constexpr int DefaultMessages = 50'000;
+
+// Small enough that producers keep running into a full queue
+constexpr size_t QueueCapacity = 64;
+
+constexpr size_t MinMessageSize = 3;
+constexpr size_t MaxMessageSize = 7;
+
+// Mismatches reported before the rest are only counted.
+constexpr int MaxReports = 5;
+
+struct ProducerResult {
+    uint64_t pushed_messages = 0;
+    uint64_t pushed_bytes    = 0;
+    uint64_t failed_messages = 0;
+    uint64_t failed_bytes    = 0;
+};
+
+// Messages look like this:
+//
+//   0x80 | producer << 4 | size, sequence & 0x7f, (sequence >> 7) & 0x7f, then sequence & 0x7f for the rest
+//
+// and are pushed with `timed` set for odd producers and the sequence number as the delay.
+static size_t make_message(uint8_t (&message)[MaxMessageSize], int producer, uint32_t sequence)
+{
+    const size_t size = MinMessageSize + sequence % (MaxMessageSize - MinMessageSize + 1);
+
+    message[0] = (uint8_t)(0x80 | producer << 4 | size);
+    message[1] = sequence & 0x7f;
+    message[2] = (sequence >> 7) & 0x7f;
+    for (size_t i = 3; i < size; ++i) {
+        message[i] = sequence & 0x7f;
+    }
+    return size;
+}
+
+static void produce(MidiInputQueue& queue, int producer, int messages, ProducerResult& result)
+{
+    uint8_t message[MaxMessageSize];
+
+    // Never fits, so it must be dropped and counted
+    uint8_t oversized[QueueCapacity + 1]{};
+    if (!queue.Push(oversized, false, 0.0)) {
+        result.failed_messages++;
+        result.failed_bytes += sizeof(oversized);
+    }
+
+    for (uint32_t sequence = 0; sequence < (uint32_t)messages; ++sequence) {
+        const size_t size = make_message(message, producer, sequence);
+        while (!queue.Push(std::span{message, size}, producer & 1, sequence)) {
+            result.failed_messages++;
+            result.failed_bytes += size;
+            std::this_thread::yield();
+        }
+        result.pushed_messages++;
+        result.pushed_bytes += size;
+    }
+}
+
+// Checks the bytes popped by the consumer one at a time.
+class Checker {
+public:
+    void check(const MidiInputByte& byte)
+    {
+        ++m_bytes;
+
+        if (byte.data & 0x80) {
+            if (m_offset != m_size) {
+                fail("a message starts before the previous one is complete");
+            }
+            m_producer = (byte.data >> 4) & 7;
+            m_size     = byte.data & 0x0f;
+            m_offset   = 1;
+            m_timed    = byte.timed;
+            m_delay    = byte.delay_frames;
+            if (m_producer >= Producers || m_size < MinMessageSize || m_size > MaxMessageSize) {
+                fail("bad message header");
+                m_size = 1;
+            }
+            return;
+        }
+
+        if (m_offset == m_size) {
+            fail("a data byte outside of a message");
+            return;
+        }
+        if (byte.timed != m_timed || byte.delay_frames != m_delay) {
+            fail("the timing changes within a message");
+        }
+
+        switch (m_offset) {
+        case 1:
+            m_sequence = byte.data;
+            break;
+        case 2:
+            m_sequence |= (uint32_t)byte.data << 7;
+            break;
+        default:
+            if (byte.data != (m_sequence & 0x7f)) {
+                fail("a data byte from another message");
+            }
+            break;
+        }
+
+        if (++m_offset == m_size) {
+            end_message();
+        }
+    }
+
+    uint64_t messages() const { return m_messages; }
+    uint64_t bytes() const { return m_bytes; }
+    long     mismatches() const { return m_mismatches; }
+
+    // The last message of every producer must have arrived
+    void finish(int messages)
+    {
+        if (m_offset != m_size) {
+            fail("the last message is incomplete");
+        }
+        for (int producer = 0; producer < Producers; ++producer) {
+            if (m_next_sequence[producer] != (uint32_t)messages) {
+                fail("messages are missing");
+            }
+        }
+    }
+
+private:
+    void end_message()
+    {
+        ++m_messages;
+
+        // Only 14 bits of the sequence number are sent
+        const uint32_t expected = m_next_sequence[m_producer];
+        if (m_sequence != (expected & 0x3fff) || m_delay != (double)expected ||
+            m_timed != ((m_producer & 1) != 0) ||
+            m_size != MinMessageSize + expected % (MaxMessageSize - MinMessageSize + 1)) {
+            fail("a message is out of order or corrupted");
+        }
+        m_next_sequence[m_producer] = expected + 1;
+    }
+
+    void fail(const char* what)
+    {
+        if (++m_mismatches <= MaxReports) {
+            fprintf(stderr, "Byte %llu: %s\n", (unsigned long long)m_bytes, what);
+        }
+    }
+
+    uint32_t m_next_sequence[Producers]{};
+
+    int      m_producer = 0;
+    size_t   m_size     = 0;
+    size_t   m_offset   = 0;
+    uint32_t m_sequence = 0;
+    bool     m_timed    = false;
+    double   m_delay    = 0.0;
+
+    uint64_t m_messages   = 0;
+    uint64_t m_bytes      = 0;
+    long     m_mismatches = 0;
+};
+
+int main(int argc, char* argv[])
+{
+    const int messages = argc > 1 ? atoi(argv[1]) : DefaultMessages;
+
+    MidiInputQueue queue(QueueCapacity);
+
+    std::vector<ProducerResult> results(Producers);
+    std::atomic<int>            running{Producers};
+
+    std::vector<std::thread> threads;
+    for (int producer = 0; producer < Producers; ++producer) {
+        threads.emplace_back([&, producer] {
+            produce(queue, producer, messages, results[producer]);
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    Checker       checker;
+    MidiInputByte byte;
+    for (;;) {
+        // Read before peeking, so that nothing pushed before the last producer finished is missed
+        const bool done = running.load(std::memory_order_acquire) == 0;
+        if (queue.Peek(byte)) {
+            queue.Pop();
+            checker.check(byte);
+        } else if (done) {
+            break;
+        } else {
+            // Let the producers run on machines with few cores
+            std::this_thread::yield();
+        }
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    checker.finish(messages);
+
+    ProducerResult total;
+    for (const ProducerResult& result : results) {
+        total.pushed_messages += result.pushed_messages;
+        total.pushed_bytes += result.pushed_bytes;
+        total.failed_messages += result.failed_messages;
+        total.failed_bytes += result.failed_bytes;
+    }
+
+    bool ok = checker.mismatches() == 0;
+    if (checker.messages() != total.pushed_messages || checker.bytes() != total.pushed_bytes) {
+        fprintf(stderr,
+                "Pushed %llu messages (%llu bytes) but popped %llu (%llu bytes)\n",
+                (unsigned long long)total.pushed_messages,
+                (unsigned long long)total.pushed_bytes,
+                (unsigned long long)checker.messages(),
+                (unsigned long long)checker.bytes());
+        ok = false;
+    }
+    if (queue.GetDroppedMessages() != total.failed_messages || queue.GetDroppedBytes() != total.failed_bytes) {
+        fprintf(stderr,
+                "%llu pushes (%llu bytes) failed but the queue counted %llu (%llu bytes)\n",
+                (unsigned long long)total.failed_messages,
+                (unsigned long long)total.failed_bytes,
+                (unsigned long long)queue.GetDroppedMessages(),
+                (unsigned long long)queue.GetDroppedBytes());
+        ok = false;
+    }
+
+    if (!ok) {
+        return 1;
+    }
+    printf("%llu messages from %d producers arrived intact, %llu pushes were dropped and counted\n",
+           (unsigned long long)total.pushed_messages,
+           Producers,
+           (unsigned long long)total.failed_messages);
+    return 0;
+}
@@ -0,0 +1,535 @@
+// Renders Standard MIDI Files to WAV files without a plugin host, e.g. to
+// batch-convert whole soundtracks from a script.
+//
+// Usage: nuked-sc55-render [options] FILE...
+//
+// Options:
+//   -d, --rom-directory DIR     Directory containing the romset (required)
+//   -r, --romset NAME           Romset to load (default: mk2)
+//   -o, --output-directory DIR  Where to write the WAV files (default: next
+//                               to each MIDI file)
+//   -s, --sample-rate HZ        Output sample rate; 0 keeps the native rate
+//                               of the emulator (default: 0)
+//       --resampler NAME        Resampler used for other rates, see
+//                               resampler.h (default: Polyphase)
+//   -f, --format s16|f32        Sample format (default: s16)
+//       --reset gs|gm|none      Reset sent while booting (default: gs)
+//       --max-tail SECONDS      Longest time to keep rendering after the
+//                               last event while waiting for the sound to
+//                               die out (default: 30)
+//   -j, --jobs N                Files to render in parallel (default: number
+//                               of cores)
+//       --block-engine          Run the main MCU on the block engine
+//
+// Each worker thread has its own emulator, and all of them share a single
+// copy of the ROM images. The machine is booted once up front and every
+// song starts from a snapshot of the booted state, so the output doesn't
+// depend on which worker renders a song or in what order.
+//
+// In builds with NUKED_SC55_PROFILE, the profiler's totals are written as
+// JSON to the file named by NUKED_SC55_PROFILE_OUTPUT when all songs are done.
+// Likewise, NUKED_SC55_HOTSPOTS builds write the firmware hotspots to
+// NUKED_SC55_HOTSPOT_OUTPUT (see hotspot.h).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "nuked-sc55/backend/emu.h"
+#include "nuked-sc55/backend/hotspot.h"
+#include "nuked-sc55/backend/profile.h"
+#include "nuked-sc55/common/rom_image_cache.h"
+#include "nuked-sc55/common/smf.h"
+#include "nuked-sc55/common/wav_writer.h"
+#include "resampler.h"
+
+// Emulator frames rendered per RenderFrames() call
+constexpr size_t ChunkFrames = 4096;
+
+struct RenderOptions {
+    std::filesystem::path rom_dir    = {};
+    std::string romset               = "mk2";
+    std::filesystem::path output_dir = {};
+
+    uint32_t sample_rate_hz      = 0;
+    ResamplerType resampler_type = ResamplerType::Polyphase;
+    common::WavFormat format     = common::WavFormat::S16;
+    EMU_SystemReset reset        = EMU_SystemReset::GS_RESET;
+    double max_tail_secs         = 30.0;
+    uint32_t num_jobs            = 0;
+    bool block_engine            = false;
+
+    std::vector<std::filesystem::path> inputs = {};
+};
+
+static void print_usage()
+{
+    fprintf(stderr,
+            "Usage: nuked-sc55-render [options] FILE...\n"
+            "\n"
+            "Options:\n"
+            "  -d, --rom-directory DIR     Directory containing the romset (required)\n"
+            "  -r, --romset NAME           Romset to load (default: mk2)\n"
+            "  -o, --output-directory DIR  Where to write the WAV files (default: next\n"
+            "                              to each MIDI file)\n"
+            "  -s, --sample-rate HZ        Output sample rate; 0 keeps the native rate\n"
+            "                              of the emulator (default: 0)\n"
+            "      --resampler NAME        Speex, Polyphase, Cubic or Linear\n"
+            "                              (default: Polyphase)\n"
+            "  -f, --format s16|f32        Sample format (default: s16)\n"
+            "      --reset gs|gm|none      Reset sent while booting (default: gs)\n"
+            "      --max-tail SECONDS      Longest time to keep rendering after the last\n"
+            "                              event (default: 30)\n"
+            "  -j, --jobs N                Files to render in parallel (default: number\n"
+            "                              of cores)\n"
+            "      --block-engine          Run the main MCU on the block engine\n");
+}
+
+static bool parse_args(int argc, char* argv[], RenderOptions& opts)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+
+        const auto next_value = [&]() -> std::optional<std::string_view> {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", argv[i]);
+                return {};
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            return false;
+
+        } else if (arg == "-d" || arg == "--rom-directory") {
+            const auto value = next_value();
+            if (!value) {
+                return false;
+            }
+            opts.rom_dir = std::filesystem::path(*value);
+
+        } else if (arg == "-r" || arg == "--romset") {
+            const auto value = next_value();
+            if (!value) {
+                return false;
+            }
+            opts.romset = *value;
+
+        } else if (arg == "-o" || arg == "--output-directory") {
+            const auto value = next_value();
+            if (!value) {
+                return false;
+            }
+            opts.output_dir = std::filesystem::path(*value);
+
+        } else if (arg == "-s" || arg == "--sample-rate") {
+            const auto value = next_value();
+            if (!value) {
+                return false;
+            }
+            opts.sample_rate_hz = static_cast<uint32_t>(
+                std::strtoul(std::string(*value).c_str(), nullptr, 10));
+
+        } else if (arg == "--resampler") {
+            const auto value = next_value();
+            if (!value) {
+                return false;
+            }
+            const auto type = resampler_type_from_string(*value);
+            if (!type) {
+                fprintf(stderr, "Unknown resampler: %s\n", std::string(*value).c_str());
+                return false;
+            }
+            opts.resampler_type = *type;
+
+        } else if (arg == "-f" || arg == "--format") {
+            const auto value = next_value();
+            if (!value) {
+                return false;
+            }
+            if (*value == "s16") {
+                opts.format = common::WavFormat::S16;
+            } else if (*value == "f32") {
+                opts.format = common::WavFormat::F32;
+            } else {
+                fprintf(stderr, "Unknown format: %s\n", std::string(*value).c_str());
+                return false;
+            }
+
+        } else if (arg == "--reset") {
+            const auto value = next_value();
+            if (!value) {
+                return false;
+            }
+            if (*value == "gs") {
+                opts.reset = EMU_SystemReset::GS_RESET;
+            } else if (*value == "gm") {
+                opts.reset = EMU_SystemReset::GM_RESET;
+            } else if (*value == "none") {
+                opts.reset = EMU_SystemReset::NONE;
+            } else {
+                fprintf(stderr, "Unknown reset: %s\n", std::string(*value).c_str());
+                return false;
+            }
+
+        } else if (arg == "--max-tail") {
+            const auto value = next_value();
+            if (!value) {
+                return false;
+            }
+            opts.max_tail_secs = std::max(
+                std::strtod(std::string(*value).c_str(), nullptr), 0.0);
+
+        } else if (arg == "-j" || arg == "--jobs") {
+            const auto value = next_value();
+            if (!value) {
+                return false;
+            }
+            opts.num_jobs = static_cast<uint32_t>(
+                std::strtoul(std::string(*value).c_str(), nullptr, 10));
+
+        } else if (arg == "--block-engine") {
+            opts.block_engine = true;
+
+        } else if (arg.starts_with("-")) {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return false;
+
+        } else {
+            opts.inputs.emplace_back(arg);
+        }
+    }
+
+    if (opts.rom_dir.empty()) {
+        fprintf(stderr, "No ROM directory given\n");
+        return false;
+    }
+    if (opts.inputs.empty()) {
+        fprintf(stderr, "No input files given\n");
+        return false;
+    }
+    return true;
+}
+
+static std::filesystem::path get_output_path(const RenderOptions& opts,
+                                             const std::filesystem::path& input)
+{
+    auto output = opts.output_dir.empty() ? input
+                                          : opts.output_dir / input.filename();
+    output.replace_extension(".wav");
+    return output;
+}
+
+// Boots the machine the same way the plugin does, except for the choice of
+// reset, and returns the booted state
+static bool boot(const RenderOptions& opts,
+                 const std::shared_ptr<const RomImages>& rom_images,
+                 EMU_Snapshot& snapshot)
+{
+    Emulator emu;
+
+    if (!emu.Init(EMU_Options{}) || !emu.LoadRoms(rom_images)) {
+        return false;
+    }
+
+    emu.Boot(opts.reset);
+    emu.SaveSnapshot(snapshot);
+    return true;
+}
+
+struct RenderResult {
+    double audio_secs = 0.0;
+    // Messages that didn't fit into the MIDI queue. They are posted again
+    // after the next chunk, so they arrive late but aren't lost.
+    uint64_t queue_full_messages = 0;
+    uint64_t queue_full_bytes    = 0;
+    std::string error = {};
+};
+
+// Renders the song from `input` to `output` on `emu`, starting from the
+// booted state. Keeps rendering after the last event until the emulator
+// has gone silent, or for at most `max_tail_secs`.
+static RenderResult render_file(Emulator& emu, const EMU_Snapshot& boot_snapshot,
+                                const RenderOptions& opts,
+                                const std::filesystem::path& input,
+                                const std::filesystem::path& output)
+{
+    RenderResult result = {};
+
+    common::SmfData smf = {};
+    if (const auto err = common::LoadSmf(input, smf); err != common::SmfError{}) {
+        result.error = common::ToCString(err);
+        return result;
+    }
+
+    // The previous song may have left bytes behind if it hit the tail limit
+    auto& midi_queue = emu.GetMIDIQueue();
+    for (MidiInputByte byte; midi_queue.Peek(byte);) {
+        midi_queue.Pop();
+    }
+
+    // The counters cover the emulator's lifetime, which spans several songs
+    const uint64_t dropped_messages_before = midi_queue.GetDroppedMessages();
+    const uint64_t dropped_bytes_before    = midi_queue.GetDroppedBytes();
+
+    if (!emu.RestoreSnapshot(boot_snapshot)) {
+        result.error = "Failed to restore the booted state";
+        return result;
+    }
+
+    const double render_rate_hz = PCM_GetOutputFrequency(emu.GetPCM());
+
+    const uint32_t out_rate_hz = opts.sample_rate_hz
+                                   ? opts.sample_rate_hz
+                                   : static_cast<uint32_t>(std::lround(render_rate_hz));
+
+    std::unique_ptr<Resampler> resampler = nullptr;
+    if (opts.sample_rate_hz && opts.sample_rate_hz != std::lround(render_rate_hz)) {
+        resampler = create_resampler(opts.resampler_type, render_rate_hz, out_rate_hz);
+        if (!resampler) {
+            result.error = "Failed to create the resampler";
+            return result;
+        }
+    }
+
+    common::WavWriter wav;
+    if (!wav.Open(output, out_rate_hz, opts.format)) {
+        result.error = "Failed to open the output file";
+        return result;
+    }
+
+    std::vector<float> left(ChunkFrames);
+    std::vector<float> right(ChunkFrames);
+
+    const auto max_out_frames = static_cast<size_t>(
+        std::ceil(ChunkFrames * out_rate_hz / render_rate_hz)) + 256;
+
+    std::vector<float> out_left(resampler ? max_out_frames : 0);
+    std::vector<float> out_right(resampler ? max_out_frames : 0);
+
+    const auto max_tail_frames = static_cast<uint64_t>(opts.max_tail_secs * render_rate_hz);
+
+    uint64_t rendered_frames = 0;
+    uint64_t tail_frames     = 0;
+    size_t next_event        = 0;
+
+    for (;;) {
+        // Every event is scheduled at the exact emulator frame of its time
+        const auto chunk_end = static_cast<double>(rendered_frames + ChunkFrames);
+
+        while (next_event < smf.events.size()) {
+            const auto& event  = smf.events[next_event];
+            const double frame = event.time * render_rate_hz;
+            if (frame >= chunk_end) {
+                break;
+            }
+
+            const auto message = smf.GetMessage(event);
+
+            // Can never fit into the queue
+            if (message.size() > EMU_MIDI_QUEUE_SIZE) {
+                ++next_event;
+                continue;
+            }
+            // The queue is full of earlier bytes; try again after rendering
+            if (!emu.PostMIDI(message, frame - static_cast<double>(rendered_frames))) {
+                break;
+            }
+            ++next_event;
+        }
+
+        emu.RenderFrames(left.data(), right.data(), ChunkFrames);
+        rendered_frames += ChunkFrames;
+
+        if (resampler) {
+            const float* in_left  = left.data();
+            const float* in_right = right.data();
+            uint32_t in_remaining = ChunkFrames;
+
+            while (in_remaining > 0) {
+                uint32_t in_len  = in_remaining;
+                uint32_t out_len = static_cast<uint32_t>(out_left.size());
+
+                {
+                    PROFILE_SCOPE(RESAMPLE);
+                    resampler->Process(in_left, in_right, in_len,
+                                       out_left.data(), out_right.data(), out_len);
+                }
+
+                wav.Write(out_left.data(), out_right.data(), out_len);
+
+                if (in_len == 0 && out_len == 0) {
+                    break;
+                }
+                in_left += in_len;
+                in_right += in_len;
+                in_remaining -= in_len;
+            }
+        } else {
+            wav.Write(left.data(), right.data(), ChunkFrames);
+        }
+
+        if (next_event == smf.events.size()) {
+            tail_frames += ChunkFrames;
+            if (emu.IsSilent() || tail_frames >= max_tail_frames) {
+                break;
+            }
+        }
+    }
+
+    result.audio_secs = static_cast<double>(wav.GetFramesWritten()) / out_rate_hz;
+    result.queue_full_messages = midi_queue.GetDroppedMessages() - dropped_messages_before;
+    result.queue_full_bytes    = midi_queue.GetDroppedBytes() - dropped_bytes_before;
+
+    if (!wav.Close()) {
+        result.error = "Failed to write the output file";
+    }
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    RenderOptions opts = {};
+    if (!parse_args(argc, argv, opts)) {
+        print_usage();
+        return 1;
+    }
+
+    std::shared_ptr<const RomImages> rom_images = {};
+
+    const auto err = common::LoadRomImages(opts.rom_dir, opts.romset, {}, rom_images);
+    if (err != common::LoadRomsetError{}) {
+        fprintf(stderr, "Failed to load romset '%s' from %s: %s\n",
+                opts.romset.c_str(),
+                opts.rom_dir.string().c_str(),
+                common::ToCString(err));
+
+        if (err == common::LoadRomsetError::InvalidRomsetName) {
+            fprintf(stderr, "Valid romsets:");
+            for (const char* name : GetParsableRomsetNames()) {
+                fprintf(stderr, " %s", name);
+            }
+            fprintf(stderr, "\n");
+        }
+        return 1;
+    }
+
+    if (!opts.output_dir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(opts.output_dir, ec);
+    }
+
+    fprintf(stderr, "Booting %s...\n", RomsetName(rom_images->romset));
+
+    EMU_Snapshot boot_snapshot = {};
+    if (!boot(opts, rom_images, boot_snapshot)) {
+        fprintf(stderr, "Failed to boot the emulator\n");
+        return 1;
+    }
+
+    const auto num_files = opts.inputs.size();
+
+    auto num_jobs = opts.num_jobs ? opts.num_jobs : std::thread::hardware_concurrency();
+    num_jobs      = std::clamp<uint32_t>(num_jobs, 1, static_cast<uint32_t>(num_files));
+
+    std::atomic<size_t> next_file = 0;
+    std::atomic<size_t> num_done  = 0;
+    std::atomic<size_t> num_ok    = 0;
+    std::mutex print_mutex        = {};
+
+    // Guarded by print_mutex
+    uint64_t total_queue_full_messages = 0;
+    uint64_t total_queue_full_bytes    = 0;
+
+    const auto worker = [&]() {
+        Emulator emu;
+
+        const EMU_Options emu_opts = {
+            .lcd_backend    = nullptr,
+            .nvram_filename = std::filesystem::path{},
+            .block_engine   = opts.block_engine};
+        if (!emu.Init(emu_opts) || !emu.LoadRoms(rom_images)) {
+            std::lock_guard lock(print_mutex);
+            fprintf(stderr, "Failed to initialize an emulator\n");
+            return;
+        }
+
+        for (size_t i = next_file++; i < num_files; i = next_file++) {
+            const auto& input = opts.inputs[i];
+            const auto output = get_output_path(opts, input);
+
+            const auto start  = std::chrono::steady_clock::now();
+            const auto result = render_file(emu, boot_snapshot, opts, input, output);
+            const auto end    = std::chrono::steady_clock::now();
+
+            const auto elapsed_secs = std::chrono::duration<double>(end - start).count();
+
+            std::lock_guard lock(print_mutex);
+
+            const auto done = ++num_done;
+
+            if (!result.error.empty()) {
+                fprintf(stderr, "[%zu/%zu] %s: %s\n",
+                        done, num_files,
+                        input.string().c_str(),
+                        result.error.c_str());
+            } else {
+                ++num_ok;
+                fprintf(stderr, "[%zu/%zu] %s -> %s (%.1f s, %.1fx realtime)\n",
+                        done, num_files,
+                        input.string().c_str(),
+                        output.string().c_str(),
+                        result.audio_secs,
+                        result.audio_secs / std::max(elapsed_secs, 1e-9));
+                if (result.queue_full_messages) {
+                    fprintf(stderr, "[%zu/%zu] %s: MIDI queue was full for %" PRIu64
+                            " messages (%" PRIu64 " bytes), they were delayed\n",
+                            done, num_files,
+                            input.string().c_str(),
+                            result.queue_full_messages,
+                            result.queue_full_bytes);
+                }
+                total_queue_full_messages += result.queue_full_messages;
+                total_queue_full_bytes += result.queue_full_bytes;
+            }
+        }
+
+        // Resampling of the last chunk isn't published by the emulator
+        PROFILE_Publish();
+    };
+
+    std::vector<std::thread> threads = {};
+    for (uint32_t i = 1; i < num_jobs; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    PROFILE_WriteToEnvPath();
+    HOTSPOT_WriteToEnvPath();
+
+    fprintf(stderr, "MIDI queue overflows: %" PRIu64 " messages (%" PRIu64 " bytes) delayed\n",
+            total_queue_full_messages,
+            total_queue_full_bytes);
+
+    if (num_ok < num_files) {
+        fprintf(stderr, "%zu of %zu files failed\n", num_files - num_ok, num_files);
+        return 1;
+    }
+    return 0;
+}
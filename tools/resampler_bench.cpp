@@ -0,0 +1,220 @@
+// Measures the speed and quality of every resampler in src/resampler.h for
+// the render rates of the emulator and common host rates.
+//
+// Usage: nuked-sc55-resampler-bench [in_rate_hz out_rate_hz]
+//
+// For each resampler it reports:
+//
+//   cpu      Milliseconds of CPU time per second of resampled audio
+//   ripple   Largest gain deviation of sines in the passband, in dB
+//   alias    Level of the strongest unwanted component (aliases, images,
+//            interpolation error) in dB relative to the input, for sines in
+//            the passband and, when downsampling, for sines that would
+//            alias into the passband
+//
+// The passband is what survives a 20 kHz audio band, capped at 85% of the
+// lower Nyquist frequency of the two rates.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <numbers>
+#include <random>
+#include <vector>
+
+#include "resampler.h"
+
+// Output frames per Process() call, like a typical host block
+constexpr uint32_t BlockFrames = 512;
+
+// Resamples `in` in the same way the plugin does, one output block at a
+// time, feeding exactly as much input as the resampler consumes
+static std::vector<float> resample(Resampler& resampler, const std::vector<float>& in,
+                                   const double ratio, const size_t out_frames)
+{
+    std::vector<float> out(out_frames);
+    std::vector<float> out_right(out_frames);
+
+    size_t in_pos  = 0;
+    size_t out_pos = 0;
+
+    while (out_pos < out_frames) {
+        auto out_len = static_cast<uint32_t>(std::min<size_t>(BlockFrames, out_frames - out_pos));
+        auto in_len = static_cast<uint32_t>(std::min<size_t>(
+            static_cast<size_t>(std::ceil(out_len * ratio)) + 64, in.size() - in_pos));
+
+        resampler.Process(in.data() + in_pos, in.data() + in_pos, in_len,
+                          out.data() + out_pos, out_right.data() + out_pos, out_len);
+
+        in_pos += in_len;
+        out_pos += out_len;
+
+        if (out_len == 0 && in_pos == in.size()) {
+            break;
+        }
+    }
+    return out;
+}
+
+static std::vector<float> sine(const double freq_hz, const double rate_hz, const size_t frames)
+{
+    std::vector<float> v(frames);
+    for (size_t i = 0; i < frames; ++i) {
+        v[i] = static_cast<float>(
+            0.5 * std::sin(2.0 * std::numbers::pi * freq_hz * static_cast<double>(i) / rate_hz));
+    }
+    return v;
+}
+
+struct ToneResult {
+    // Gain of the tone itself
+    double gain = 0.0;
+
+    // RMS of everything else, relative to the input RMS
+    double residual = 0.0;
+};
+
+// Fits a sine of `freq_hz` to the output with least squares and returns its
+// gain and the level of whatever is left over. The start and the end are
+// skipped to ignore the filter transients.
+static ToneResult analyze_tone(const std::vector<float>& out, const double freq_hz,
+                               const double rate_hz)
+{
+    const size_t skip = out.size() / 8;
+    const size_t n    = out.size() - 2 * skip;
+
+    double ss = 0.0, sc = 0.0, cc = 0.0, ys = 0.0, yc = 0.0, yy = 0.0;
+
+    for (size_t i = skip; i < skip + n; ++i) {
+        const double phase = 2.0 * std::numbers::pi * freq_hz * static_cast<double>(i) / rate_hz;
+        const double s = std::sin(phase);
+        const double c = std::cos(phase);
+        const double y = out[i];
+
+        ss += s * s;
+        sc += s * c;
+        cc += c * c;
+        ys += y * s;
+        yc += y * c;
+        yy += y * y;
+    }
+
+    ToneResult result = {};
+
+    // Tones above the output Nyquist frequency must be removed completely
+    double fitted_energy = 0.0;
+    if (freq_hz < rate_hz / 2.0) {
+        const double det = ss * cc - sc * sc;
+        const double a   = (ys * cc - yc * sc) / det;
+        const double b   = (yc * ss - ys * sc) / det;
+
+        result.gain   = std::sqrt(a * a + b * b) / 0.5;
+        fitted_energy = a * ys + b * yc;
+    }
+
+    const double input_rms    = 0.5 / std::sqrt(2.0);
+    const double residual_rms = std::sqrt(std::max(yy - fitted_energy, 0.0) / static_cast<double>(n));
+
+    result.residual = residual_rms / input_rms;
+    return result;
+}
+
+static double to_db(const double v)
+{
+    return 20.0 * std::log10(std::max(v, 1e-12));
+}
+
+static void bench(const ResamplerType type, const double in_rate_hz, const double out_rate_hz)
+{
+    const double ratio = in_rate_hz / out_rate_hz;
+
+    auto resampler = create_resampler(type, in_rate_hz, out_rate_hz);
+    if (!resampler) {
+        printf("  %-10s failed to create\n", resampler_type_to_string(type));
+        return;
+    }
+
+    // CPU time on 10 seconds of noise
+    constexpr double BenchSeconds = 10.0;
+
+    const auto out_frames = static_cast<size_t>(BenchSeconds * out_rate_hz);
+
+    std::vector<float> noise(static_cast<size_t>(BenchSeconds * in_rate_hz) + 1024);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+    for (auto& x : noise) {
+        x = dist(rng);
+    }
+
+    double best_ms = 1e30;
+    for (int run = 0; run < 3; ++run) {
+        resampler->Reset();
+
+        const auto start = std::chrono::steady_clock::now();
+        resample(*resampler, noise, ratio, out_frames);
+        const auto end = std::chrono::steady_clock::now();
+
+        best_ms = std::min(
+            best_ms, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    // Quality on sines
+    const double min_nyquist = std::min(in_rate_hz, out_rate_hz) / 2.0;
+    const double passband_hz = std::min(20000.0, 0.85 * min_nyquist);
+
+    constexpr size_t ToneFrames = 16384;
+
+    double ripple_db = 0.0;
+    double alias_db  = -300.0;
+
+    for (double freq = 50.0; freq < in_rate_hz / 2.0 * 0.99; freq *= 1.05) {
+        // Everything in between may only be attenuated, not removed
+        if (freq > passband_hz && freq < out_rate_hz - passband_hz) {
+            continue;
+        }
+
+        resampler->Reset();
+
+        const auto in  = sine(freq, in_rate_hz, static_cast<size_t>(ToneFrames * ratio) + 1024);
+        const auto out = resample(*resampler, in, ratio, ToneFrames);
+        const auto result = analyze_tone(out, freq, out_rate_hz);
+
+        if (freq <= passband_hz) {
+            ripple_db = std::max(ripple_db, std::abs(to_db(result.gain)));
+        }
+        alias_db = std::max(alias_db, to_db(result.residual));
+    }
+
+    printf("  %-10s cpu %7.3f ms/s   ripple %7.4f dB (to %5.0f Hz)   alias %7.1f dB\n",
+           resampler_type_to_string(type),
+           best_ms / BenchSeconds,
+           ripple_db,
+           passband_hz,
+           alias_db);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::pair<double, double>> rates = {};
+
+    if (argc == 3) {
+        rates.emplace_back(std::atof(argv[1]), std::atof(argv[2]));
+    } else {
+        // Render rates of the emulator with and without oversampling
+        for (const double in_rate_hz : {32000.0, 33103.5, 64000.0, 66207.0}) {
+            for (const double out_rate_hz : {44100.0, 48000.0, 96000.0}) {
+                rates.emplace_back(in_rate_hz, out_rate_hz);
+            }
+        }
+    }
+
+    for (const auto& [in_rate_hz, out_rate_hz] : rates) {
+        printf("%g Hz -> %g Hz\n", in_rate_hz, out_rate_hz);
+
+        for (uint32_t i = 0; i < NumResamplerTypes; ++i) {
+            bench(static_cast<ResamplerType>(i), in_rate_hz, out_rate_hz);
+        }
+    }
+    return 0;
+}
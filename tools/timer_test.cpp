@@ -0,0 +1,182 @@
+// Differential test of the timers. Runs two copies of the FRTs and the 8-bit
+// timer side by side: one advanced with TIMER_Clock, skipping ahead to the
+// deadlines it returns like the emulator does, and one advanced one tick at a
+// time with TIMER_ClockReference. Random register writes and reads are
+// replayed into both, and the interrupt requests, the values read back and the
+// final machine state must match.
+//
+// Usage: nuked-sc55-timer-test [seeds] [steps]
+//
+// Every seed is run for both the mk1 and the generic prescaler tables. No ROMs
+// are needed.
+//
+// Exit status: 0 if everything matched, 1 on a mismatch.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include "nuked-sc55/backend/emu.h"
+#include "nuked-sc55/backend/mcu.h"
+#include "nuked-sc55/backend/mcu_timer.h"
+
+constexpr int DefaultSeeds = 8;
+constexpr int DefaultSteps = 1'000'000;
+
+// Cycles between two calls to TIMER_Clock; about one instruction.
+constexpr uint64_t StepCycles = 12;
+
+// One in this many steps accesses a register.
+constexpr uint32_t AccessInterval = 200;
+
+// Mismatches reported per run before the rest are only counted.
+constexpr int MaxReports = 5;
+
+struct TimerRun {
+    int  mk1;
+    int  seed;
+    long mismatches = 0;
+
+    void report(long step, const char* what, uint32_t address, int fast, int reference)
+    {
+        if (++mismatches <= MaxReports) {
+            fprintf(stderr,
+                    "mk1=%d seed=%d step=%ld: %s %02x: TIMER_Clock %02x, reference %02x\n",
+                    mk1,
+                    seed,
+                    step,
+                    what,
+                    address,
+                    fast,
+                    reference);
+        }
+    }
+};
+
+// Picks an FRT register of one of the three timers.
+static uint32_t random_frt_address(std::mt19937& rng)
+{
+    return 0x10 + (rng() % 3) * 0x10 + rng() % 10;
+}
+
+// Picks a register of the 8-bit timer.
+static uint32_t random_tmr_address(std::mt19937& rng)
+{
+    return 0x50 + rng() % 5;
+}
+
+static long run(int mk1, int seed, int steps)
+{
+    Emulator fast_emu;
+    Emulator ref_emu;
+    if (!fast_emu.Init(EMU_Options{}) || !ref_emu.Init(EMU_Options{})) {
+        fprintf(stderr, "Failed to initialize the emulator\n");
+        exit(1);
+    }
+
+    mcu_t& fast_mcu = fast_emu.GetMCU();
+    mcu_t& ref_mcu  = ref_emu.GetMCU();
+    fast_mcu.is_mk1 = mk1;
+    ref_mcu.is_mk1  = mk1;
+
+    mcu_timer_t& fast = *fast_mcu.timer;
+    mcu_timer_t& ref  = *ref_mcu.timer;
+
+    TimerRun result{mk1, seed};
+
+    std::mt19937 rng((uint32_t)seed);
+    uint64_t     deadline = 0;
+
+    for (long step = 0; step < steps; ++step) {
+        fast_mcu.cycles += StepCycles;
+        ref_mcu.cycles += StepCycles;
+
+        if (fast_mcu.cycles >= deadline) {
+            deadline = TIMER_Clock(fast, fast_mcu.cycles);
+        }
+        TIMER_ClockReference(ref, ref_mcu.cycles, ref_mcu.interrupt_pending);
+
+        for (int i = 0; i < INTERRUPT_SOURCE_MAX; ++i) {
+            if (fast_mcu.interrupt_pending[i] != ref_mcu.interrupt_pending[i]) {
+                result.report(step, "interrupt", i, fast_mcu.interrupt_pending[i], ref_mcu.interrupt_pending[i]);
+                // Resynchronize so that a single mismatch isn't reported on every following step
+                fast_mcu.interrupt_pending[i] = ref_mcu.interrupt_pending[i];
+            }
+        }
+
+        if (rng() % AccessInterval != 0) {
+            continue;
+        }
+
+        uint8_t data = (uint8_t)rng();
+        // Keep the upper bits clear now and then, so that flags and interrupts don't stay enabled all the time
+        if (rng() % 3 == 0) {
+            data &= 0x0f;
+        }
+
+        switch (rng() % 4) {
+        case 0: {
+            const uint32_t address = random_frt_address(rng);
+            TIMER_Write(fast, address, data);
+            TIMER_Write(ref, address, data);
+            break;
+        }
+        case 1: {
+            const uint32_t address = random_tmr_address(rng);
+            TIMER2_Write(fast, address, data);
+            TIMER2_Write(ref, address, data);
+            break;
+        }
+        case 2: {
+            const uint32_t address = random_frt_address(rng);
+            const uint8_t  a       = TIMER_Read(fast, address);
+            const uint8_t  b       = TIMER_Read(ref, address);
+            if (a != b) {
+                result.report(step, "FRT read", address, a, b);
+            }
+            break;
+        }
+        case 3: {
+            const uint32_t address = random_tmr_address(rng);
+            const uint8_t  a       = TIMER_Read2(fast, address);
+            const uint8_t  b       = TIMER_Read2(ref, address);
+            if (a != b) {
+                result.report(step, "TMR read", address, a, b);
+            }
+            break;
+        }
+        }
+
+        // Register accesses change when the next interrupt can happen, which the emulator handles the same way
+        deadline = 0;
+    }
+
+    TIMER_Clock(fast, fast_mcu.cycles);
+    if (memcmp(&fast, &ref, TIMER_STATE_SIZE) != 0) {
+        ++result.mismatches;
+        fprintf(stderr, "mk1=%d seed=%d: timer state differs at the end\n", mk1, seed);
+    }
+
+    return result.mismatches;
+}
+
+int main(int argc, char* argv[])
+{
+    const int seeds = argc > 1 ? atoi(argv[1]) : DefaultSeeds;
+    const int steps = argc > 2 ? atoi(argv[2]) : DefaultSteps;
+
+    long mismatches = 0;
+    for (int mk1 = 0; mk1 < 2; ++mk1) {
+        for (int seed = 0; seed < seeds; ++seed) {
+            mismatches += run(mk1, seed, steps);
+        }
+    }
+
+    if (mismatches) {
+        fprintf(stderr, "%ld mismatches\n", mismatches);
+        return 1;
+    }
+    printf("Timers match the reference over %d seeds of %d steps\n", seeds, steps);
+    return 0;
+}